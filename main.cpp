@@ -6,18 +6,193 @@
 //
 //---------------------------------
 
+#ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#define popen _popen
+#define pclose _pclose
+#endif
 #include <math.h>
 #include <iostream>
 #include <time.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+//---------------------------------------------------------------------
+// PLATFORM LAYER (non-Windows builds)
+//---------------------------------------------------------------------
+// The game targets the Win32 console. On other platforms the few Win32
+// calls it uses are mapped onto POSIX and ANSI terminal output so the
+// headless tools (replay, benchmarks) build and run on Linux hosts.
+
+// Console attributes are IRGB; ANSI SGR colors are BGR
+int AnsiColor(int attr) {
+    static const int ansiColor[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+    return ((attr & 8) ? 90 : 30) + ansiColor[attr & 7];
+}
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+typedef unsigned long DWORD;
+typedef unsigned short WORD;
+typedef wchar_t WCHAR;
+typedef void* HANDLE;
+typedef int errno_t;
+
+struct COORD { short X, Y; };
+struct SMALL_RECT { short Left, Top, Right, Bottom; };
+struct CHAR_INFO {
+    union { WCHAR UnicodeChar; char AsciiChar; } Char;
+    WORD Attributes;
+};
+struct CONSOLE_CURSOR_INFO {
+    DWORD dwSize;
+    int bVisible;
+};
+
+#define VK_RETURN 0x0D
+#define VK_SHIFT 0x10
+#define VK_CONTROL 0x11
+#define VK_ESCAPE 0x1B
+#define VK_SPACE 0x20
+#define VK_LEFT 0x25
+#define VK_UP 0x26
+#define VK_RIGHT 0x27
+#define VK_DOWN 0x28
+#define VK_F1 0x70
+#define VK_F5 0x74
+#define VK_F9 0x78
+#define GENERIC_WRITE 0x40000000
+#define CONSOLE_TEXTMODE_BUFFER 1
+#define STD_OUTPUT_HANDLE ((DWORD)-11)
+
+DWORD GetTickCount() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+void Sleep(DWORD ms) { usleep(ms * 1000); }
+short GetAsyncKeyState(int) { return 0; }
+
+int SetConsoleCP(unsigned int) { return 1; }
+int SetConsoleOutputCP(unsigned int) { return 1; }
+HANDLE GetStdHandle(DWORD) { return (HANDLE)stdout; }
+HANDLE CreateConsoleScreenBuffer(DWORD, DWORD, void*, DWORD, void*) {
+    return (HANDLE)stdout;
+}
+
+int SetConsoleActiveScreenBuffer(HANDLE) {
+    // Alternate screen while the game buffer is active
+    static int active = 0;
+    active = !active;
+    fputs(active ? "\x1b[?1049h" : "\x1b[?1049l\x1b[?25h", stdout);
+    fflush(stdout);
+    return 1;
+}
+
+int SetConsoleCursorInfo(HANDLE, const CONSOLE_CURSOR_INFO* info) {
+    fputs(info->bVisible ? "\x1b[?25h" : "\x1b[?25l", stdout);
+    return 1;
+}
+
+int SetConsoleTitleA(const char* title) {
+    printf("\x1b]0;%s\x07", title);
+    return 1;
+}
+
+int WriteConsoleOutput(HANDLE, const CHAR_INFO* buffer, COORD size, COORD coord, SMALL_RECT* region) {
+    int lastAttr = -1;
+
+    for (int y = 0; y <= region->Bottom - region->Top; y++) {
+        printf("\x1b[%d;%dH", region->Top + y + 1, region->Left + 1);
+        for (int x = 0; x <= region->Right - region->Left; x++) {
+            const CHAR_INFO* cell = &buffer[(coord.Y + y) * size.X + coord.X + x];
+            int attr = cell->Attributes & 0x0F;
+            if (attr != lastAttr) {
+                printf("\x1b[%dm", AnsiColor(attr));
+                lastAttr = attr;
+            }
+            char c = (char)cell->Char.UnicodeChar;
+            putchar((c >= 32 && c < 127) ? c : ' ');
+        }
+    }
+    fputs("\x1b[0m", stdout);
+    fflush(stdout);
+    return 1;
+}
+
+// MSVC secure CRT functions used throughout the game
+errno_t fopen_s(FILE** file, const char* name, const char* mode) {
+    *file = fopen(name, mode);
+    return *file ? 0 : 1;
+}
+
+int strcpy_s(char* dst, size_t size, const char* src) {
+    snprintf(dst, size, "%s", src);
+    return 0;
+}
+
+template <size_t N>
+int strcpy_s(char (&dst)[N], const char* src) { return strcpy_s(dst, N, src); }
+
+int strcat_s(char* dst, size_t size, const char* src) {
+    size_t len = strlen(dst);
+    if (len < size) snprintf(dst + len, size - len, "%s", src);
+    return 0;
+}
+
+int sprintf_s(char* buf, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buf, size, format, args);
+    va_end(args);
+    return written;
+}
+
+template <size_t N>
+int sprintf_s(char (&buf)[N], const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buf, N, format, args);
+    va_end(args);
+    return written;
+}
+
+#define sscanf_s sscanf
+#endif
 
 #define WIDTH 120
 #define HEIGHT 40
-#define MAX_POINTS 1000
-#define MAX_STICKS 1000
+#define MAX_POINTS 4096
+#define MAX_STICKS 4096
 #define MAX_BOXES 20
+#define MAX_TARGETS 5
 #define MAX_PARTICLES 150
 
 // Game Constants
@@ -40,9 +215,157 @@ const float SHAKE_DECAY = 0.15f;
 const float EXPLOSION_RADIUS = 15.0f;
 const float EXPLOSION_POWER = 2.5f;
 const float BLUR_SPEED_THRESHOLD = 2.0f;
-const int MAX_UNDO_STATES = 5;
+const int MAX_UNDO_STATES = 512;
+const int UNDO_MEMORY_BUDGET = 512 * 1024;
 const int MAX_SHOP_ITEMS = 8;
 const char SAVE_FILE[] = "game_save.txt";
+const char SAVE_TEMP_FILE[] = "game_save.txt.tmp";
+const int SAVE_FLUSH_MS = 2000;
+const int KEY_DEBOUNCE_MS = 50;         // a second press sooner than this is contact chatter
+const int KEY_REPEAT_DELAY_MS = 400;
+const int KEY_REPEAT_INTERVAL_MS = 80;
+const int PULSE_WAKE_MS = 100;          // idle redraw rate while mission targets pulse
+const DWORD MAX_FRAME_MS = 100;         // one frame never covers more, however long the loop idled
+const int SIM_RATE = 30;                // world steps per second, whatever --fps presents at
+const int MAX_FRAME_STEPS = 4;          // catch-up steps in one frame; time beyond is dropped
+const int SIM_STEP_SLACK = 250;         // a quarter step, in the simClock units below
+
+// Sound
+const int SOUND_PLACE = 0;
+const int SOUND_BREAK = 1;
+const int SOUND_EXPLOSION = 2;
+const int SOUND_SUCCESS = 3;
+const int SOUND_FAILURE = 4;
+const int SOUND_CLICK = 5;
+const int SOUND_DRAG = 6;
+const int SOUND_COIN = 7;
+const int SOUND_COUNT = 8;
+const int SOUND_SAMPLE_RATE = 22050;
+const int SOUND_AMPLITUDE = 4000;
+const int SOUND_MERGE_MS = 80;
+const int SOUND_CATEGORY_UI = 0;
+const int SOUND_CATEGORY_EFFECT = 1;
+const int SOUND_CATEGORY_JINGLE = 2;
+const int SOUND_CATEGORY_COUNT = 3;
+
+// Input log format
+const char REPLAY_MAGIC[] = "RGRP";
+const int REPLAY_VERSION = 1;
+const int INPUT_LOG_OFF = 0;
+const int INPUT_LOG_RECORD = 1;
+const int INPUT_LOG_REPLAY = 2;
+const int INPUT_LOG_SCRIPT = 3;         // keys set by code, nothing logged
+const char REPLAY_TAG_FRAME = 'F';
+const char REPLAY_TAG_SEED = 'S';
+const char REPLAY_TAG_END = 'E';
+const char REPLAY_TAG_STEPS = 'T';
+
+// Pickups
+const int PICKUP_NONE = 0;
+const int PICKUP_COIN = 1;
+const float PICKUP_RADIUS = 3.0f;
+const int pickupValues[] = { 0, 10 };
+
+// Entities
+const int ENTITY_RAGDOLL = 0;
+const int ENTITY_ROPE = 1;
+const int ENTITY_BOX = 2;
+const int ENTITY_BOMB = 3;
+const int ENTITY_COIN = 4;
+const int ENTITY_PLATFORM = 5;
+const int ENTITY_KIND_COUNT = 6;
+
+// Pick filters: one bit per entity kind, plus loose points
+const int PICK_LOOSE = 1 << ENTITY_KIND_COUNT;
+const int PICK_ANY = (1 << (ENTITY_KIND_COUNT + 1)) - 1;
+const float PICK_CELL_SIZE = 4.0f;
+
+// Ragdoll parts and bones in spawn order, as offsets into the entity ranges
+const int PART_HEAD = 0;
+const int PART_NECK = 1;
+const int PART_CHEST = 2;
+const int PART_HIPS = 3;
+const int PART_LEFT_HAND = 4;
+const int PART_RIGHT_HAND = 5;
+const int PART_LEFT_KNEE = 6;
+const int PART_RIGHT_KNEE = 7;
+const int PART_LEFT_FOOT = 8;
+const int PART_RIGHT_FOOT = 9;
+const int RAGDOLL_PARTS = 10;
+const int BONE_NECK = 0;
+const int BONE_SPINE = 1;
+const int BONE_WAIST = 2;
+const int BONE_LEFT_ARM = 3;
+const int BONE_RIGHT_ARM = 4;
+const int BONE_LEFT_THIGH = 5;
+const int BONE_RIGHT_THIGH = 6;
+const int BONE_LEFT_SHIN = 7;
+const int BONE_RIGHT_SHIN = 8;
+const int RAGDOLL_BONES = 9;
+
+// Hangman dictionary
+const unsigned int COMMON_LETTER_MASK = 0x1e6999;  // E T A O I N S H R D L U
+const int DICT_EASY = 0;
+const int DICT_MEDIUM = 1;
+const int DICT_HARD = 2;
+
+// Mission solver
+const int SOLVER_FRAME_MS = 33;
+const unsigned int SOLVER_REPLAY_SEED = 12345;
+const int SOLVER_KEY_LEFT = 1;
+const int SOLVER_KEY_RIGHT = 2;
+const int SOLVER_KEY_UP = 4;
+const int SOLVER_KEY_DOWN = 8;
+const int SOLVER_KEY_SHIFT = 16;
+const int SOLVER_KEY_RETURN = 32;
+const int SOLVER_KEY_DRAG = 64;
+const int SOLVER_KEY_COUNT = 7;
+const int SOLVE_APPROACH = 0;
+const int SOLVE_DRAG = 1;
+const int SOLVE_IDLE = 2;
+
+// Mission balancing
+const float BALANCE_JITTER = 0.3f;         // cells of random offset per free point
+const int BALANCE_COMPLETE = 0;
+const int BALANCE_BROKEN = 1;
+const int BALANCE_TIMEOUT = 2;
+const int BALANCE_UNFINISHED = 3;
+const int BALANCE_OUTCOME_COUNT = 4;
+const int BALANCE_COIN_BUCKET_SIZE = 25;
+
+// World snapshot format
+const char SNAPSHOT_MAGIC[] = "RGWS";
+const int SNAPSHOT_VERSION = 3;
+const unsigned int SNAPSHOT_ENDIAN_TAG = 0x01020304;
+const char SNAPSHOT_FILE[] = "sandbox.rgw";
+const int SNAP_POINTS = 0;
+const int SNAP_STICKS = 1;
+const int SNAP_BOXES = 2;
+const int SNAP_TARGETS = 3;
+const int SNAP_PARTICLES = 4;
+const int SNAP_ENTITIES = 5;
+const int SNAP_SECTION_COUNT = 6;
+
+// Level streaming
+const char STREAM_MAGIC[] = "RGST";
+const int STREAM_VERSION = 3;
+const char STREAM_SWAP_FILE[] = "stream_swap.tmp";
+const int CHUNK_WIDTH = 64;
+const int CHUNK_RESIDENT_RADIUS = 2;    // chunks simulated on each side of the focus
+
+// Mission files
+const char MISSION_DIR[] = "missions";
+const char LEVEL_CACHE_MAGIC[] = "RGLC";
+const int LEVEL_CACHE_VERSION = 2;
+const int LEVEL_OP_RAGDOLL = 0;
+const int LEVEL_OP_BOX = 1;
+const int LEVEL_OP_PLATFORM = 2;
+const int LEVEL_OP_BOMB = 3;
+const int LEVEL_OP_COIN = 4;
+const int LEVEL_OP_TARGET = 5;
+const int LEVEL_OP_POINT = 6;
+const int LEVEL_OP_STICK = 7;
+const int LEVEL_OP_PUSH = 8;
 
 // Colors
 const int COLOR_BLACK = 0;
@@ -79,7 +402,46 @@ struct InputManager {
     int keys[256];
     int keysPressed[256];
     int keysReleased[256];
-    DWORD lastKeyTime[256];
+    DWORD lastKeyTime[256];     // last accepted press, on the input clock
+    int keysRepeated[256];      // a press, or a repeat tick while held
+    DWORD nextRepeatTime[256];
+    DWORD now;                  // step time in ms; replays advance it by the recorded frame times
+};
+
+// Input Queue
+// A reader thread turns key events into timestamped commands on a
+// single-producer ring; UpdateInputManager drains it at the start of each
+// step. On Linux the reader decodes raw terminal bytes, on Windows it
+// samples GetAsyncKeyState every millisecond.
+#define INPUT_RING_SIZE 256
+#define INPUT_LATENCY_SAMPLES 4096
+const int INPUT_ESCAPE_MS = 25;     // a lone ESC is a key once nothing follows it
+
+struct InputCommand {
+    long long timeNs;
+    unsigned char key;
+    unsigned char down;         // terminals only report presses: a tap is down then up
+};
+
+struct InputQueue {
+    InputCommand items[INPUT_RING_SIZE];
+    std::atomic<int> head;      // next slot the reader fills
+    std::atomic<int> tail;      // next slot the game drains
+    std::atomic<int> stop;
+    std::atomic<int> dropped;
+    std::thread reader;
+    std::mutex wakeLock;
+    std::condition_variable wake;   // an idle game loop waits here for keys
+    int running;
+    int fd;                     // terminal or benchmark pipe (POSIX)
+#ifndef _WIN32
+    struct termios savedMode;
+    int rawMode;
+#endif
+    unsigned char keys[256];        // state after the commands drained so far
+    unsigned char frameKeys[256];   // what PollKey reports this step
+    int latencyUs[INPUT_LATENCY_SAMPLES];
+    int latencyCount;           // every sample taken; the array keeps the latest
 };
 
 // Sound Manager
@@ -87,6 +449,240 @@ struct SoundManager {
     int enabled;
 };
 
+// Sound Engine
+// PlaySound*() posts an event id into a lock-free SPSC ring; a dedicated
+// audio thread turns events into voices, mixes them to PCM and hands
+// each block to the selected sink.
+#define SOUND_QUEUE_SIZE 64
+#define SOUND_BLOCK_SAMPLES 512
+#define MAX_VOICES 8
+
+struct ToneStep {
+    int freq;
+    int ms;
+};
+
+struct SoundDef {
+    ToneStep steps[3];
+    int stepCount;
+    int category;
+    int priority;           // higher wins a voice when its category is full
+};
+
+struct Voice {
+    int active;
+    int sound;
+    int step;
+    int samplesLeft;
+    float phase;
+    long long startClock;
+};
+
+struct SoundSink {
+    const char* name;
+    int (*open)(const char* arg);
+    void (*write)(const short* samples, int count);
+    void (*close)();
+    int paced;              // write() blocks at device rate
+};
+
+struct SoundEngine {
+    unsigned char queue[SOUND_QUEUE_SIZE];
+    std::atomic<int> head;
+    std::atomic<int> tail;
+    std::atomic<int> stop;
+    int running;
+    Voice voices[MAX_VOICES];
+    long long clock;                        // samples mixed so far
+    long long lastStart[SOUND_COUNT];
+    std::atomic<int> activeVoices;
+    std::atomic<int> eventsMerged;
+    std::atomic<int> eventsDropped;         // never played
+    std::atomic<int> voicesPreempted;       // cut short by a louder event
+    const SoundSink* sink;
+    std::thread thread;
+};
+
+// Asciicast Recorder
+// Frames are diffed against the last queued frame, encoded straight into
+// a fixed ring of slots on the main thread and written by a background
+// thread. A full ring drops the frame instead of waiting on the disk.
+#define CAST_SLOTS 16
+#define CAST_SLOT_BYTES (WIDTH * HEIGHT * 28 + 64)
+struct CastRecorder {
+    FILE* file;
+    char prevChars[WIDTH * HEIGHT];
+    int prevColors[WIDTH * HEIGHT];
+    int termColor;
+    char slots[CAST_SLOTS][CAST_SLOT_BYTES];
+    int slotSize[CAST_SLOTS];
+    std::atomic<int> head;      // next slot the game fills
+    std::atomic<int> tail;      // next slot the writer drains
+    std::atomic<int> stop;
+    std::thread writer;
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    long long startNs;
+    long long captureNs;
+    int framesCaptured;
+    int framesDropped;
+    std::atomic<long long> bytesWritten;
+};
+
+// Frame Trace
+// --frame-trace writes one CSV row per frame: the time since the previous
+// frame started, the time the game thread spent on this one and the key
+// presses it handled, so input hitches show up as spikes.
+struct FrameTrace {
+    FILE* file;
+    int frames;
+    int pressFrames;
+    long long maxWorkNs;
+    long long maxPressWorkNs;   // worst frame that handled a key press
+    DWORD maxFrameMs;
+};
+
+// Frame Pacer
+// Frame starts sit on a grid of deadlines on the nanosecond clock. The
+// pacer sleeps until PACE_SPIN_NS before a deadline and yields the rest of
+// the way, since a sleep can overshoot by a scheduler tick.
+#define PACE_SAMPLES 1024
+const long long PACE_SPIN_NS = 2000000;
+
+struct FramePacer {
+    long long periodNs;
+    long long deadlineNs;       // next frame start, 0 to follow the last start
+    long long lastStartNs;      // 0 until the first frame after a reset
+    int intervalUs[PACE_SAMPLES];   // start to start, latest samples
+    int sampleCount;            // every sample taken
+    int lateFrames;             // frames that ran past their deadline
+    long long spinNs;
+};
+
+// Time Histograms
+// Log-bucketed like HdrHistogram: 16 linear sub-buckets per power of two
+// of microseconds, so any value lands within about 3% of its bucket. The
+// window counts follow the latest TIME_WINDOW samples for the HUD; the
+// session counts are what --time-histogram writes on exit.
+#define TIME_BUCKETS 448
+#define TIME_WINDOW 512
+const int TIME_SUB_BITS = 4;
+
+// Render times come from the render thread, so every field is a relaxed
+// atomic: recording never blocks, and a reader may see a sample half added.
+struct TimeHistogram {
+    const char* name;
+    std::atomic<int> window[TIME_WINDOW];           // latest samples in us
+    std::atomic<long long> windowCounts[TIME_BUCKETS];
+    std::atomic<long long> sessionCounts[TIME_BUCKETS];
+    std::atomic<long long> sampleCount;
+    std::atomic<int> sessionMaxUs;
+};
+
+// Performance Counters
+// With --perf-counters each thread that runs a phase opens one Linux
+// perf_event group for itself (counters follow the thread, not the CPU)
+// and reads it once before and once after the phase. Events the kernel
+// or the machine refuses are left out; if even cycles cannot be opened,
+// the layer reports why and stays off.
+#define PERF_EVENTS 5
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES };
+enum { PHASE_SOLVER, PHASE_PARTICLES, PHASE_RENDER, PHASE_COUNT };
+enum { PERF_OFF, PERF_ON, PERF_NO_CYCLES, PERF_NOT_LINUX };
+
+struct PerfGroup {
+    int state;                  // 0 not tried, 1 open, -1 unavailable
+    int fds[PERF_EVENTS];
+    int slot[PERF_EVENTS];      // position in the group read, -1 if refused
+    int members;
+};
+
+struct PerfSample {
+    long long values[PERF_EVENTS];
+    int valid;
+};
+
+struct PhaseCounters {
+    const char* name;
+    std::atomic<long long> values[PERF_EVENTS];
+    std::atomic<long long> runs;
+    std::atomic<long long> points;      // world points per run, summed
+};
+
+// Metrics
+// A fixed table of counters, gauges and histograms. The game updates them
+// with relaxed atomic adds and stores only; the exporter thread reads them
+// and writes Prometheus text format, either to a file (replaced through a
+// rename, so a scraper never reads half of it) or to each client that
+// connects to a Unix socket.
+#define METRIC_BUCKETS 12
+enum { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+enum {
+    METRIC_STEPS, METRIC_BREAKS, METRIC_EXPLOSIONS, METRIC_PARTICLE_SPAWNS, METRIC_PARTICLES_DROPPED,
+    METRIC_LIVE_POINTS, METRIC_LIVE_STICKS, METRIC_LIVE_BOXES, METRIC_SLEEPING_ISLANDS,
+    METRIC_STEP_SECONDS, METRIC_RENDER_SECONDS, METRIC_FRAME_SECONDS, METRIC_COUNT
+};
+const float REST_SPEED = 0.01f;     // an island sleeps when no point moves more per step
+const int METRICS_TEXT_SIZE = 8192;
+
+struct Metric {
+    const char* name;
+    const char* help;
+    int type;
+    std::atomic<long long> value;                   // counter total or gauge
+    std::atomic<long long> buckets[METRIC_BUCKETS]; // histogram, not cumulative
+    std::atomic<long long> sumNs;
+};
+
+struct MetricsExporter {
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    int stop;
+    int running;
+    const char* path;           // file, or socket path after "unix:"
+    int socketFd;               // listening socket, -1 when writing a file
+    int intervalMs;
+    std::atomic<long long> exports;
+};
+
+// Profile Persistence
+// Gameplay only marks the profile dirty; a background thread writes the
+// latest snapshot on an interval and once more at exit.
+struct SaveProfile {
+    int coins;
+    int currentHead;
+    int missionsCompleted;
+    int unlocked[MAX_SHOP_ITEMS];
+};
+
+struct SaveService {
+    std::mutex lock;
+    std::condition_variable wake;
+    SaveProfile pending;
+    int dirty;
+    int stop;
+    int running;
+    std::thread thread;
+    long long mainNs;                   // main thread time spent in MarkProfileDirty
+    int requests;
+    std::atomic<int> writes;
+    std::atomic<int> writeErrors;
+    std::atomic<long long> writeNs;
+};
+
+// Input Log (session recording / replay)
+struct InputLog {
+    FILE* file;
+    int mode;
+    int frameCount;
+    DWORD frameMs;
+    int steps;
+    int replayKeys[256];
+    int hasExpectedHash;
+    unsigned long long expectedHash;
+};
+
 // Shop Item
 struct ShopItem {
     char name[20];
@@ -108,6 +704,7 @@ struct Point {
     int isRagdollPart;
     int color;
     int isSpecialHead;  // For shop heads
+    int pickup;         // PICKUP_* kind, PICKUP_NONE for ordinary points
 };
 
 // Stick Structure
@@ -135,15 +732,51 @@ struct Target {
     int ragdollTouching;
 };
 
-// Undo System
-struct GameState {
-    int savedPointCount;
-    int savedStickCount;
-    int savedBoxCount;
-    struct Point savedPoints[MAX_POINTS];
-    struct Stick savedSticks[MAX_STICKS];
-    struct Box savedBoxes[MAX_BOXES];
-    int isValid;
+// Entity
+// A spawned object: the contiguous point and stick ranges it owns, its
+// main point and the bounds of its live points as of the last step
+#define MAX_ENTITIES MAX_POINTS
+
+struct Entity {
+    int kind;
+    int firstPoint;
+    int pointCount;
+    int firstStick;
+    int stickCount;
+    int head;               // -1 when the entity has no main point
+    float minX, minY;
+    float maxX, maxY;
+};
+
+// Undo Journal
+// An edit is journaled as the record ranges it touched: appended ranges
+// keep only the new records, modified ranges keep before and after
+// images. Cost scales with the edit, not with the world.
+#define JOURNAL_ARRAYS 4
+#define MAX_JOURNAL_RANGES 8
+
+struct JournalArray {
+    void* base;
+    int* count;
+    int recordSize;
+};
+
+struct JournalRange {
+    int array;
+    int first;
+    int beforeCount;        // records in before image
+    int afterCount;         // records in after image
+    char* before;
+    char* after;
+};
+
+struct JournalEntry {
+    int beforeCounts[JOURNAL_ARRAYS];
+    int afterCounts[JOURNAL_ARRAYS];
+    JournalRange ranges[MAX_JOURNAL_RANGES];
+    int rangeCount;
+    int wholeArrays;        // ranges ran out; every array is journaled whole
+    int bytes;
 };
 
 // Particle Structure
@@ -157,20 +790,391 @@ struct Particle {
     int active;
 };
 
+// Job System
+// Jobs of a graph become ready when their pending counter reaches zero
+#define MAX_GRAPH_JOBS 16
+#define MAX_JOB_DEPENDENTS 4
+#define MAX_JOB_WORKERS 16
+#define JOB_DEQUE_SIZE 64
+
+typedef void (*JobFunc)(void* data);
+struct JobGraph;
+
+struct Job {
+    JobFunc func;
+    void* data;
+    JobGraph* graph;
+    int dependents[MAX_JOB_DEPENDENTS];
+    int dependentCount;
+    int dependencyCount;
+    std::atomic<int> pending;
+};
+
+struct JobGraph {
+    Job jobs[MAX_GRAPH_JOBS];
+    int jobCount;
+    std::atomic<int> remaining;
+};
+
+struct JobDeque {
+    std::mutex lock;
+    Job* items[JOB_DEQUE_SIZE];
+    int top;                    // thieves take from here
+    int bottom;                 // the owner pushes and pops here
+};
+
+struct JobWorker {
+    JobDeque deque;
+    std::thread thread;
+    std::atomic<long long> busyNs;
+    std::atomic<long long> jobsRun;
+    std::atomic<long long> steals;
+};
+
+struct JobSystem {
+    JobWorker workers[MAX_JOB_WORKERS + 1];     // 0 is the thread running the graph
+    int workerCount;
+    std::atomic<int> stop;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<int> generation;    // bumped under sleepLock for every pushed job
+    long long startNs;
+};
+
+// Particle spawns held back while the solver runs as a job
+struct ParticleStage {
+    Particle items[MAX_PARTICLES];
+    int count;
+    int budget;                 // free slots once the particle job is done
+    int active;
+};
+
+// World Snapshot
+// The file is a header, a section table and the record arrays exactly as
+// they sit in memory (little-endian, 8-byte aligned sections). Loading
+// maps the file and points a WorldView at the sections; nothing is parsed.
+struct SnapshotHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int endianTag;
+    unsigned int fileSize;
+    unsigned int sectionCount;
+    unsigned int reserved;
+};
+
+struct SnapshotSection {
+    unsigned int id;
+    unsigned int count;
+    unsigned int recordSize;
+    unsigned int offset;        // from start of file
+};
+
+// The on-disk records are these structs; a layout change needs a new version.
+// Every field is a 4-byte scalar except the symbol chars, which are followed
+// by 3 bytes of padding; pinning the fields after them pins the whole layout.
+static_assert(sizeof(SnapshotHeader) == 24 && sizeof(SnapshotSection) == 16, "snapshot header layout");
+static_assert(offsetof(Point, radius) == 28 && offsetof(Particle, active) == 32, "snapshot record padding");
+static_assert(sizeof(Point) == 48 && sizeof(Stick) == 20 && sizeof(Box) == 28, "snapshot record layout");
+static_assert(sizeof(Target) == 20 && sizeof(Particle) == 36, "snapshot record layout");
+static_assert(sizeof(Entity) == 40, "snapshot record layout");
+
+struct WorldView {
+    const Point* points;
+    int pointCount;
+    const Stick* sticks;
+    int stickCount;
+    const Box* boxes;
+    int boxCount;
+    const Target* targets;
+    int targetCount;
+    const Particle* particles;
+    int particleCount;
+    const Entity* entities;
+    int entityCount;
+};
+
+// Frame Pipeline
+// Every frame is drawn into a DrawTarget. While pipelining, DrawScreen
+// copies the drawable world into a free FrameSnapshot, draws the UI into
+// its overlay (char 0 lets the world show through) and queues it; the
+// render thread rasterizes and presents it while the game thread steps
+// the next frame. With two slots the screen trails by at most one frame.
+#define FRAME_SLOTS 2
+
+struct DrawTarget {
+    char chars[WIDTH * HEIGHT];
+    int colors[WIDTH * HEIGHT];
+};
+
+struct FrameSnapshot {
+    Point points[MAX_POINTS];
+    Stick sticks[MAX_STICKS];
+    Box boxes[MAX_BOXES];
+    Target targets[MAX_TARGETS];
+    Particle particles[MAX_PARTICLES];
+    WorldView view;             // over the copies above
+    int viewX;                  // camera and shake
+    int shakeY;
+    int targetX;                // targets follow the camera but not the shake
+    int showTargets;
+    float time;
+    DrawTarget overlay;
+};
+
+struct FramePipeline {
+    FrameSnapshot* slots;       // NULL while frames are presented inline
+    HANDLE out;
+    std::thread renderer;
+    std::mutex lock;
+    std::condition_variable changed;
+    int queued;                 // slot waiting for the renderer, -1 for none
+    int rendering;              // slot being presented, -1 for none
+    int stop;
+    std::atomic<int> framesPresented;
+    std::atomic<long long> renderNs;
+    long long waitNs;           // game thread blocked on the renderer
+};
+
+// Level Stream
+// A stream file is a header, a chunk table and one image per chunk:
+// Point[pointCount], Stick[stickCount] with chunk-local indices,
+// Box[boxCount], then Entity[entityCount] with chunk-local ranges. Only
+// the chunks around the focus live in the global world arrays; the rest
+// stay on disk, either in the level file or, once they have been
+// simulated, in the swap file.
+#define MAX_CHUNKS 4096
+
+struct StreamHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int chunkCount;
+    unsigned int chunkWidth;
+};
+
+struct StreamChunkEntry {
+    unsigned int offset;
+    unsigned short pointCount;
+    unsigned short stickCount;
+    unsigned short boxCount;
+    unsigned short entityCount;
+};
+
+struct Chunk {
+    unsigned int offset;
+    unsigned int capacity;      // bytes reserved in the swap file
+    unsigned short pointCount;
+    unsigned short stickCount;
+    unsigned short boxCount;
+    unsigned short entityCount;
+    char inSwap;
+    char resident;
+};
+
+struct LevelStream {
+    int active;
+    FILE* level;
+    FILE* swap;
+    unsigned int swapEnd;
+    Chunk chunks[MAX_CHUNKS];
+    int chunkCount;
+    int firstResident;          // resident window, inclusive
+    int lastResident;
+    int moves;                  // window changes
+    int pageIns;
+    int pageOuts;
+    int overflows;              // chunks that did not fit the world arrays
+    long long pageNs;
+    long long maxPageNs;
+};
+
+// Mission Definition
+// A level file compiles to a flat list of spawn ops; InitMission replays
+// them through the normal spawn functions.
+#define MAX_MISSIONS 32
+#define MAX_LEVEL_OPS 128
+#define MAX_LEVEL_IDS 16
+
+struct LevelOp {
+    unsigned char op;
+    char symbol;
+    unsigned char id;           // named point written or read
+    unsigned char id2;
+    int flags;                  // box: solid | wall << 1, point: locked
+    int color;
+    float v[4];
+};
+
+struct MissionInfo {
+    char title[64];
+    char desc[100];
+    char hint[100];
+    float timeLimit;
+    int reward;
+    int opCount;
+};
+
+struct MissionDef {
+    MissionInfo info;
+    LevelOp ops[MAX_LEVEL_OPS];
+};
+
+// Compiled level cache: header, MissionInfo, then info.opCount ops. The
+// source's size and modification time say whether it is still current.
+struct LevelCacheHeader {
+    char magic[4];
+    unsigned int version;
+    long long sourceSize;
+    long long sourceTime;       // native mtime units, finest available
+};
+
+// Mission Solver
+// A plan grabs one ragdoll part and drags it through cursor waypoints,
+// waiting hold[] frames at each
+#define SOLVER_WAYPOINTS 4
+#define SOLVER_MAX_FRAMES 4096
+#define SOLVER_MAX_WORKERS 64
+
+struct SolverPlan {
+    int part;
+    int waypointCount;
+    int x[SOLVER_WAYPOINTS], y[SOLVER_WAYPOINTS];
+    int hold[SOLVER_WAYPOINTS];
+    int release;                // let go after the last waypoint
+};
+
+// Input state a mission starts from; the previous mission leaves it behind
+struct SolverStart {
+    int curX, curY;
+    int dragMode;
+    unsigned int rng;
+    float jitter;               // free point offset after InitMission, 0 for exact runs
+};
+
+// Per-mission totals of a --balance batch
+#define BALANCE_COIN_BUCKETS 64
+
+struct BalanceStats {
+    int runs;
+    int outcomes[BALANCE_OUTCOME_COUNT];
+    float completeTime;
+    long long coinTotal;
+    int coinHistogram[BALANCE_COIN_BUCKETS];
+};
+
+struct SolverProgress {
+    int phase;
+    int waypoint;
+    int holdLeft;
+    int tries;                  // grab attempts
+};
+
+// Spatial Grid
+// Bucket grid over a set of point indices, rebuilt by counting sort.
+// Cells grow when the bounds would need more than GRID_MAX_CELLS.
+#define GRID_MAX_CELLS 4096
+
+struct SpatialGrid {
+    float originX, originY;
+    float cellSize;
+    int cols, rows;
+    int cellStart[GRID_MAX_CELLS + 1];
+    int items[MAX_POINTS];
+    int itemCount;
+};
+
+// Pick Index
+// Grid over any point array, sized on build; items are active points in
+// cell order with their position and entity kind copied alongside
+#define PICK_MAX_K 64
+
+struct PickIndex {
+    float originX, originY;
+    float cellSize;
+    int cols, rows;
+    int* cellStart;
+    int* items;
+    float* xs;
+    float* ys;
+    unsigned char* kinds;
+    int itemCount;
+    int cellCapacity;
+    int itemCapacity;
+};
+
+// Lists of points by role, rebuilt when worldRevision moves on
+struct PointIndex {
+    int revision;
+    int builtCount;
+    int pickups[MAX_POINTS];
+    int pickupCount;
+    int ragdollParts[MAX_POINTS];
+    int ragdollPartCount;
+    int builtStickCount;
+    int brokenRagdollSticks;    // kept current by BreakStick between rebuilds
+};
+
+// Entities by kind and the owner of each point, rebuilt like PointIndex
+struct EntityIndex {
+    int revision;
+    int builtCount;
+    int builtPointCount;
+    int ofKind[ENTITY_KIND_COUNT][MAX_ENTITIES];
+    int kindCount[ENTITY_KIND_COUNT];
+};
+
+// Read-only file mapping
+struct MappedFile {
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+// Hangman Dictionary
+// Words sorted by difficulty then length; bucketStart[d][len] is the first
+// word of that bucket, so [len, maxLen + 1) is one range per difficulty
+#define MIN_WORD_LENGTH 3
+#define MAX_WORD_LENGTH 32
+#define DICT_DIFFICULTIES 3
+
+struct DictWord {
+    unsigned int offset;        // into the mapped file
+    unsigned int letterMask;    // bit per letter A-Z
+    unsigned char length;
+    unsigned char difficulty;
+};
+
+struct Dictionary {
+    MappedFile file;
+    DictWord* words;
+    int count;
+    int bucketStart[DICT_DIFFICULTIES][MAX_WORD_LENGTH + 2];
+};
 
 // Global variables
 Point points[MAX_POINTS];
 Stick sticks[MAX_STICKS];
 Box boxes[MAX_BOXES];
-Target targets[5];
+Target targets[MAX_TARGETS];
 Particle particles[MAX_PARTICLES];
-char screenBuf[WIDTH * HEIGHT];
-int colorBuf[WIDTH * HEIGHT];
+Entity entities[MAX_ENTITIES];
+int pointEntity[MAX_POINTS];    // owning entity, -1 for loose points; see UpdateEntityIndex
+DrawTarget mainTarget;          // game thread, and every synchronous screen
+DrawTarget renderTarget;        // render thread
+thread_local DrawTarget* drawTarget = &mainTarget;
+DrawTarget presentedTarget;     // cells as last written to the console
+int rowsWritten = 0;
+int rowsSkipped = 0;
 
 int pointCount = 0;
 int stickCount = 0;
 int boxCount = 0;
 int targetCount = 0;
+int entityCount = 0;
 
 int curX = 60;
 int curY = 10;
@@ -187,6 +1191,12 @@ int menuSelection = 0;
 
 int currentMission = 1;
 int maxMissions = 5;
+MissionDef missionDefs[MAX_MISSIONS];
+LevelStream levelStream;
+const char* streamPath = NULL;  // --stream level used by the sandbox
+float worldWidth = WIDTH;
+int cameraX = 0;
+int builtinMissions = 1;        // no mission files found
 int missionComplete = 0;
 int missionFailed = 0;
 int ragdollBroken = 0;
@@ -210,17 +1220,93 @@ int hangmanWon = 0;
 char currentLetter = 0;
 int stickmanIntact = 1;
 int currentHangmanStage = 0;
+unsigned int letterPositions[26];   // bit i set where the word has that letter
+unsigned int revealedMask = 0;
+unsigned int guessedMask = 0;
+Dictionary dictionary;
+int dictMinLength = 4;
+int dictMaxLength = 12;
+int dictDifficulty = -1;            // -1 for any
 
 // variables
 GameStats gameStats;
-GameState undoStates[MAX_UNDO_STATES];
-int currentUndoIndex = 0;
-int undoCount = 0;
+int worldRevision = 0;      // bumped whenever point records are added, replaced or moved
+int positionRevision = 0;   // bumped when live points move: each step, drags, jitter
+PointIndex pointIndex;
+SpatialGrid pickupGrid;
+SpatialGrid ragdollGrid;
+EntityIndex entityIndex;
+PickIndex pickIndex;
+int pickIndexBuilt = 0;
+int pickRevision = 0;
+int pickPositionRevision = 0;
+int pickPointCount = 0;
+int pickScanRevision = -1;  // world state the last linear pick ran against
+int pickScanPositionRevision = -1;
+int pickScanPointCount = -1;
+int stickBreakCount = 0;    // sticks broken since startup
+int targetOccupant[MAX_TARGETS]; // ragdoll part inside each target, -1 when empty
+JournalEntry undoJournal[MAX_UNDO_STATES];    // ring, oldest at journalFirst
+int journalFirst = 0;
+int journalCount = 0;       // entries held, including the redo stack
+int undoCount = 0;          // entries that can be undone
+int journalBytes = 0;
+int editOpen = 0;
+JournalEntry pendingEdit;
 InputManager inputManager;
+InputQueue inputQueue;
 SoundManager soundManager;
+SoundEngine soundEngine;
+JobSystem jobSystem;
+ParticleStage particleStage;
+int jobThreads = -1;        // worker threads besides the game thread, -1 for one per spare core
+FramePipeline framePipeline;
+int pipelineEnabled = 1;    // --no-pipeline draws and presents on the game thread
+int sessionStats = 0;       // --stats reports CPU, pacing and input latency on exit
+SaveService saveService;
 int showHelp = 0;
 int debugMode = 0;
 float cursorSpeedMultiplier = CURSOR_SPEED_NORMAL;
+InputLog inputLog;
+CastRecorder castRecorder;
+FrameTrace frameTrace;
+FramePacer framePacer;
+TimeHistogram frameTimes = { "Frame", {}, {}, {}, {}, {} };    // game thread work per frame
+TimeHistogram simTimes = { "Sim", {}, {}, {}, {}, {} };        // one world step
+TimeHistogram renderTimes = { "Render", {}, {}, {}, {}, {} };  // rasterize and present
+int perfCountersEnabled = 0;
+std::atomic<int> perfEventsMissing[PERF_EVENTS];    // refused on some thread
+std::atomic<int> perfOutcome(PERF_OFF);     // the first thread to open its group decides it
+std::atomic<int> perfCyclesError(0);        // errno when the outcome is PERF_NO_CYCLES
+std::atomic<int> perfGroupsOpen(0);
+PhaseCounters phaseCounters[PHASE_COUNT] = {
+    { "solver", {}, {}, {} }, { "particles", {}, {}, {} }, { "render", {}, {}, {} }
+};
+Metric metrics[METRIC_COUNT] = {
+    { "ragdoll_steps_total", "World steps simulated.", METRIC_COUNTER, {}, {}, {} },
+    { "ragdoll_stick_breaks_total", "Sticks broken.", METRIC_COUNTER, {}, {}, {} },
+    { "ragdoll_explosions_total", "Bombs exploded.", METRIC_COUNTER, {}, {}, {} },
+    { "ragdoll_particle_spawns_total", "Particles placed.", METRIC_COUNTER, {}, {}, {} },
+    { "ragdoll_particles_dropped_total", "Particles dropped for lack of a free slot.", METRIC_COUNTER, {}, {}, {} },
+    { "ragdoll_live_points", "Active points.", METRIC_GAUGE, {}, {}, {} },
+    { "ragdoll_live_sticks", "Active sticks.", METRIC_GAUGE, {}, {}, {} },
+    { "ragdoll_live_boxes", "Active boxes.", METRIC_GAUGE, {}, {}, {} },
+    { "ragdoll_sleeping_islands", "Entities whose points are all at rest.", METRIC_GAUGE, {}, {}, {} },
+    { "ragdoll_step_seconds", "Time of one world step.", METRIC_HISTOGRAM, {}, {}, {} },
+    { "ragdoll_render_seconds", "Time to rasterize and present a frame.", METRIC_HISTOGRAM, {}, {}, {} },
+    { "ragdoll_frame_seconds", "Game thread work per frame.", METRIC_HISTOGRAM, {}, {}, {} },
+};
+// Upper bounds of the histogram buckets; the last one is +Inf
+const long long metricBoundsNs[METRIC_BUCKETS - 1] = {
+    50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000
+};
+MetricsExporter metricsExporter;
+int frameRate = 30;         // --fps; presentation only, the world steps at SIM_RATE
+int simSteps = 1;           // world steps this frame; solver runs always take one
+long long simClock = 0;     // frame time not yet stepped, in ms x SIM_RATE
+int simResync = 0;          // the loop idled, so the next frame takes a single step
+int headlessMode = 0;
+unsigned int simRandState = 1;
 
 // Shop variables
 ShopItem shopItems[MAX_SHOP_ITEMS];
@@ -232,8 +1318,9 @@ int itemsPerPage = 6;
 // Function Prototypes
 void ClearWorld();
 void InitInputManager();
-void UpdateInputManager();
+void UpdateInputManager(DWORD frameMs);
 int IsKeyPressed(int key);
+int IsKeyRepeated(int key);
 int IsKeyDown(int key);
 int IsKeyReleased(int key);
 void UpdateCursor();
@@ -241,9 +1328,103 @@ void DrawEnhancedCursor();
 void DrawToolSelection();
 void DrawStatusBar();
 void DrawHelpOverlay();
+void DrawDebugLine(int y, const char* text, int color);
 void DrawDebugInfo();
-void SaveState();
+void BeginEdit();
+JournalEntry* JournalAt(int i);
+void JournalWholeArrays(JournalEntry* edit);
+void JournalModify(int array, int first, int count);
+void EndEdit();
+void ClearJournal();
 void Undo();
+void Redo();
+void ResetSandbox();
+int OpenMappedFile(MappedFile* mf, const char* path);
+void CloseMappedFile(MappedFile* mf);
+int MapSnapshot(const MappedFile* mf, WorldView* view);
+int SaveSnapshot(const char* path, const WorldView* view);
+int LoadSnapshot(const char* path);
+WorldView CurrentWorldView();
+int RunSnapshotBenchmark(int pointTotal);
+int BuildStreamLevel(const char* path, int chunkTotal);
+int StartStreaming(const char* path, float focusX);
+void StopStreaming();
+void UpdateStreaming();
+int StartStreamSandbox();
+int RunStreamBenchmark(int chunkTotal);
+void WriteU32(FILE* file, unsigned int v);
+int StartRecording(const char* path);
+int StartReplay(const char* path);
+int BeginInputFrame(DWORD* frameMs, int* steps);
+int PollKey(int key);
+void RecordInputFrame(const unsigned char* toggled, int count);
+int FinishInputLog();
+void SeedRandom();
+int SimRand();
+unsigned long long WorldHash();
+void PushInputCommand(int key, int down, long long timeNs);
+void PushInputTap(int key, int modifier, long long timeNs);
+int DecodeTerminalKey(const unsigned char* buf, int len, int* key, int* modifier);
+void InputReaderThread();
+void StartInputThread(int fd);
+void StopInputThread();
+void RestoreTerminalMode();
+void RestoreTerminalOnSignal(int sig);
+void WakeInputWaiter();
+void WaitForInput(int timeoutMs);
+int IdleWaitMs(int showMissionStart);
+double ProcessCpuSeconds();
+void DrainInputCommands();
+void FormatInputLatency(char* out, int size);
+int CompareInts(const void* a, const void* b);
+int RunInputBenchmark(int taps);
+long long GetTimeNs();
+void PresentScreen(HANDLE hOut);
+int StartCastRecording(const char* path);
+void CaptureCastFrame();
+void StopCastRecording();
+void StartFramePacer(FramePacer* pacer, int rate);
+void StopFramePacer();
+void ResetFramePacer(FramePacer* pacer);
+int TakeSimSteps(DWORD frameMs);
+long long BeginPacedFrame(FramePacer* pacer);
+void WaitNextFrame(FramePacer* pacer);
+int RecentFrameRate(const FramePacer* pacer);
+void FormatFrameJitter(const FramePacer* pacer, char* out, int size);
+long long LegacyLimiterPass(int frames, int rate, FramePacer* stats);
+int RunPacingBenchmark(int frames, int rate);
+int TimeBucket(int us);
+int TimeBucketLow(int bucket);
+void RecordTime(TimeHistogram* hist, long long ns);
+int BucketPercentile(const long long* counts, long long total, int percent, int maxUs);
+void TimePercentiles(TimeHistogram* hist, int* p50, int* p95, int* p99, int* maxUs);
+void FormatTimePercentiles(TimeHistogram* hist, char* out, int size);
+long long LoadTimeCounts(const std::atomic<long long>* counts, long long* out);
+int WriteTimeHistograms(const char* path);
+void OpenPerfCounters();
+void PublishPerfOutcome(int outcome);
+void FormatPerfStatus(char* out, int size);
+void ClosePerfCounters();
+void BeginPhaseCounters(PerfSample* sample);
+void EndPhaseCounters(int phase, const PerfSample* start, int points);
+void FormatPhaseCounters(int phase, char* out, int size);
+void WritePhaseJson(FILE* file, int phase, int frames);
+int RunCounterBenchmark(int frames, const char* jsonPath);
+void CountMetric(int metric, long long n);
+void SetGauge(int metric, long long value);
+void ObserveMetric(int metric, long long ns);
+void UpdateWorldGauges();
+int FormatMetrics(char* out, int size);
+int WriteMetricsFile(const char* path, const char* text, int len);
+void ServeMetricsClients(int timeoutMs);
+void MetricsThread();
+int StartMetricsExporter(const char* spec, int intervalMs);
+void StopMetricsExporter();
+int StartFrameTrace(const char* path);
+void TraceFrame(DWORD frameMs, long long workNs);
+void StopFrameTrace();
+void StopStartupServices();
+int SoundActive();
 void PlaySoundPlace();
 void PlaySoundBreak();
 void PlaySoundExplosion();
@@ -253,22 +1434,44 @@ void PlaySoundClick();
 void PlaySoundDrag();
 void PlaySoundCoin();
 void ToggleSound();
+void PostSound(int sound);
+int StartSoundEngine(const char* spec);
+void StopSoundEngine();
 void SpawnExplosionParticles(float x, float y);
 void SpawnBreakParticles(float x, float y);
 void SpawnSuccessParticles(float x, float y);
 void SpawnCoinParticles(float x, float y);
-void DrawPointWithEffects(Point* p, int shakeX, int shakeY);
-void DrawAnimatedTargets();
+void DrawPointWithEffects(const Point* p, int shakeX, int shakeY);
+void DrawAnimatedTargets(const Target* list, int count, int offsetX, float time);
 void UpdateMissionWithStats(float deltaTime);
+void UpdateActiveMission(float deltaTime);
+unsigned int SolverRand(unsigned int* state);
+int RunPlan(const SolverPlan* plan, const SolverStart* start, int missionNum, unsigned char* trace, float* time);
+int RunSolveWorker(int missionNum, unsigned int seed, int candidates, const SolverStart* start);
+int RunSolver(const char* exe, int candidates, const char* replayPath);
+void JitterPoints(float amount);
+int RunBalanceWorker(int missionNum, int firstRun, int runs);
+int RunBalance(const char* exe, int runs, const char* csvPath);
 void InitShop();
 void DrawShop();
 void HandleShopInput();
 void BuyItem(int index);
 void EquipHead(int index);
-void SaveGame();
+void MarkProfileDirty();
+int WriteSaveFile(const SaveProfile* profile);
+void StartSaveService();
+void StopSaveService();
 void LoadGame();
 int AddPoint(float x, float y, char symbol, int locked, float radius, int isRagdoll, int color, int isSpecial);
 void AddStick(int p1, int p2, int isRagdoll);
+void BreakStick(int s);
+Entity MakeEntity(int kind, int firstPoint, int pointTotal, int firstStick, int stickTotal, int head);
+int ValidEntity(const Entity* e, int pointTotal, int stickTotal);
+void ComputeEntityBounds(Entity* e);
+void UpdateEntityBounds();
+int RegisterEntity(int kind, int firstPoint, int firstStick, int head);
+void UpdateEntityIndex();
+Entity* FirstRagdoll();
 int AddBox(float x, float y, float w, float h, int solid, int isWall);
 void AddTarget(float x, float y, float radius);
 void SpawnRagdoll(int x, int y);
@@ -277,18 +1480,56 @@ void SpawnRope(int x1, int y1, int x2, int y2);
 void SpawnPlatform(int x, int y, int width);
 void SpawnMovableBox(int x, int y);
 void SpawnCoin(int x, int y);
+int BreakBone(const Entity* ragdoll, int bone);
+void FreePart(const Entity* ragdoll, int part);
 void BreakRandomStick();
 void InitHangmanMode();
 void ProcessHangmanGuess(char letter);
 void DrawHangmanUI();
+int LoadDictionary(const char* path);
+void CloseDictionary();
+int CountDictWords(int minLength, int maxLength, int difficulty);
+const DictWord* PickDictWord(int minLength, int maxLength, int difficulty);
+void SetHangmanWord(const char* word, int length);
+int RunDictionaryBenchmark(int wordTotal);
 void Explode(int x, int y);
 void ClampPointToBox(int pointIndex, int boxIndex);
 void ResolveBoxCollisions();
 int CheckRagdollInTarget(int targetIndex);
 int CheckRagdollIntegrity();
 void InitMission(int missionNum);
+void InitBuiltinMission(int missionNum);
+int CompileLevel(const char* text, size_t size, MissionDef* def, char* error, int errorSize);
+int LoadLevel(const char* path, MissionDef* def, int* fromCache, char* error, int errorSize);
+int LoadMissions();
+int RunMissionBenchmark();
+int VerifyMissions();
 void UpdateParticles();
 void UpdatePhysics();
+void StepWorld(int missionChecks, float deltaTime);
+void SolveWorld();
+void StageParticle(float x, float y, int color, char symbol, float speed);
+void ResetJobGraph(JobGraph* graph);
+int AddJob(JobGraph* graph, JobFunc func, void* data);
+void AddDependency(JobGraph* graph, int before, int after);
+void RunJobGraph(JobGraph* graph);
+void StartJobSystem(int threads);
+void StopJobSystem();
+void FormatJobUtilization(char* out, int size);
+int RunJobBenchmark(int frames);
+void ClearDrawTarget(DrawTarget* target, char fill);
+void RasterizeWorld(const WorldView* view, int viewX, int shakeY, int targetX, int showTargets, float time);
+void DrawFrameUI();
+void RenderFrame(const FrameSnapshot* frame, HANDLE hOut);
+void RenderThread();
+FrameSnapshot* BeginFrameSnapshot();
+void SubmitFrame(FrameSnapshot* frame);
+void StartFramePipeline(HANDLE hOut);
+void WaitFramePipeline();
+void StopFramePipeline();
+void BuildPipelineScene(int ragdolls);
+long long TimePipelinePass(HANDLE hOut, int ragdolls, int frames, int pipelined, long long* simNs);
+int RunPipelineBenchmark(int frames);
 void DrawScreen(HANDLE hOut);
 void ShowMainMenu(HANDLE hOut);
 void ShowMissionComplete(HANDLE hOut);
@@ -296,6 +1537,20 @@ void ShowMissionFailed(HANDLE hOut);
 int FindNearestPoint(int x, int y, float maxDist);
 void DrawMissionStartScreen(HANDLE hOut, int missionNum);
 float GetDistance(float x1, float y1, float x2, float y2);
+void BuildGrid(SpatialGrid* grid, const Point* pts, const int* indices, int count, float cellSize);
+int QueryGrid(const SpatialGrid* grid, const Point* pts, float x, float y, float radius, int* out, int maxOut);
+void UpdatePointIndex();
+void UpdateTargetOccupancy();
+int BuildPickIndex(PickIndex* index, const Point* pts, const unsigned char* kinds, int count, float cellSize);
+void FreePickIndex(PickIndex* index);
+int PickKNearest(const PickIndex* index, float x, float y, float radius, int kindMask, int k, int* out);
+int PickNearest(const PickIndex* index, float x, float y, float radius, int kindMask);
+int PickRect(const PickIndex* index, float x0, float y0, float x1, float y1, int kindMask, int* out, int maxOut);
+int PickIndexCurrent();
+void UpdatePickIndex();
+int RunPickBenchmark(int pointTotal);
+void CollectPickups();
+int RunPickupBenchmark(int coinTotal);
 void PutChar(int x, int y, char c, int color);
 void DrawLine(int x0, int y0, int x1, int y1, char c, int color);
 void SpawnParticle(float x, float y, int color, char symbol, float speed);
@@ -310,26 +1565,51 @@ void InitInputManager() {
         inputManager.keysPressed[i] = 0;
         inputManager.keysReleased[i] = 0;
         inputManager.lastKeyTime[i] = 0;
+        inputManager.keysRepeated[i] = 0;
+        inputManager.nextRepeatTime[i] = 0;
     }
+    // Starts past the debounce window so the very first press counts
+    inputManager.now = KEY_DEBOUNCE_MS;
 }
 
-void UpdateInputManager() {
-    DWORD currentTime = GetTickCount();
+// Debounce and key repeat run on the step clock rather than wall time, so
+// a replay accepts exactly the presses the recorded session did and no
+// handler ever has to sleep.
+void UpdateInputManager(DWORD frameMs) {
+    InputManager* input = &inputManager;
+    unsigned char toggled[256];
+    int toggleCount = 0;
+
+    input->now += frameMs;
+    if (inputQueue.running) DrainInputCommands();
 
     for (int i = 0; i < 256; i++) {
-        int currentState = (GetAsyncKeyState(i) & 0x8000) != 0;
-        inputManager.keysPressed[i] = currentState && !inputManager.keys[i];
-        inputManager.keysReleased[i] = !currentState && inputManager.keys[i];
+        int currentState = PollKey(i);
+        int pressed = currentState && !input->keys[i];
+        if (currentState != input->keys[i]) toggled[toggleCount++] = (unsigned char)i;
+
+        input->keysReleased[i] = !currentState && input->keys[i];
+        input->keysPressed[i] = pressed && input->now - input->lastKeyTime[i] >= (DWORD)KEY_DEBOUNCE_MS;
+        input->keysRepeated[i] = input->keysPressed[i];
 
-        if (inputManager.keysPressed[i]) {
-            inputManager.lastKeyTime[i] = currentTime;
+        if (input->keysPressed[i]) {
+            input->lastKeyTime[i] = input->now;
+            input->nextRepeatTime[i] = input->now + KEY_REPEAT_DELAY_MS;
+        }
+        else if (currentState && !pressed && (int)(input->now - input->nextRepeatTime[i]) >= 0) {
+            input->keysRepeated[i] = 1;
+            input->nextRepeatTime[i] += KEY_REPEAT_INTERVAL_MS;
         }
 
-        inputManager.keys[i] = currentState;
+        input->keys[i] = currentState;
     }
+
+    // The log keeps raw key changes; debouncing is redone on replay
+    if (inputLog.mode == INPUT_LOG_RECORD) RecordInputFrame(toggled, toggleCount);
 }
 
 int IsKeyPressed(int key) { return inputManager.keysPressed[key]; }
+int IsKeyRepeated(int key) { return inputManager.keysRepeated[key]; }
 int IsKeyDown(int key) { return inputManager.keys[key]; }
 int IsKeyReleased(int key) { return inputManager.keysReleased[key]; }
 
@@ -396,20 +1676,124 @@ void InitShop() {
     shopItems[7].color = COLOR_BRIGHT_RED;
     strcpy_s(shopItems[7].description, "Fiery demon head");
 }
+void CaptureProfile(SaveProfile* profile) {
+    profile->coins = gameStats.coins;
+    profile->currentHead = currentHeadIndex;
+    profile->missionsCompleted = gameStats.missionsCompleted;
+    for (int i = 0; i < MAX_SHOP_ITEMS; i++) {
+        profile->unlocked[i] = shopItems[i].unlocked;
+    }
+}
 
-void SaveGame() {
+// Write to a temp file, force it to disk, then rename it over the save so
+// a crash leaves either the old profile or the new one, never half of each
+int WriteSaveFile(const SaveProfile* profile) {
     FILE* file;
-    errno_t err = fopen_s(&file, SAVE_FILE, "w");
-    if (err == 0 && file) {
-        fprintf(file, "COINS:%d\n", gameStats.coins);
-        fprintf(file, "CURRENT_HEAD:%d\n", currentHeadIndex);
-        fprintf(file, "MISSIONS:%d\n", gameStats.missionsCompleted);
+    errno_t err = fopen_s(&file, SAVE_TEMP_FILE, "w");
+    if (err != 0 || !file) return 0;
+
+    fprintf(file, "COINS:%d\n", profile->coins);
+    fprintf(file, "CURRENT_HEAD:%d\n", profile->currentHead);
+    fprintf(file, "MISSIONS:%d\n", profile->missionsCompleted);
+
+    for (int i = 0; i < MAX_SHOP_ITEMS; i++) {
+        fprintf(file, "ITEM%d:%d\n", i, profile->unlocked[i]);
+    }
+
+    int ok = (fflush(file) == 0);
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(file)) == 0;
+#else
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        remove(SAVE_TEMP_FILE);
+        return 0;
+    }
+
+#ifdef _WIN32
+    return MoveFileExA(SAVE_TEMP_FILE, SAVE_FILE, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(SAVE_TEMP_FILE, SAVE_FILE) == 0;
+#endif
+}
+
+void SaveThread() {
+    SaveService* svc = &saveService;
+    std::unique_lock<std::mutex> lock(svc->lock);
+    while (1) {
+        svc->wake.wait_for(lock, std::chrono::milliseconds(SAVE_FLUSH_MS),
+            [svc] { return svc->stop != 0; });
 
-        for (int i = 0; i < MAX_SHOP_ITEMS; i++) {
-            fprintf(file, "ITEM%d:%d\n", i, shopItems[i].unlocked);
+        if (svc->dirty) {
+            SaveProfile profile = svc->pending;
+            svc->dirty = 0;
+            lock.unlock();
+
+            long long start = GetTimeNs();
+            if (WriteSaveFile(&profile)) svc->writes++;
+            else svc->writeErrors++;
+            svc->writeNs += GetTimeNs() - start;
+
+            lock.lock();
         }
+        if (svc->stop && !svc->dirty) break;
+    }
+}
 
-        fclose(file);
+// Called from gameplay whenever the profile changes. Only copies the
+// profile; the disk write happens on the save thread.
+void MarkProfileDirty() {
+    // Replays and headless tools never touch the player's save
+    if (inputLog.mode == INPUT_LOG_REPLAY || headlessMode) return;
+
+    SaveService* svc = &saveService;
+    long long start = GetTimeNs();
+    if (!svc->running) {
+        SaveProfile profile;
+        CaptureProfile(&profile);
+        WriteSaveFile(&profile);
+    }
+    else {
+        std::lock_guard<std::mutex> lock(svc->lock);
+        CaptureProfile(&svc->pending);
+        svc->dirty = 1;
+    }
+    svc->mainNs += GetTimeNs() - start;
+    svc->requests++;
+}
+
+void StartSaveService() {
+    SaveService* svc = &saveService;
+    if (inputLog.mode == INPUT_LOG_REPLAY || svc->running) return;
+
+    svc->dirty = 0;
+    svc->stop = 0;
+    svc->mainNs = 0;
+    svc->requests = 0;
+    svc->writes = 0;
+    svc->writeErrors = 0;
+    svc->writeNs = 0;
+    svc->running = 1;
+    svc->thread = std::thread(SaveThread);
+}
+
+// Flushes anything still pending before the thread exits
+void StopSaveService() {
+    SaveService* svc = &saveService;
+    if (!svc->running) return;
+
+    {
+        std::lock_guard<std::mutex> lock(svc->lock);
+        svc->stop = 1;
+    }
+    svc->wake.notify_one();
+    svc->thread.join();
+    svc->running = 0;
+
+    if (svc->writeErrors > 0) {
+        printf("Save: %d writes to %s failed\n", svc->writeErrors.load(), SAVE_FILE);
     }
 }
 
@@ -444,145 +1828,2130 @@ void LoadGame() {
 // SOUND FUNCTIONS
 //---------------------------------------------------------------------
 
-void PlaySoundPlace() {
-    if (!soundManager.enabled) return;
-    Beep(800, 50);
-}
+// Tone sequences reproduce the old blocking Beep() calls
+const SoundDef soundDefs[SOUND_COUNT] = {
+    { { { 800, 50 } }, 1, SOUND_CATEGORY_EFFECT, 1 },                             // SOUND_PLACE
+    { { { 400, 80 }, { 300, 60 } }, 2, SOUND_CATEGORY_EFFECT, 1 },                // SOUND_BREAK
+    { { { 250, 80 } }, 1, SOUND_CATEGORY_EFFECT, 2 },                             // SOUND_EXPLOSION
+    { { { 523, 100 }, { 659, 100 }, { 784, 150 } }, 3, SOUND_CATEGORY_JINGLE, 3 }, // SOUND_SUCCESS
+    { { { 400, 150 }, { 300, 150 }, { 200, 200 } }, 3, SOUND_CATEGORY_JINGLE, 3 }, // SOUND_FAILURE
+    { { { 1000, 30 } }, 1, SOUND_CATEGORY_UI, 0 },                                // SOUND_CLICK
+    { { { 600, 20 } }, 1, SOUND_CATEGORY_UI, 0 },                                 // SOUND_DRAG
+    { { { 800, 100 }, { 1000, 100 } }, 2, SOUND_CATEGORY_EFFECT, 2 }              // SOUND_COIN
+};
 
-void PlaySoundBreak() {
-    if (!soundManager.enabled) return;
-    Beep(400, 80);
-    Beep(300, 60);
-}
+// Simultaneous voices allowed per category
+const int soundCategoryVoices[SOUND_CATEGORY_COUNT] = { 2, 4, 1 };
+
+// Game thread side: one store into the SPSC ring, never blocks
+void PostSound(int sound) {
+    if (!SoundActive() || !soundEngine.running) return;
 
-void PlaySoundExplosion() {
-    if (!soundManager.enabled) return;
-    Beep(250, 80); 
+    int head = soundEngine.head.load(std::memory_order_relaxed);
+    if (head - soundEngine.tail.load(std::memory_order_acquire) >= SOUND_QUEUE_SIZE) {
+        soundEngine.eventsDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    soundEngine.queue[head % SOUND_QUEUE_SIZE] = (unsigned char)sound;
+    soundEngine.head.store(head + 1, std::memory_order_release);
 }
 
-void PlaySoundSuccess() {
-    if (!soundManager.enabled) return;
-    Beep(523, 100);
-    Beep(659, 100);
-    Beep(784, 150);
+void PlaySoundPlace() { PostSound(SOUND_PLACE); }
+void PlaySoundBreak() { PostSound(SOUND_BREAK); }
+void PlaySoundExplosion() { PostSound(SOUND_EXPLOSION); }
+void PlaySoundSuccess() { PostSound(SOUND_SUCCESS); }
+void PlaySoundFailure() { PostSound(SOUND_FAILURE); }
+void PlaySoundClick() { PostSound(SOUND_CLICK); }
+void PlaySoundDrag() { PostSound(SOUND_DRAG); }
+void PlaySoundCoin() { PostSound(SOUND_COIN); }
+
+// Null sink: discards audio, the engine paces itself in real time
+int NullSinkOpen(const char*) { return 1; }
+void NullSinkWrite(const short*, int) {}
+void NullSinkClose() {}
+
+// WAV sink: 16-bit mono PCM, sizes patched in on close
+FILE* wavFile = NULL;
+int wavSamples = 0;
+
+void WriteWavHeader(FILE* file, int samples) {
+    unsigned int dataBytes = (unsigned int)samples * 2;
+    fwrite("RIFF", 1, 4, file);
+    WriteU32(file, 36 + dataBytes);
+    fwrite("WAVEfmt ", 1, 8, file);
+    WriteU32(file, 16);
+    WriteU32(file, 1 | (1 << 16));                  // PCM, mono
+    WriteU32(file, SOUND_SAMPLE_RATE);
+    WriteU32(file, SOUND_SAMPLE_RATE * 2);          // byte rate
+    WriteU32(file, 2 | (16 << 16));                 // block align, bits
+    fwrite("data", 1, 4, file);
+    WriteU32(file, dataBytes);
 }
 
-void PlaySoundFailure() {
-    if (!soundManager.enabled) return;
-    Beep(400, 150);
-    Beep(300, 150);
-    Beep(200, 200);
+int WavSinkOpen(const char* arg) {
+    if (fopen_s(&wavFile, arg, "wb") != 0 || !wavFile) return 0;
+    wavSamples = 0;
+    WriteWavHeader(wavFile, 0);
+    return 1;
 }
 
-void PlaySoundClick() {
-    if (!soundManager.enabled) return;
-    Beep(1000, 30);
+void WavSinkWrite(const short* samples, int count) {
+    for (int i = 0; i < count; i++) {
+        fputc(samples[i] & 0xFF, wavFile);
+        fputc((samples[i] >> 8) & 0xFF, wavFile);
+    }
+    wavSamples += count;
 }
 
-void PlaySoundDrag() {
-    if (!soundManager.enabled) return;
-    Beep(600, 20);
+void WavSinkClose() {
+    fseek(wavFile, 0, SEEK_SET);
+    WriteWavHeader(wavFile, wavSamples);
+    fclose(wavFile);
+    wavFile = NULL;
 }
 
-void PlaySoundCoin() {
-    if (!soundManager.enabled) return;
-    Beep(800, 100);
-    Beep(1000, 100);
+#ifdef _WIN32
+#pragma comment(lib, "winmm.lib")
+
+// waveOut sink: a few rotating buffers, write waits for a free one
+#define WAVEOUT_BUFFERS 4
+HWAVEOUT waveOut;
+WAVEHDR waveHeaders[WAVEOUT_BUFFERS];
+short waveData[WAVEOUT_BUFFERS][SOUND_BLOCK_SAMPLES];
+int waveNext = 0;
+
+int WaveOutSinkOpen(const char* arg) {
+    WAVEFORMATEX format = { 0 };
+    format.wFormatTag = WAVE_FORMAT_PCM;
+    format.nChannels = 1;
+    format.nSamplesPerSec = SOUND_SAMPLE_RATE;
+    format.wBitsPerSample = 16;
+    format.nBlockAlign = 2;
+    format.nAvgBytesPerSec = SOUND_SAMPLE_RATE * 2;
+    if (waveOutOpen(&waveOut, WAVE_MAPPER, &format, 0, 0, CALLBACK_NULL) != MMSYSERR_NOERROR) return 0;
+
+    for (int i = 0; i < WAVEOUT_BUFFERS; i++) {
+        waveHeaders[i].lpData = (LPSTR)waveData[i];
+        waveHeaders[i].dwBufferLength = sizeof(waveData[i]);
+        waveHeaders[i].dwFlags = 0;
+        waveOutPrepareHeader(waveOut, &waveHeaders[i], sizeof(WAVEHDR));
+        waveHeaders[i].dwFlags |= WHDR_DONE;
+    }
+    waveNext = 0;
+    return 1;
 }
 
-void ToggleSound() {
-    soundManager.enabled = !soundManager.enabled;
+void WaveOutSinkWrite(const short* samples, int count) {
+    WAVEHDR* header = &waveHeaders[waveNext];
+    while (!(header->dwFlags & WHDR_DONE)) Sleep(1);
+
+    memcpy(waveData[waveNext], samples, count * sizeof(short));
+    header->dwBufferLength = count * sizeof(short);
+    header->dwFlags &= ~WHDR_DONE;
+    waveOutWrite(waveOut, header, sizeof(WAVEHDR));
+    waveNext = (waveNext + 1) % WAVEOUT_BUFFERS;
 }
 
-//---------------------------------------------------------------------
-// UNDO SYSTEM
-//---------------------------------------------------------------------
+void WaveOutSinkClose() {
+    waveOutReset(waveOut);
+    for (int i = 0; i < WAVEOUT_BUFFERS; i++) {
+        waveOutUnprepareHeader(waveOut, &waveHeaders[i], sizeof(WAVEHDR));
+    }
+    waveOutClose(waveOut);
+}
+#endif
+
+const SoundSink soundSinks[] = {
+    { "null", NullSinkOpen, NullSinkWrite, NullSinkClose, 0 },
+    { "wav", WavSinkOpen, WavSinkWrite, WavSinkClose, 0 },
+#ifdef _WIN32
+    { "waveout", WaveOutSinkOpen, WaveOutSinkWrite, WaveOutSinkClose, 1 },
+#endif
+};
 
-void SaveState() {
-    if (currentMode != 1) return;
+// Sums the active voices into one block of square-wave PCM
+void MixSoundBlock(short* out, int count) {
+    for (int i = 0; i < count; i++) {
+        int sample = 0;
 
-    currentUndoIndex = (currentUndoIndex + 1) % MAX_UNDO_STATES;
-    undoStates[currentUndoIndex].savedPointCount = pointCount;
-    undoStates[currentUndoIndex].savedStickCount = stickCount;
-    undoStates[currentUndoIndex].savedBoxCount = boxCount;
+        for (int v = 0; v < MAX_VOICES; v++) {
+            Voice* voice = &soundEngine.voices[v];
+            if (!voice->active) continue;
 
-    for (int i = 0; i < pointCount; i++) {
-        undoStates[currentUndoIndex].savedPoints[i] = points[i];
-    }
+            const ToneStep* tone = &soundDefs[voice->sound].steps[voice->step];
+            sample += (voice->phase < 0.5f) ? SOUND_AMPLITUDE : -SOUND_AMPLITUDE;
+            voice->phase += (float)tone->freq / SOUND_SAMPLE_RATE;
+            if (voice->phase >= 1.0f) voice->phase -= 1.0f;
 
-    for (int i = 0; i < stickCount; i++) {
-        undoStates[currentUndoIndex].savedSticks[i] = sticks[i];
-    }
+            if (--voice->samplesLeft <= 0) {
+                voice->step++;
+                if (voice->step >= soundDefs[voice->sound].stepCount) {
+                    voice->active = 0;
+                }
+                else {
+                    voice->samplesLeft = soundDefs[voice->sound].steps[voice->step].ms * SOUND_SAMPLE_RATE / 1000;
+                }
+            }
+        }
 
-    for (int i = 0; i < boxCount; i++) {
-        undoStates[currentUndoIndex].savedBoxes[i] = boxes[i];
+        if (sample > 32767) sample = 32767;
+        if (sample < -32768) sample = -32768;
+        out[i] = (short)sample;
     }
-
-    undoStates[currentUndoIndex].isValid = 1;
-    if (undoCount < MAX_UNDO_STATES) undoCount++;
 }
 
-void Undo() {
-    if (undoCount == 0 || !undoStates[currentUndoIndex].isValid) return;
+void StartVoice(Voice* voice, int sound) {
+    voice->active = 1;
+    voice->sound = sound;
+    voice->step = 0;
+    voice->phase = 0.0f;
+    voice->samplesLeft = soundDefs[sound].steps[0].ms * SOUND_SAMPLE_RATE / 1000;
+    voice->startClock = soundEngine.clock;
+    soundEngine.lastStart[sound] = soundEngine.clock;
+}
 
-    pointCount = undoStates[currentUndoIndex].savedPointCount;
-    stickCount = undoStates[currentUndoIndex].savedStickCount;
-    boxCount = undoStates[currentUndoIndex].savedBoxCount;
+// Picks a voice for the event or rejects it. Repeats of the same sound
+// inside SOUND_MERGE_MS are merged into the one already playing; a full
+// category (or a full mixer) gives its weakest, oldest voice to a
+// higher-priority event and drops anything else.
+void ScheduleSound(int sound) {
+    const SoundDef* def = &soundDefs[sound];
+    long long mergeSamples = (long long)SOUND_MERGE_MS * SOUND_SAMPLE_RATE / 1000;
 
-    for (int i = 0; i < pointCount; i++) {
-        points[i] = undoStates[currentUndoIndex].savedPoints[i];
+    if (soundEngine.lastStart[sound] >= 0 && soundEngine.clock - soundEngine.lastStart[sound] < mergeSamples) {
+        soundEngine.eventsMerged.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
 
-    for (int i = 0; i < stickCount; i++) {
-        sticks[i] = undoStates[currentUndoIndex].savedSticks[i];
-    }
+    Voice* freeVoice = NULL;
+    Voice* victim = NULL;
+    int inCategory = 0;
 
-    for (int i = 0; i < boxCount; i++) {
-        boxes[i] = undoStates[currentUndoIndex].savedBoxes[i];
+    for (int v = 0; v < MAX_VOICES; v++) {
+        Voice* voice = &soundEngine.voices[v];
+        if (!voice->active) {
+            if (!freeVoice) freeVoice = voice;
+            continue;
+        }
+        if (soundDefs[voice->sound].category == def->category) inCategory++;
     }
 
-    currentUndoIndex = (currentUndoIndex - 1 + MAX_UNDO_STATES) % MAX_UNDO_STATES;
-    undoCount--;
-}
+    int categoryFull = inCategory >= soundCategoryVoices[def->category];
+    if (freeVoice && !categoryFull) {
+        StartVoice(freeVoice, sound);
+        return;
+    }
 
-//---------------------------------------------------------------------
-// CURSOR AND INPUT FUNCTIONS
-//---------------------------------------------------------------------
+    for (int v = 0; v < MAX_VOICES; v++) {
+        Voice* voice = &soundEngine.voices[v];
+        if (!voice->active) continue;
+        if (categoryFull && soundDefs[voice->sound].category != def->category) continue;
 
-void UpdateCursor() {
-    // Speed modifiers
-    if (IsKeyDown(VK_SHIFT)) {
-        cursorSpeedMultiplier = CURSOR_SPEED_FAST;
+        int prio = soundDefs[voice->sound].priority;
+        if (!victim || prio < soundDefs[victim->sound].priority ||
+            (prio == soundDefs[victim->sound].priority && voice->startClock < victim->startClock)) {
+            victim = voice;
+        }
     }
-    else if (IsKeyDown(VK_CONTROL)) {
-        cursorSpeedMultiplier = CURSOR_SPEED_PRECISE;
+
+    if (victim && soundDefs[victim->sound].priority < def->priority) {
+        soundEngine.voicesPreempted.fetch_add(1, std::memory_order_relaxed);
+        StartVoice(victim, sound);
     }
     else {
-        cursorSpeedMultiplier = CURSOR_SPEED_NORMAL;
+        soundEngine.eventsDropped.fetch_add(1, std::memory_order_relaxed);
     }
+}
 
-    // Movement
-    int moveAmount = (int)cursorSpeedMultiplier;
-    if (moveAmount < 1) moveAmount = 1;
-
-    if (IsKeyDown(VK_LEFT)) curX -= moveAmount;
-    if (IsKeyDown(VK_RIGHT)) curX += moveAmount;
-    if (IsKeyDown(VK_UP)) curY -= moveAmount;
-    if (IsKeyDown(VK_DOWN)) curY += moveAmount;
+void SoundThread() {
+    short block[SOUND_BLOCK_SAMPLES];
+    long long blockNs = (long long)SOUND_BLOCK_SAMPLES * 1000000000LL / SOUND_SAMPLE_RATE;
+    long long deadline = GetTimeNs();
+
+    while (!soundEngine.stop.load()) {
+        // Drain pending events, most important first
+        int batch[SOUND_QUEUE_SIZE];
+        int count = 0;
+        int tail = soundEngine.tail.load(std::memory_order_relaxed);
+        int head = soundEngine.head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            int sound = soundEngine.queue[tail % SOUND_QUEUE_SIZE];
+            int at = count++;
+            while (at > 0 && soundDefs[batch[at - 1]].priority < soundDefs[sound].priority) {
+                batch[at] = batch[at - 1];
+                at--;
+            }
+            batch[at] = sound;
+        }
+        soundEngine.tail.store(tail, std::memory_order_release);
 
-    // Clamp
-    if (curX < 0) curX = 0;
-    if (curX >= WIDTH) curX = WIDTH - 1;
-    if (curY < GAME_AREA_TOP) curY = GAME_AREA_TOP;
-    if (curY >= HEIGHT - 2) curY = HEIGHT - 3;
-}
+        for (int i = 0; i < count; i++) ScheduleSound(batch[i]);
 
-void DrawEnhancedCursor() {
-    // Main cursor
-    char cursorChar = dragMode ? 'X' : '+';
-    int cursorColor = dragMode ? COLOR_BRIGHT_RED : COLOR_BRIGHT_MAGENTA;
+        MixSoundBlock(block, SOUND_BLOCK_SAMPLES);
+        soundEngine.sink->write(block, SOUND_BLOCK_SAMPLES);
+        soundEngine.clock += SOUND_BLOCK_SAMPLES;
 
-    PutChar(curX, curY, cursorChar, cursorColor);
+        int active = 0;
+        for (int v = 0; v < MAX_VOICES; v++) active += soundEngine.voices[v].active;
+        soundEngine.activeVoices.store(active, std::memory_order_relaxed);
+
+        // Device sinks block on their own buffers; others keep real time
+        if (!soundEngine.sink->paced) {
+            deadline += blockNs;
+            long long wait = deadline - GetTimeNs();
+            if (wait > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+        }
+    }
+}
+
+// spec is a sink name, optionally followed by ":argument" (wav:out.wav)
+int StartSoundEngine(const char* spec) {
+    char name[16];
+    const char* arg = strchr(spec, ':');
+    int nameLen = arg ? (int)(arg - spec) : (int)strlen(spec);
+    if (nameLen >= (int)sizeof(name)) return 0;
+    memcpy(name, spec, nameLen);
+    name[nameLen] = '\0';
+
+    const SoundSink* sink = NULL;
+    for (int i = 0; i < (int)(sizeof(soundSinks) / sizeof(soundSinks[0])); i++) {
+        if (strcmp(soundSinks[i].name, name) == 0) sink = &soundSinks[i];
+    }
+    if (!sink || !sink->open(arg ? arg + 1 : "")) return 0;
+
+    for (int v = 0; v < MAX_VOICES; v++) soundEngine.voices[v].active = 0;
+    for (int i = 0; i < SOUND_COUNT; i++) soundEngine.lastStart[i] = -1;
+    soundEngine.clock = 0;
+    soundEngine.activeVoices = 0;
+    soundEngine.eventsMerged = 0;
+    soundEngine.eventsDropped = 0;
+    soundEngine.voicesPreempted = 0;
+    soundEngine.sink = sink;
+    soundEngine.head = 0;
+    soundEngine.tail = 0;
+    soundEngine.stop = 0;
+    soundEngine.running = 1;
+    soundEngine.thread = std::thread(SoundThread);
+    return 1;
+}
+
+void StopSoundEngine() {
+    if (!soundEngine.running) return;
+
+    soundEngine.stop = 1;
+    soundEngine.thread.join();
+    soundEngine.sink->close();
+    soundEngine.running = 0;
+}
+
+void ToggleSound() {
+    soundManager.enabled = !soundManager.enabled;
+}
+
+int SoundActive() {
+    return soundManager.enabled && !headlessMode;
+}
+
+//---------------------------------------------------------------------
+// UNDO SYSTEM
+//---------------------------------------------------------------------
+
+// Arrays covered by the journal, in restore order
+JournalArray journalArrays[JOURNAL_ARRAYS] = {
+    { points, &pointCount, sizeof(Point) },
+    { sticks, &stickCount, sizeof(Stick) },
+    { boxes, &boxCount, sizeof(Box) },
+    { entities, &entityCount, sizeof(Entity) }
+};
+
+char* CopyRecords(int array, int first, int count) {
+    if (count <= 0) return NULL;
+    JournalArray* arr = &journalArrays[array];
+    char* image = (char*)malloc((size_t)count * arr->recordSize);
+    memcpy(image, (char*)arr->base + (size_t)first * arr->recordSize, (size_t)count * arr->recordSize);
+    return image;
+}
+
+void RestoreRecords(int array, int first, int count, const char* image) {
+    if (count <= 0) return;
+    JournalArray* arr = &journalArrays[array];
+    memcpy((char*)arr->base + (size_t)first * arr->recordSize, image, (size_t)count * arr->recordSize);
+    worldRevision++;
+}
+
+void FreeJournalEntry(JournalEntry* entry) {
+    for (int r = 0; r < entry->rangeCount; r++) {
+        free(entry->ranges[r].before);
+        free(entry->ranges[r].after);
+    }
+    journalBytes -= entry->bytes;
+    entry->rangeCount = 0;
+    entry->bytes = 0;
+}
+
+// i-th entry from the oldest
+JournalEntry* JournalAt(int i) {
+    return &undoJournal[(journalFirst + i) % MAX_UNDO_STATES];
+}
+
+void ClearJournal() {
+    for (int i = 0; i < journalCount; i++) FreeJournalEntry(JournalAt(i));
+    journalFirst = 0;
+    journalCount = 0;
+    undoCount = 0;
+    editOpen = 0;
+}
+
+// Starts journaling a sandbox edit; pairs with EndEdit()
+void BeginEdit() {
+    if (currentMode != 1) return;
+
+    for (int a = 0; a < JOURNAL_ARRAYS; a++) {
+        pendingEdit.beforeCounts[a] = *journalArrays[a].count;
+    }
+    pendingEdit.rangeCount = 0;
+    pendingEdit.wholeArrays = 0;
+    pendingEdit.bytes = 0;
+    editOpen = 1;
+}
+
+// Replaces the ranges of an edit with one per array covering every record
+// that existed before it. Records outside the ranges are still unchanged,
+// so the before images are the current records with the ranges' before
+// images laid over them, earliest range last.
+void JournalWholeArrays(JournalEntry* edit) {
+    JournalRange whole[JOURNAL_ARRAYS];
+    int bytes = 0;
+    for (int a = 0; a < JOURNAL_ARRAYS; a++) {
+        whole[a].array = a;
+        whole[a].first = 0;
+        whole[a].beforeCount = edit->beforeCounts[a];
+        whole[a].afterCount = 0;
+        whole[a].before = CopyRecords(a, 0, edit->beforeCounts[a]);
+        whole[a].after = NULL;
+        bytes += edit->beforeCounts[a] * journalArrays[a].recordSize;
+    }
+
+    for (int r = edit->rangeCount - 1; r >= 0; r--) {
+        JournalRange* range = &edit->ranges[r];
+        int size = journalArrays[range->array].recordSize;
+        int count = edit->beforeCounts[range->array] - range->first;
+        if (count > range->beforeCount) count = range->beforeCount;
+        if (count > 0) memcpy(whole[range->array].before + (size_t)range->first * size, range->before, (size_t)count * size);
+        free(range->before);
+    }
+
+    for (int a = 0; a < JOURNAL_ARRAYS; a++) edit->ranges[a] = whole[a];
+    edit->rangeCount = JOURNAL_ARRAYS;
+    edit->wholeArrays = 1;
+    edit->bytes = bytes;
+}
+
+// Call before an open edit changes or drops existing records
+void JournalModify(int array, int first, int count) {
+    if (!editOpen || count <= 0 || pendingEdit.wholeArrays) return;
+    if (pendingEdit.rangeCount >= MAX_JOURNAL_RANGES) {
+        JournalWholeArrays(&pendingEdit);
+        return;
+    }
+
+    JournalRange* range = &pendingEdit.ranges[pendingEdit.rangeCount++];
+    range->array = array;
+    range->first = first;
+    range->beforeCount = count;
+    range->afterCount = 0;
+    range->before = CopyRecords(array, first, count);
+    range->after = NULL;
+    pendingEdit.bytes += count * journalArrays[array].recordSize;
+}
+
+void EndEdit() {
+    if (!editOpen) return;
+    editOpen = 0;
+
+    JournalEntry* edit = &pendingEdit;
+
+    // Appended records need a range per array too
+    int appended = 0;
+    for (int a = 0; a < JOURNAL_ARRAYS; a++) appended += *journalArrays[a].count > edit->beforeCounts[a];
+    if (!edit->wholeArrays && edit->rangeCount + appended > MAX_JOURNAL_RANGES) JournalWholeArrays(edit);
+
+    // After images of the modified ranges that still exist
+    for (int r = 0; r < edit->rangeCount; r++) {
+        JournalRange* range = &edit->ranges[r];
+        int alive = *journalArrays[range->array].count - range->first;
+        if (alive < 0) alive = 0;
+        range->afterCount = alive < range->beforeCount ? alive : range->beforeCount;
+        range->after = CopyRecords(range->array, range->first, range->afterCount);
+        edit->bytes += range->afterCount * journalArrays[range->array].recordSize;
+    }
+
+    // Appended records
+    for (int a = 0; a < JOURNAL_ARRAYS; a++) {
+        edit->afterCounts[a] = *journalArrays[a].count;
+        int added = edit->afterCounts[a] - edit->beforeCounts[a];
+        if (added <= 0) continue;
+
+        JournalRange* range = &edit->ranges[edit->rangeCount++];
+        range->array = a;
+        range->first = edit->beforeCounts[a];
+        range->beforeCount = 0;
+        range->afterCount = added;
+        range->before = NULL;
+        range->after = CopyRecords(a, range->first, added);
+        edit->bytes += added * journalArrays[a].recordSize;
+    }
+
+    // A new edit discards the redo stack
+    for (int i = undoCount; i < journalCount; i++) FreeJournalEntry(JournalAt(i));
+    journalCount = undoCount;
+
+    // Evict the oldest entries past the depth or memory budget
+    while (journalCount > 0 &&
+        (journalCount >= MAX_UNDO_STATES || journalBytes + edit->bytes > UNDO_MEMORY_BUDGET)) {
+        FreeJournalEntry(JournalAt(0));
+        journalFirst = (journalFirst + 1) % MAX_UNDO_STATES;
+        journalCount--;
+    }
+
+    *JournalAt(journalCount++) = *edit;
+    undoCount = journalCount;
+    journalBytes += edit->bytes;
+}
+
+void Undo() {
+    if (undoCount == 0) return;
+
+    JournalEntry* entry = JournalAt(--undoCount);
+    for (int a = 0; a < JOURNAL_ARRAYS; a++) *journalArrays[a].count = entry->beforeCounts[a];
+    for (int r = entry->rangeCount - 1; r >= 0; r--) {
+        JournalRange* range = &entry->ranges[r];
+        RestoreRecords(range->array, range->first, range->beforeCount, range->before);
+    }
+    dragPoint = -1;
+}
+
+void Redo() {
+    if (undoCount == journalCount) return;
+
+    JournalEntry* entry = JournalAt(undoCount++);
+    for (int a = 0; a < JOURNAL_ARRAYS; a++) *journalArrays[a].count = entry->afterCounts[a];
+    for (int r = 0; r < entry->rangeCount; r++) {
+        JournalRange* range = &entry->ranges[r];
+        RestoreRecords(range->array, range->first, range->afterCount, range->after);
+    }
+    dragPoint = -1;
+}
+
+// Sandbox R key: empties the world as an undoable edit
+void ResetSandbox() {
+    BeginEdit();
+    for (int a = 0; a < JOURNAL_ARRAYS; a++) JournalModify(a, 0, *journalArrays[a].count);
+    pointCount = 0;
+    stickCount = 0;
+    boxCount = 0;
+    entityCount = 0;
+    EndEdit();
+
+    dragPoint = -1;
+    ropeStartX = -1;
+    ropeStartY = -1;
+    for (int i = 0; i < MAX_PARTICLES; i++) particles[i].active = 0;
+}
+
+//---------------------------------------------------------------------
+// WORLD SNAPSHOTS
+//---------------------------------------------------------------------
+
+int OpenMappedFile(MappedFile* mf, const char* path) {
+    mf->data = NULL;
+    mf->size = 0;
+#ifdef _WIN32
+    mf->mapping = NULL;
+    mf->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mf->file == INVALID_HANDLE_VALUE) return 0;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mf->file, &size) || size.QuadPart == 0) {
+        CloseHandle(mf->file);
+        return 0;
+    }
+    mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mf->mapping) mf->data = (const unsigned char*)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mf->data) {
+        if (mf->mapping) CloseHandle(mf->mapping);
+        CloseHandle(mf->file);
+        return 0;
+    }
+    mf->size = (size_t)size.QuadPart;
+#else
+    mf->fd = open(path, O_RDONLY);
+    if (mf->fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(mf->fd, &st) != 0 || st.st_size == 0) {
+        close(mf->fd);
+        return 0;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, mf->fd, 0);
+    if (data == MAP_FAILED) {
+        close(mf->fd);
+        return 0;
+    }
+    mf->data = (const unsigned char*)data;
+    mf->size = (size_t)st.st_size;
+#endif
+    return 1;
+}
+
+void CloseMappedFile(MappedFile* mf) {
+    if (!mf->data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(mf->data);
+    CloseHandle(mf->mapping);
+    CloseHandle(mf->file);
+#else
+    munmap((void*)mf->data, mf->size);
+    close(mf->fd);
+#endif
+    mf->data = NULL;
+    mf->size = 0;
+}
+
+// Validates the header and section table and points the view into the
+// mapping. Record contents are used as they are.
+int MapSnapshot(const MappedFile* mf, WorldView* view) {
+    static const unsigned int recordSizes[SNAP_SECTION_COUNT] = {
+        sizeof(Point), sizeof(Stick), sizeof(Box), sizeof(Target), sizeof(Particle), sizeof(Entity)
+    };
+
+    if (mf->size < sizeof(SnapshotHeader)) return 0;
+    const SnapshotHeader* header = (const SnapshotHeader*)mf->data;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0) return 0;
+    if (header->version != SNAPSHOT_VERSION || header->endianTag != SNAPSHOT_ENDIAN_TAG) return 0;
+    if (header->fileSize != mf->size || header->sectionCount != SNAP_SECTION_COUNT) return 0;
+    if (sizeof(SnapshotHeader) + SNAP_SECTION_COUNT * sizeof(SnapshotSection) > mf->size) return 0;
+
+    const SnapshotSection* sections = (const SnapshotSection*)(mf->data + sizeof(SnapshotHeader));
+    const void* base[SNAP_SECTION_COUNT];
+    int counts[SNAP_SECTION_COUNT];
+    for (int s = 0; s < SNAP_SECTION_COUNT; s++) {
+        const SnapshotSection* sec = &sections[s];
+        if (sec->id != (unsigned int)s || sec->recordSize != recordSizes[s]) return 0;
+        if (sec->offset % 8 != 0 || sec->offset > mf->size) return 0;
+        if ((unsigned long long)sec->count * sec->recordSize > mf->size - sec->offset) return 0;
+        base[s] = mf->data + sec->offset;
+        counts[s] = (int)sec->count;
+    }
+
+    view->points = (const Point*)base[SNAP_POINTS];
+    view->pointCount = counts[SNAP_POINTS];
+    view->sticks = (const Stick*)base[SNAP_STICKS];
+    view->stickCount = counts[SNAP_STICKS];
+    view->boxes = (const Box*)base[SNAP_BOXES];
+    view->boxCount = counts[SNAP_BOXES];
+    view->targets = (const Target*)base[SNAP_TARGETS];
+    view->targetCount = counts[SNAP_TARGETS];
+    view->particles = (const Particle*)base[SNAP_PARTICLES];
+    view->particleCount = counts[SNAP_PARTICLES];
+    view->entities = (const Entity*)base[SNAP_ENTITIES];
+    view->entityCount = counts[SNAP_ENTITIES];
+    return 1;
+}
+
+int SaveSnapshot(const char* path, const WorldView* view) {
+    // Records are written as they are in memory, so only little-endian hosts can save
+    if (*(const unsigned char*)&SNAPSHOT_ENDIAN_TAG != 0x04) return 0;
+
+    const void* data[SNAP_SECTION_COUNT] = {
+        view->points, view->sticks, view->boxes, view->targets, view->particles, view->entities
+    };
+    int counts[SNAP_SECTION_COUNT] = {
+        view->pointCount, view->stickCount, view->boxCount, view->targetCount, view->particleCount,
+        view->entityCount
+    };
+    static const unsigned int recordSizes[SNAP_SECTION_COUNT] = {
+        sizeof(Point), sizeof(Stick), sizeof(Box), sizeof(Target), sizeof(Particle), sizeof(Entity)
+    };
+
+    SnapshotSection sections[SNAP_SECTION_COUNT];
+    unsigned long long offset = sizeof(SnapshotHeader) + sizeof(sections);
+    for (int s = 0; s < SNAP_SECTION_COUNT; s++) {
+        offset = (offset + 7) & ~7ULL;
+        sections[s].id = s;
+        sections[s].count = counts[s];
+        sections[s].recordSize = recordSizes[s];
+        sections[s].offset = (unsigned int)offset;
+        offset += (unsigned long long)counts[s] * recordSizes[s];
+    }
+    if (offset > 0xFFFFFFFFULL) return 0;
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.endianTag = SNAPSHOT_ENDIAN_TAG;
+    header.fileSize = (unsigned int)offset;
+    header.sectionCount = SNAP_SECTION_COUNT;
+    header.reserved = 0;
+
+    // Same write-behind as the profile: a short write or a crash leaves the
+    // previous snapshot in place
+    char temp[270];
+    sprintf_s(temp, sizeof(temp), "%s.tmp", path);
+    FILE* file;
+    if (fopen_s(&file, temp, "wb") != 0 || !file) return 0;
+
+    static const char zeros[8] = { 0 };
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(sections, sizeof(sections), 1, file) == 1;
+    unsigned int pos = sizeof(SnapshotHeader) + sizeof(sections);
+    for (int s = 0; s < SNAP_SECTION_COUNT; s++) {
+        fwrite(zeros, 1, sections[s].offset - pos, file);
+        size_t bytes = (size_t)counts[s] * recordSizes[s];
+        if (bytes > 0 && fwrite(data[s], bytes, 1, file) != 1) ok = 0;
+        pos = sections[s].offset + (unsigned int)bytes;
+    }
+    ok = ok && fflush(file) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(file)) == 0;
+#else
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        remove(temp);
+        return 0;
+    }
+
+#ifdef _WIN32
+    return MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(temp, path) == 0;
+#endif
+}
+
+WorldView CurrentWorldView() {
+    WorldView view;
+    view.points = points;
+    view.pointCount = pointCount;
+    view.sticks = sticks;
+    view.stickCount = stickCount;
+    view.boxes = boxes;
+    view.boxCount = boxCount;
+    view.targets = targets;
+    view.targetCount = targetCount;
+    view.particles = particles;
+    view.particleCount = MAX_PARTICLES;
+    view.entities = entities;
+    view.entityCount = entityCount;
+    return view;
+}
+
+// Replaces the sandbox with a snapshot. Undoable like a reset.
+int LoadSnapshot(const char* path) {
+    MappedFile file;
+    if (!OpenMappedFile(&file, path)) return 0;
+
+    WorldView view;
+    int ok = MapSnapshot(&file, &view);
+    ok = ok && view.pointCount <= MAX_POINTS && view.stickCount <= MAX_STICKS &&
+        view.boxCount <= MAX_BOXES && view.targetCount <= MAX_TARGETS;
+    for (int i = 0; ok && i < view.stickCount; i++) {
+        const Stick* s = &view.sticks[i];
+        ok = s->p1 >= 0 && s->p1 < view.pointCount && s->p2 >= 0 && s->p2 < view.pointCount;
+    }
+    ok = ok && view.entityCount <= MAX_ENTITIES;
+    for (int i = 0; ok && i < view.entityCount; i++) {
+        ok = ValidEntity(&view.entities[i], view.pointCount, view.stickCount);
+    }
+
+    if (ok) {
+        BeginEdit();
+        for (int a = 0; a < JOURNAL_ARRAYS; a++) JournalModify(a, 0, *journalArrays[a].count);
+        memcpy(points, view.points, view.pointCount * sizeof(Point));
+        memcpy(sticks, view.sticks, view.stickCount * sizeof(Stick));
+        memcpy(boxes, view.boxes, view.boxCount * sizeof(Box));
+        memcpy(entities, view.entities, view.entityCount * sizeof(Entity));
+        pointCount = view.pointCount;
+        stickCount = view.stickCount;
+        boxCount = view.boxCount;
+        entityCount = view.entityCount;
+        worldRevision++;
+        EndEdit();
+
+        memcpy(targets, view.targets, view.targetCount * sizeof(Target));
+        targetCount = view.targetCount;
+        int particleCount = view.particleCount < MAX_PARTICLES ? view.particleCount : MAX_PARTICLES;
+        memcpy(particles, view.particles, particleCount * sizeof(Particle));
+        for (int i = particleCount; i < MAX_PARTICLES; i++) particles[i].active = 0;
+
+        dragPoint = -1;
+        ropeStartX = -1;
+        ropeStartY = -1;
+    }
+
+    CloseMappedFile(&file);
+    return ok;
+}
+
+// Saves a synthetic world of ragdoll chains and times mapping it back
+int RunSnapshotBenchmark(int pointTotal) {
+    const char* path = "bench_snapshot.rgw";
+    const int loads = 200;
+
+    Point* pts = (Point*)calloc(pointTotal, sizeof(Point));
+    Stick* sts = (Stick*)calloc(pointTotal, sizeof(Stick));
+    if (!pts || !sts) return 1;
+
+    int stickTotal = 0;
+    for (int i = 0; i < pointTotal; i++) {
+        Point* p = &pts[i];
+        p->x = p->oldX = (float)(i % 1000) * 0.1f;
+        p->y = p->oldY = (float)(i / 1000);
+        p->isActive = 1;
+        p->symbol = 'o';
+        p->radius = 1.0f;
+        p->isRagdollPart = 1;
+        p->color = COLOR_WHITE;
+        if (i % 10 != 0) {
+            Stick* s = &sts[stickTotal++];
+            s->p1 = i - 1;
+            s->p2 = i;
+            s->length = 0.1f;
+            s->active = 1;
+            s->isRagdollStick = 1;
+        }
+    }
+
+    WorldView world = CurrentWorldView();
+    world.points = pts;
+    world.pointCount = pointTotal;
+    world.sticks = sts;
+    world.stickCount = stickTotal;
+    world.entityCount = 0;
+
+    long long start = GetTimeNs();
+    int saved = SaveSnapshot(path, &world);
+    long long saveNs = GetTimeNs() - start;
+    if (!saved) {
+        printf("Cannot write %s\n", path);
+        return 1;
+    }
+
+    // Map and validate only
+    MappedFile file;
+    WorldView view;
+    start = GetTimeNs();
+    for (int i = 0; i < loads; i++) {
+        if (!OpenMappedFile(&file, path) || !MapSnapshot(&file, &view)) return 1;
+        CloseMappedFile(&file);
+    }
+    long long mapNs = (GetTimeNs() - start) / loads;
+
+    // Map and read every point, as the first simulation step would
+    float sum = 0.0f;
+    start = GetTimeNs();
+    for (int i = 0; i < loads; i++) {
+        OpenMappedFile(&file, path);
+        MapSnapshot(&file, &view);
+        for (int p = 0; p < view.pointCount; p++) sum += view.points[p].x;
+        CloseMappedFile(&file);
+    }
+    long long touchNs = (GetTimeNs() - start) / loads;
+
+    // Buffered read of the whole file, for comparison
+    size_t fileSize = 0;
+    if (OpenMappedFile(&file, path)) {
+        fileSize = file.size;
+        CloseMappedFile(&file);
+    }
+    char* buffer = (char*)malloc(fileSize);
+    start = GetTimeNs();
+    for (int i = 0; i < loads; i++) {
+        FILE* f;
+        if (fopen_s(&f, path, "rb") != 0 || !f) return 1;
+        fread(buffer, 1, fileSize, f);
+        fclose(f);
+    }
+    long long readNs = (GetTimeNs() - start) / loads;
+
+    printf("Snapshot: %d points, %d sticks, %.1f MB (%s)\n",
+        view.pointCount, view.stickCount, fileSize / 1048576.0, sum != 0.0f ? "ok" : "empty");
+    printf("  save:                 %8.2f ms\n", saveNs / 1e6);
+    printf("  map + validate:       %8.2f us\n", mapNs / 1e3);
+    printf("  map + read points:    %8.2f us\n", touchNs / 1e3);
+    printf("  fread whole file:     %8.2f us\n", readNs / 1e3);
+
+    free(buffer);
+    free(pts);
+    free(sts);
+    remove(path);
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// LEVEL STREAMING
+//---------------------------------------------------------------------
+// The world arrays hold the resident window. When the focus (the ragdoll
+// head, or the cursor when there is none) moves to another chunk, objects
+// outside the new window are written out and the arrays are compacted,
+// then the chunks entering the window are appended. Objects belong to the
+// chunk they are in when they leave, so anything that drifted across a
+// boundary is handed to its new chunk. Points joined by sticks move as
+// one group, so stick indices inside an image never point outside it.
+
+// Chunk image scratch, sized like the world so any resident set fits
+Point chunkPoints[MAX_POINTS];
+Stick chunkSticks[MAX_STICKS];
+Box chunkBoxes[MAX_BOXES];
+Entity chunkEntities[MAX_ENTITIES];
+
+int ChunkOf(float x) {
+    int c = (int)floorf(x / CHUNK_WIDTH);
+    if (c < 0) c = 0;
+    if (c >= levelStream.chunkCount) c = levelStream.chunkCount - 1;
+    return c;
+}
+
+// Procedural test level: platforms with coins, a pendulum and a hanging
+// rope in every chunk, all above the ragdoll's head on flat ground
+int BuildStreamLevel(const char* path, int chunkTotal) {
+    if (chunkTotal < 1 || chunkTotal > MAX_CHUNKS) return 0;
+
+    FILE* file;
+    if (fopen_s(&file, path, "wb") != 0 || !file) return 0;
+
+    StreamHeader header;
+    memcpy(header.magic, STREAM_MAGIC, 4);
+    header.version = STREAM_VERSION;
+    header.chunkCount = chunkTotal;
+    header.chunkWidth = CHUNK_WIDTH;
+    fwrite(&header, sizeof(header), 1, file);
+
+    // Table first, filled in once the images are written
+    StreamChunkEntry* table = (StreamChunkEntry*)calloc(chunkTotal, sizeof(StreamChunkEntry));
+    fwrite(table, sizeof(StreamChunkEntry), chunkTotal, file);
+
+    unsigned int offset = sizeof(header) + chunkTotal * sizeof(StreamChunkEntry);
+    for (int c = 0; c < chunkTotal; c++) {
+        float x0 = (float)(c * CHUNK_WIDTH);
+        int pc = 0, sc = 0, bc = 0, ec = 0;
+        Point* p = chunkPoints;
+
+        memset(chunkPoints, 0, 16 * sizeof(Point));
+        for (int i = 0; i < 1 + c % 3; i++) {
+            p[pc].x = x0 + 10 + i * 6;
+            p[pc].y = 9;
+            p[pc].symbol = '$';
+            p[pc].pickup = PICKUP_COIN;
+            p[pc].radius = 0.5f;
+            p[pc].color = COLOR_BRIGHT_YELLOW;
+            chunkEntities[ec++] = MakeEntity(ENTITY_COIN, pc, 1, sc, 0, pc);
+            pc++;
+        }
+
+        chunkEntities[ec++] = MakeEntity(ENTITY_ROPE, pc, 2, sc, 1, pc);
+        p[pc].x = x0 + 40; p[pc].y = 3; p[pc].symbol = 'O'; p[pc].isLocked = 1;
+        p[pc].radius = 1.0f; p[pc].color = COLOR_BRIGHT_CYAN; pc++;
+        p[pc].x = x0 + 46; p[pc].y = 8; p[pc].symbol = '['; p[pc].radius = 1.0f;
+        p[pc].color = COLOR_BRIGHT_YELLOW; pc++;
+        chunkSticks[sc].p1 = pc - 2;
+        chunkSticks[sc].p2 = pc - 1;
+        sc++;
+
+        chunkEntities[ec++] = MakeEntity(ENTITY_ROPE, pc, 4, sc, 3, pc);
+        for (int i = 0; i < 4; i++) {
+            p[pc].x = x0 + 56; p[pc].y = 3.0f + i * 3; p[pc].symbol = i == 0 ? 'O' : 'o';
+            p[pc].isLocked = (i == 0); p[pc].radius = 0.6f; p[pc].color = COLOR_WHITE; pc++;
+            if (i > 0) {
+                chunkSticks[sc].p1 = pc - 2;
+                chunkSticks[sc].p2 = pc - 1;
+                sc++;
+            }
+        }
+
+        for (int i = 0; i < pc; i++) {
+            p[i].oldX = p[i].x;
+            p[i].oldY = p[i].y;
+            p[i].isActive = 1;
+        }
+        for (int i = 0; i < sc; i++) {
+            Stick* s = &chunkSticks[i];
+            s->length = GetDistance(p[s->p1].x, p[s->p1].y, p[s->p2].x, p[s->p2].y);
+            s->active = 1;
+            s->isRagdollStick = 0;
+        }
+
+        Box platform = { x0 + 16, 12, 20, 2, 1, 1, 1 };
+        chunkBoxes[bc++] = platform;
+        if (c % 2 == 1) {
+            Box ledge = { x0 + 48, 15, 12, 2, 1, 1, 1 };
+            chunkBoxes[bc++] = ledge;
+        }
+
+        fwrite(chunkPoints, sizeof(Point), pc, file);
+        fwrite(chunkSticks, sizeof(Stick), sc, file);
+        fwrite(chunkBoxes, sizeof(Box), bc, file);
+        fwrite(chunkEntities, sizeof(Entity), ec, file);
+        table[c].offset = offset;
+        table[c].pointCount = (unsigned short)pc;
+        table[c].stickCount = (unsigned short)sc;
+        table[c].boxCount = (unsigned short)bc;
+        table[c].entityCount = (unsigned short)ec;
+        offset += pc * sizeof(Point) + sc * sizeof(Stick) + bc * sizeof(Box) + ec * sizeof(Entity);
+    }
+
+    fseek(file, sizeof(header), SEEK_SET);
+    fwrite(table, sizeof(StreamChunkEntry), chunkTotal, file);
+    free(table);
+    return fclose(file) == 0;
+}
+
+// Reads a chunk image into the scratch arrays
+int ReadChunk(int c) {
+    Chunk* chunk = &levelStream.chunks[c];
+    if (chunk->pointCount + chunk->stickCount + chunk->boxCount + chunk->entityCount == 0) return 1;
+    if (chunk->pointCount > MAX_POINTS || chunk->stickCount > MAX_STICKS || chunk->boxCount > MAX_BOXES) return 0;
+    if (chunk->entityCount > MAX_ENTITIES) return 0;
+
+    FILE* file = chunk->inSwap ? levelStream.swap : levelStream.level;
+    if (fseek(file, chunk->offset, SEEK_SET) != 0) return 0;
+    if (fread(chunkPoints, sizeof(Point), chunk->pointCount, file) != chunk->pointCount) return 0;
+    if (fread(chunkSticks, sizeof(Stick), chunk->stickCount, file) != chunk->stickCount) return 0;
+    if (fread(chunkBoxes, sizeof(Box), chunk->boxCount, file) != chunk->boxCount) return 0;
+    if (fread(chunkEntities, sizeof(Entity), chunk->entityCount, file) != chunk->entityCount) return 0;
+
+    for (int i = 0; i < chunk->stickCount; i++) {
+        if (chunkSticks[i].p1 < 0 || chunkSticks[i].p1 >= chunk->pointCount) return 0;
+        if (chunkSticks[i].p2 < 0 || chunkSticks[i].p2 >= chunk->pointCount) return 0;
+    }
+    for (int i = 0; i < chunk->entityCount; i++) {
+        if (!ValidEntity(&chunkEntities[i], chunk->pointCount, chunk->stickCount)) return 0;
+    }
+    return 1;
+}
+
+// Writes the scratch arrays as chunk c's image in the swap file
+void WriteChunk(int c, int pc, int sc, int bc, int ec) {
+    Chunk* chunk = &levelStream.chunks[c];
+    unsigned int bytes = pc * sizeof(Point) + sc * sizeof(Stick) + bc * sizeof(Box) + ec * sizeof(Entity);
+
+    if (!chunk->inSwap || bytes > chunk->capacity) {
+        chunk->offset = levelStream.swapEnd;
+        chunk->capacity = bytes;
+        chunk->inSwap = 1;
+        levelStream.swapEnd += bytes;
+    }
+    fseek(levelStream.swap, chunk->offset, SEEK_SET);
+    fwrite(chunkPoints, sizeof(Point), pc, levelStream.swap);
+    fwrite(chunkSticks, sizeof(Stick), sc, levelStream.swap);
+    fwrite(chunkBoxes, sizeof(Box), bc, levelStream.swap);
+    fwrite(chunkEntities, sizeof(Entity), ec, levelStream.swap);
+
+    chunk->pointCount = (unsigned short)pc;
+    chunk->stickCount = (unsigned short)sc;
+    chunk->boxCount = (unsigned short)bc;
+    chunk->entityCount = (unsigned short)ec;
+}
+
+int FindGroup(int* parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Writes out every object whose group lies outside [lo, hi] and compacts
+// the world arrays. Groups containing a ragdoll part always stay, and so
+// does everything bound for a chunk that cannot be read or would not fit.
+// Returns 1 if any record moved.
+int PageOut(int lo, int hi) {
+    static int parent[MAX_POINTS];
+    static int groupChunk[MAX_POINTS];
+    static int boxChunk[MAX_BOXES];
+    static int remap[MAX_POINTS];
+    static int stickRemap[MAX_STICKS];
+    static int targetChunks[MAX_POINTS + MAX_BOXES + 2 * CHUNK_RESIDENT_RADIUS + 1];
+
+    for (int i = 0; i < pointCount; i++) parent[i] = i;
+    for (int s = 0; s < stickCount; s++) {
+        int a = FindGroup(parent, sticks[s].p1);
+        int b = FindGroup(parent, sticks[s].p2);
+        if (a != b) parent[a > b ? a : b] = a < b ? a : b;
+    }
+
+    // A group goes where its first point is; -1 keeps it resident
+    for (int i = 0; i < pointCount; i++) groupChunk[i] = -2;
+    for (int i = 0; i < pointCount; i++) {
+        int g = FindGroup(parent, i);
+        if (groupChunk[g] == -2) {
+            int c = ChunkOf(points[i].x);
+            groupChunk[g] = (c >= lo && c <= hi) ? -1 : c;
+        }
+        if (points[i].isRagdollPart) groupChunk[g] = -1;
+    }
+    for (int b = 0; b < boxCount; b++) {
+        int c = ChunkOf(boxes[b].x);
+        boxChunk[b] = (c >= lo && c <= hi) ? -1 : c;
+    }
+
+    // Chunks that receive objects, plus resident chunks leaving the window
+    int targetCount = 0;
+    for (int c = levelStream.firstResident; c >= 0 && c <= levelStream.lastResident; c++) {
+        if (c < lo || c > hi) targetChunks[targetCount++] = c;
+    }
+    for (int i = 0; i < pointCount; i++) {
+        int c = groupChunk[i];
+        if (FindGroup(parent, i) == i && c >= 0 && !levelStream.chunks[c].resident) targetChunks[targetCount++] = c;
+    }
+    for (int b = 0; b < boxCount; b++) {
+        int c = boxChunk[b];
+        if (c >= 0 && !levelStream.chunks[c].resident) targetChunks[targetCount++] = c;
+    }
+
+    for (int t = 0; t < targetCount; t++) {
+        int c = targetChunks[t];
+        int seen = 0;
+        for (int u = 0; u < t && !seen; u++) seen = (targetChunks[u] == c);
+        if (seen) continue;
+
+        // A chunk that is already out keeps its old contents
+        int pc = 0, sc = 0, bc = 0, ec = 0;
+        int readable = 1;
+        if (!levelStream.chunks[c].resident) {
+            readable = ReadChunk(c);
+            pc = levelStream.chunks[c].pointCount;
+            sc = levelStream.chunks[c].stickCount;
+            bc = levelStream.chunks[c].boxCount;
+            ec = levelStream.chunks[c].entityCount;
+        }
+
+        // Size the whole image before writing any of it
+        int outPoints = 0, outSticks = 0, outBoxes = 0, outEntities = 0;
+        for (int i = 0; i < pointCount; i++) outPoints += groupChunk[FindGroup(parent, i)] == c;
+        for (int s = 0; s < stickCount; s++) outSticks += groupChunk[FindGroup(parent, sticks[s].p1)] == c;
+        for (int b = 0; b < boxCount; b++) outBoxes += boxChunk[b] == c;
+        for (int n = 0; n < entityCount; n++) outEntities += groupChunk[FindGroup(parent, entities[n].firstPoint)] == c;
+        if (!readable || pc + outPoints > MAX_POINTS || sc + outSticks > MAX_STICKS ||
+            bc + outBoxes > MAX_BOXES || ec + outEntities > MAX_ENTITIES) {
+            // Stays resident; the next window move tries again
+            for (int i = 0; i < pointCount; i++) {
+                if (groupChunk[i] == c) groupChunk[i] = -1;
+            }
+            for (int b = 0; b < boxCount; b++) {
+                if (boxChunk[b] == c) boxChunk[b] = -1;
+            }
+            levelStream.overflows++;
+            continue;
+        }
+
+        int base = pc;
+        int stickBase = sc;
+        for (int i = 0; i < pointCount; i++) {
+            if (groupChunk[FindGroup(parent, i)] != c) continue;
+            remap[i] = pc - base;
+            chunkPoints[pc++] = points[i];
+        }
+        for (int s = 0; s < stickCount; s++) {
+            if (groupChunk[FindGroup(parent, sticks[s].p1)] != c) continue;
+            stickRemap[s] = sc - stickBase;
+            chunkSticks[sc] = sticks[s];
+            chunkSticks[sc].p1 = base + remap[sticks[s].p1];
+            chunkSticks[sc].p2 = base + remap[sticks[s].p2];
+            sc++;
+        }
+        for (int b = 0; b < boxCount; b++) {
+            if (boxChunk[b] == c) chunkBoxes[bc++] = boxes[b];
+        }
+
+        // An entity's points and sticks share a group, so its ranges stay contiguous
+        for (int n = 0; n < entityCount; n++) {
+            const Entity* ent = &entities[n];
+            if (groupChunk[FindGroup(parent, ent->firstPoint)] != c) continue;
+            chunkEntities[ec] = *ent;
+            chunkEntities[ec].firstPoint = base + remap[ent->firstPoint];
+            chunkEntities[ec].firstStick = ent->stickCount > 0 ? stickBase + stickRemap[ent->firstStick] : sc;
+            chunkEntities[ec].head = ent->head >= 0 ? base + remap[ent->head] : -1;
+            ec++;
+        }
+
+        WriteChunk(c, pc, sc, bc, ec);
+        levelStream.chunks[c].resident = 0;
+        levelStream.pageOuts++;
+    }
+
+    // Compact what stays
+    int kept = 0;
+    for (int i = 0; i < pointCount; i++) {
+        remap[i] = -1;
+        if (groupChunk[FindGroup(parent, i)] != -1) continue;
+        remap[i] = kept;
+        points[kept++] = points[i];
+    }
+    int keptSticks = 0;
+    for (int s = 0; s < stickCount; s++) {
+        if (remap[sticks[s].p1] < 0) continue;
+        stickRemap[s] = keptSticks;
+        sticks[keptSticks] = sticks[s];
+        sticks[keptSticks].p1 = remap[sticks[s].p1];
+        sticks[keptSticks].p2 = remap[sticks[s].p2];
+        keptSticks++;
+    }
+    int keptBoxes = 0;
+    for (int b = 0; b < boxCount; b++) {
+        if (boxChunk[b] == -1) boxes[keptBoxes++] = boxes[b];
+    }
+    int keptEntities = 0;
+    for (int n = 0; n < entityCount; n++) {
+        Entity ent = entities[n];
+        if (remap[ent.firstPoint] < 0) continue;
+        if (ent.stickCount > 0) ent.firstStick = stickRemap[ent.firstStick];
+        if (ent.head >= 0) ent.head = remap[ent.head];
+        ent.firstPoint = remap[ent.firstPoint];
+        entities[keptEntities++] = ent;
+    }
+
+    if (dragPoint >= 0) dragPoint = remap[dragPoint];
+    worldRevision++;
+    int moved = kept != pointCount || keptSticks != stickCount || keptBoxes != boxCount || keptEntities != entityCount;
+    pointCount = kept;
+    stickCount = keptSticks;
+    boxCount = keptBoxes;
+    entityCount = keptEntities;
+    return moved;
+}
+
+// Appends chunk c to the world arrays; returns 1 if it added records
+int PageIn(int c) {
+    Chunk* chunk = &levelStream.chunks[c];
+    if (!ReadChunk(c) || pointCount + chunk->pointCount > MAX_POINTS ||
+        stickCount + chunk->stickCount > MAX_STICKS || boxCount + chunk->boxCount > MAX_BOXES ||
+        entityCount + chunk->entityCount > MAX_ENTITIES) {
+        levelStream.overflows++;
+        return 0;
+    }
+
+    int base = pointCount;
+    int stickBase = stickCount;
+    memcpy(&points[pointCount], chunkPoints, chunk->pointCount * sizeof(Point));
+    pointCount += chunk->pointCount;
+    for (int s = 0; s < chunk->stickCount; s++) {
+        sticks[stickCount] = chunkSticks[s];
+        sticks[stickCount].p1 += base;
+        sticks[stickCount].p2 += base;
+        stickCount++;
+    }
+    memcpy(&boxes[boxCount], chunkBoxes, chunk->boxCount * sizeof(Box));
+    boxCount += chunk->boxCount;
+    for (int n = 0; n < chunk->entityCount; n++) {
+        Entity* ent = &entities[entityCount++];
+        *ent = chunkEntities[n];
+        ent->firstPoint += base;
+        ent->firstStick += stickBase;
+        if (ent->head >= 0) ent->head += base;
+        ComputeEntityBounds(ent);
+    }
+
+    chunk->resident = 1;
+    levelStream.pageIns++;
+    worldRevision++;
+    return chunk->pointCount + chunk->stickCount + chunk->boxCount + chunk->entityCount > 0;
+}
+
+// Points in the whole level, resident or not
+int StreamPointTotal() {
+    int total = pointCount;
+    for (int c = 0; c < levelStream.chunkCount; c++) {
+        if (!levelStream.chunks[c].resident) total += levelStream.chunks[c].pointCount;
+    }
+    return total;
+}
+
+int FindRagdollHead() {
+    UpdateEntityIndex();
+    for (int r = 0; r < entityIndex.kindCount[ENTITY_RAGDOLL]; r++) {
+        int head = entities[entityIndex.ofKind[ENTITY_RAGDOLL][r]].head;
+        if (head >= 0 && points[head].isActive) return head;
+    }
+    return -1;
+}
+
+// Once per frame: the camera follows the ragdoll (or pans when the cursor
+// reaches a screen edge) and the resident window follows the camera
+void UpdateStreaming() {
+    if (!levelStream.active) return;
+
+    int head = FindRagdollHead();
+    int camera = cameraX;
+    if (head >= 0) camera = (int)points[head].x - WIDTH / 2;
+    else if (curX <= 0) camera -= 2;
+    else if (curX >= WIDTH - 1) camera += 2;
+    if (camera > (int)worldWidth - WIDTH) camera = (int)worldWidth - WIDTH;
+    cameraX = camera < 0 ? 0 : camera;
+
+    int center = ChunkOf((float)(cameraX + WIDTH / 2));
+    int lo = center - CHUNK_RESIDENT_RADIUS < 0 ? 0 : center - CHUNK_RESIDENT_RADIUS;
+    int hi = center + CHUNK_RESIDENT_RADIUS >= levelStream.chunkCount ? levelStream.chunkCount - 1 : center + CHUNK_RESIDENT_RADIUS;
+    if (lo == levelStream.firstResident && hi == levelStream.lastResident) return;
+
+    long long start = GetTimeNs();
+    int moved = PageOut(lo, hi);
+    for (int c = lo; c <= hi; c++) {
+        if (!levelStream.chunks[c].resident) moved |= PageIn(c);
+    }
+    levelStream.firstResident = lo;
+    levelStream.lastResident = hi;
+    levelStream.moves++;
+
+    // Journal entries address records by index and restore counts, so they
+    // only survive moves that left the world arrays as they were
+    if (moved) ClearJournal();
+
+    long long ns = GetTimeNs() - start;
+    levelStream.pageNs += ns;
+    if (ns > levelStream.maxPageNs) levelStream.maxPageNs = ns;
+}
+
+int StartStreaming(const char* path, float focusX) {
+    ClearWorld();
+
+    FILE* level;
+    if (fopen_s(&level, path, "rb") != 0 || !level) return 0;
+
+    StreamHeader header;
+    int ok = fread(&header, sizeof(header), 1, level) == 1 && memcmp(header.magic, STREAM_MAGIC, 4) == 0;
+    ok = ok && header.version == STREAM_VERSION && header.chunkWidth == CHUNK_WIDTH;
+    ok = ok && header.chunkCount >= 1 && header.chunkCount <= MAX_CHUNKS;
+
+    for (unsigned int c = 0; ok && c < header.chunkCount; c++) {
+        StreamChunkEntry entry;
+        ok = fread(&entry, sizeof(entry), 1, level) == 1;
+        Chunk* chunk = &levelStream.chunks[c];
+        chunk->offset = entry.offset;
+        chunk->capacity = 0;
+        chunk->pointCount = entry.pointCount;
+        chunk->stickCount = entry.stickCount;
+        chunk->boxCount = entry.boxCount;
+        chunk->entityCount = entry.entityCount;
+        chunk->inSwap = 0;
+        chunk->resident = 0;
+    }
+
+    FILE* swap = NULL;
+    if (ok) ok = fopen_s(&swap, STREAM_SWAP_FILE, "w+b") == 0 && swap;
+    if (!ok) {
+        fclose(level);
+        return 0;
+    }
+
+    levelStream.level = level;
+    levelStream.swap = swap;
+    levelStream.swapEnd = 0;
+    levelStream.chunkCount = header.chunkCount;
+    levelStream.firstResident = -1;
+    levelStream.lastResident = -1;
+    levelStream.moves = 0;
+    levelStream.pageIns = 0;
+    levelStream.pageOuts = 0;
+    levelStream.overflows = 0;
+    levelStream.pageNs = 0;
+    levelStream.maxPageNs = 0;
+    levelStream.active = 1;
+    worldWidth = (float)(header.chunkCount * CHUNK_WIDTH);
+
+    cameraX = (int)focusX - WIDTH / 2;
+    UpdateStreaming();
+    return 1;
+}
+
+void StopStreaming() {
+    if (!levelStream.active) return;
+
+    fclose(levelStream.level);
+    fclose(levelStream.swap);
+    remove(STREAM_SWAP_FILE);
+    levelStream.active = 0;
+    worldWidth = WIDTH;
+    cameraX = 0;
+}
+
+// Sandbox on the --stream level with a ragdoll at its left edge
+int StartStreamSandbox() {
+    if (!StartStreaming(streamPath, 20)) return 0;
+    SpawnRagdoll(20, 10);
+    isSimulating = 0;
+    return 1;
+}
+
+// Pushes a ragdoll along the floor from the first chunk to the last and
+// reports step cost as it goes
+int RunStreamBenchmark(int chunkTotal) {
+    const char* path = "bench_stream.rgs";
+    const float walkSpeed = 1.5f;
+    const int sections = 10;
+
+    headlessMode = 1;
+    currentMode = 1;
+    if (!BuildStreamLevel(path, chunkTotal)) {
+        printf("Cannot write %s\n", path);
+        return 1;
+    }
+    if (!StartStreaming(path, 20)) {
+        printf("Cannot open %s\n", path);
+        return 1;
+    }
+    SpawnRagdoll(20, 20);
+    int startTotal = StreamPointTotal();
+
+    long long sectionNs[10] = { 0 };
+    long long sectionMax[10] = { 0 };
+    int sectionSteps[10] = { 0 };
+    int maxPoints = 0, maxSticks = 0, maxBoxes = 0;
+    int steps = 0;
+    long long start = GetTimeNs();
+
+    while (steps < chunkTotal * CHUNK_WIDTH) {
+        int head = FindRagdollHead();
+        if (head < 0) break;
+        float headX = points[head].x;
+        if (ChunkOf(headX) >= chunkTotal - 1) break;
+
+        for (int i = 0; i < pointCount; i++) {
+            if (points[i].isRagdollPart) points[i].oldX = points[i].x - walkSpeed;
+        }
+
+        long long stepStart = GetTimeNs();
+        UpdateStreaming();
+        UpdatePhysics();
+        long long ns = GetTimeNs() - stepStart;
+
+        int section = ChunkOf(headX) * sections / chunkTotal;
+        sectionNs[section] += ns;
+        sectionSteps[section]++;
+        if (ns > sectionMax[section]) sectionMax[section] = ns;
+        if (pointCount > maxPoints) maxPoints = pointCount;
+        if (stickCount > maxSticks) maxSticks = stickCount;
+        if (boxCount > maxBoxes) maxBoxes = boxCount;
+        steps++;
+    }
+    double seconds = (GetTimeNs() - start) / 1e9;
+
+    int head = FindRagdollHead();
+    printf("Stream: %d chunks of %d columns, %d steps in %.2f s, reached chunk %d\n",
+        chunkTotal, CHUNK_WIDTH, steps, seconds, head >= 0 ? ChunkOf(points[head].x) : -1);
+    printf("  resident max: %d points, %d sticks, %d boxes (%d chunks)\n",
+        maxPoints, maxSticks, maxBoxes, 2 * CHUNK_RESIDENT_RADIUS + 1);
+    printf("  %d window moves, paged in %d, out %d, %d overflows, %.1f us avg / %.1f us max per move\n",
+        levelStream.moves, levelStream.pageIns, levelStream.pageOuts, levelStream.overflows,
+        levelStream.moves ? levelStream.pageNs / 1e3 / levelStream.moves : 0.0, levelStream.maxPageNs / 1e3);
+    printf("  swap file: %u bytes, level points %d at start, %d at end\n",
+        levelStream.swapEnd, startTotal, StreamPointTotal());
+    printf("  step cost by distance walked:\n");
+    for (int s = 0; s < sections; s++) {
+        if (sectionSteps[s] == 0) continue;
+        printf("    chunks %4d-%4d: %7.2f us avg %8.2f us max\n", s * chunkTotal / sections,
+            (s + 1) * chunkTotal / sections - 1, sectionNs[s] / 1e3 / sectionSteps[s], sectionMax[s] / 1e3);
+    }
+
+    StopStreaming();
+    remove(path);
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// INPUT RECORDING AND REPLAY
+//---------------------------------------------------------------------
+// Log layout (little-endian):
+//   header: "RGRP", version byte, coins, head, missions (u32), unlock bytes
+//   'F' varint frameMs, count byte, count x toggled virtual-key codes
+//   'T' steps byte, before an 'F' whose frame did not take exactly one step
+//   'S' u32 seed passed to SeedRandom()
+//   'E' u32 frame count, u64 WorldHash() at exit
+
+void WriteU32(FILE* file, unsigned int v) {
+    for (int i = 0; i < 4; i++) fputc((v >> (i * 8)) & 0xFF, file);
+}
+
+int ReadU32(FILE* file, unsigned int* v) {
+    *v = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = fgetc(file);
+        if (c == EOF) return 0;
+        *v |= (unsigned int)c << (i * 8);
+    }
+    return 1;
+}
+
+void WriteVarint(FILE* file, unsigned int v) {
+    while (v >= 0x80) {
+        fputc((v & 0x7F) | 0x80, file);
+        v >>= 7;
+    }
+    fputc(v, file);
+}
+
+int ReadVarint(FILE* file, unsigned int* v) {
+    *v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF) return 0;
+        *v |= (unsigned int)(c & 0x7F) << shift;
+        if ((c & 0x80) == 0) return 1;
+    }
+    return 0;
+}
+
+int StartRecording(const char* path) {
+    FILE* file;
+    if (fopen_s(&file, path, "wb") != 0 || !file) return 0;
+
+    fwrite(REPLAY_MAGIC, 1, 4, file);
+    fputc(REPLAY_VERSION, file);
+    WriteU32(file, (unsigned int)gameStats.coins);
+    WriteU32(file, (unsigned int)currentHeadIndex);
+    WriteU32(file, (unsigned int)gameStats.missionsCompleted);
+    for (int i = 0; i < MAX_SHOP_ITEMS; i++) fputc(shopItems[i].unlocked ? 1 : 0, file);
+
+    inputLog.file = file;
+    inputLog.mode = INPUT_LOG_RECORD;
+    inputLog.frameCount = 0;
+    return 1;
+}
+
+int StartReplay(const char* path) {
+    FILE* file;
+    if (fopen_s(&file, path, "rb") != 0 || !file) return 0;
+
+    char magic[4];
+    unsigned int coins, head, missions;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, REPLAY_MAGIC, 4) != 0 ||
+        fgetc(file) != REPLAY_VERSION ||
+        !ReadU32(file, &coins) || !ReadU32(file, &head) || !ReadU32(file, &missions)) {
+        fclose(file);
+        return 0;
+    }
+
+    // The recorded profile replaces the local save so shop heads match
+    gameStats.coins = (int)coins;
+    currentHeadIndex = (int)head;
+    gameStats.missionsCompleted = (int)missions;
+    for (int i = 0; i < MAX_SHOP_ITEMS; i++) shopItems[i].unlocked = (fgetc(file) == 1);
+
+    for (int i = 0; i < 256; i++) inputLog.replayKeys[i] = 0;
+    inputLog.file = file;
+    inputLog.mode = INPUT_LOG_REPLAY;
+    inputLog.frameCount = 0;
+    inputLog.hasExpectedHash = 0;
+    return 1;
+}
+
+int ReadReplayEnd() {
+    unsigned int frames, lo, hi;
+    if (!ReadU32(inputLog.file, &frames) || !ReadU32(inputLog.file, &lo) || !ReadU32(inputLog.file, &hi)) {
+        return 0;
+    }
+    inputLog.expectedHash = ((unsigned long long)hi << 32) | lo;
+    inputLog.hasExpectedHash = 1;
+    return 1;
+}
+
+// Called once at the top of each frame. In replay mode this pulls the next
+// frame record and overrides the measured frame time and step count;
+// returns 0 when the log is exhausted.
+int BeginInputFrame(DWORD* frameMs, int* steps) {
+    if (inputLog.mode == INPUT_LOG_RECORD) {
+        inputLog.frameMs = *frameMs;
+        inputLog.steps = *steps;
+        return 1;
+    }
+    if (inputLog.mode != INPUT_LOG_REPLAY) return 1;
+
+    int tag = fgetc(inputLog.file);
+    *steps = 1;
+    if (tag == REPLAY_TAG_STEPS) {
+        *steps = fgetc(inputLog.file);
+        if (*steps == EOF) return 0;
+        tag = fgetc(inputLog.file);
+    }
+    if (tag == REPLAY_TAG_END) ReadReplayEnd();
+    if (tag != REPLAY_TAG_FRAME) return 0;
+
+    unsigned int ms;
+    int count = 0;
+    if (!ReadVarint(inputLog.file, &ms) || (count = fgetc(inputLog.file)) == EOF) return 0;
+    for (int i = 0; i < count; i++) {
+        int key = fgetc(inputLog.file);
+        if (key == EOF) return 0;
+        inputLog.replayKeys[key] = !inputLog.replayKeys[key];
+    }
+
+    *frameMs = ms;
+    inputLog.frameCount++;
+    return 1;
+}
+
+int PollKey(int key) {
+    if (inputLog.mode == INPUT_LOG_REPLAY || inputLog.mode == INPUT_LOG_SCRIPT) return inputLog.replayKeys[key];
+    if (inputQueue.running) return inputQueue.frameKeys[key];
+    return (GetAsyncKeyState(key) & 0x8000) != 0;
+}
+
+void RecordInputFrame(const unsigned char* toggled, int count) {
+    if (inputLog.steps != 1) {
+        fputc(REPLAY_TAG_STEPS, inputLog.file);
+        fputc(inputLog.steps, inputLog.file);
+    }
+    fputc(REPLAY_TAG_FRAME, inputLog.file);
+    WriteVarint(inputLog.file, (unsigned int)inputLog.frameMs);
+    fputc(count, inputLog.file);
+    fwrite(toggled, 1, count, inputLog.file);
+    inputLog.frameCount++;
+}
+
+// Closes the log. Returns 1 if a replay ended on a different world state
+// than the one recorded.
+int FinishInputLog() {
+    if (inputLog.mode == INPUT_LOG_OFF) return 0;
+
+    int mismatch = 0;
+    unsigned long long hash = WorldHash();
+
+    if (inputLog.mode == INPUT_LOG_RECORD) {
+        fputc(REPLAY_TAG_END, inputLog.file);
+        WriteU32(inputLog.file, (unsigned int)inputLog.frameCount);
+        WriteU32(inputLog.file, (unsigned int)(hash & 0xFFFFFFFF));
+        WriteU32(inputLog.file, (unsigned int)(hash >> 32));
+    }
+    else {
+        // Exit happened mid-frame; the end record follows the last frame
+        if (!inputLog.hasExpectedHash && fgetc(inputLog.file) == REPLAY_TAG_END) {
+            ReadReplayEnd();
+        }
+        mismatch = inputLog.hasExpectedHash && inputLog.expectedHash != hash;
+    }
+
+    fclose(inputLog.file);
+    inputLog.file = NULL;
+    inputLog.mode = INPUT_LOG_OFF;
+    return mismatch;
+}
+
+// Seeds the simulation RNG. Seeds are logged so a replay reproduces them.
+void SeedRandom() {
+    unsigned int seed = (unsigned int)time(NULL);
+
+    if (inputLog.mode == INPUT_LOG_REPLAY) {
+        // Any other tag starts the next record; put it back
+        int tag = fgetc(inputLog.file);
+        if (tag == REPLAY_TAG_SEED) ReadU32(inputLog.file, &seed);
+        else if (tag != EOF) ungetc(tag, inputLog.file);
+    }
+    else if (inputLog.mode == INPUT_LOG_RECORD) {
+        fputc(REPLAY_TAG_SEED, inputLog.file);
+        WriteU32(inputLog.file, seed);
+    }
+
+    simRandState = seed;
+}
+
+// Simulation RNG. Same sequence on every compiler/CRT, unlike rand().
+int SimRand() {
+    simRandState = simRandState * 1103515245u + 12345u;
+    return (int)((simRandState >> 16) & 0x7FFF);
+}
+
+unsigned long long HashBytes(unsigned long long h, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+unsigned long long HashInt(unsigned long long h, int v) { return HashBytes(h, &v, sizeof(v)); }
+unsigned long long HashFloat(unsigned long long h, float v) { return HashBytes(h, &v, sizeof(v)); }
+
+// FNV-1a over the simulated world. Particles are cosmetic and left out.
+unsigned long long WorldHash() {
+    unsigned long long h = 14695981039346656037ULL;
+
+    h = HashInt(h, pointCount);
+    for (int i = 0; i < pointCount; i++) {
+        h = HashFloat(h, points[i].x);
+        h = HashFloat(h, points[i].y);
+        h = HashFloat(h, points[i].oldX);
+        h = HashFloat(h, points[i].oldY);
+        h = HashInt(h, points[i].isLocked);
+        h = HashInt(h, points[i].isActive);
+        h = HashInt(h, points[i].symbol);
+        h = HashFloat(h, points[i].radius);
+        h = HashInt(h, points[i].isRagdollPart);
+        h = HashInt(h, points[i].color);
+    }
+
+    h = HashInt(h, stickCount);
+    for (int i = 0; i < stickCount; i++) {
+        h = HashInt(h, sticks[i].p1);
+        h = HashInt(h, sticks[i].p2);
+        h = HashFloat(h, sticks[i].length);
+        h = HashInt(h, sticks[i].active);
+    }
+
+    h = HashInt(h, boxCount);
+    for (int i = 0; i < boxCount; i++) {
+        h = HashFloat(h, boxes[i].x);
+        h = HashFloat(h, boxes[i].y);
+        h = HashInt(h, boxes[i].isActive);
+    }
+
+    h = HashInt(h, targetCount);
+    for (int i = 0; i < targetCount; i++) {
+        h = HashInt(h, targets[i].ragdollTouching);
+    }
+
+    h = HashInt(h, currentMode);
+    h = HashInt(h, currentMission);
+    h = HashInt(h, missionComplete);
+    h = HashInt(h, missionFailed);
+    h = HashFloat(h, missionTimer);
+    h = HashInt(h, wrongGuesses);
+    h = HashBytes(h, hangmanWord, strlen(hangmanWord));
+    h = HashInt(h, gameStats.coins);
+    return h;
+}
+
+//---------------------------------------------------------------------
+// INPUT THREAD
+//---------------------------------------------------------------------
+
+void PushInputCommand(int key, int down, long long timeNs) {
+    InputQueue* queue = &inputQueue;
+    int head = queue->head.load(std::memory_order_relaxed);
+    if (head - queue->tail.load(std::memory_order_acquire) >= INPUT_RING_SIZE) {
+        // The game has stalled; keep what is queued rather than block the reader
+        queue->dropped++;
+        return;
+    }
+
+    InputCommand* cmd = &queue->items[head % INPUT_RING_SIZE];
+    cmd->timeNs = timeNs;
+    cmd->key = (unsigned char)key;
+    cmd->down = (unsigned char)down;
+    queue->head.store(head + 1, std::memory_order_release);
+}
+
+void PushInputTap(int key, int modifier, long long timeNs) {
+    if (modifier) PushInputCommand(modifier, 1, timeNs);
+    PushInputCommand(key, 1, timeNs);
+    PushInputCommand(key, 0, timeNs);
+    if (modifier) PushInputCommand(modifier, 0, timeNs);
+}
+
+// Decodes the key at the front of buf into a virtual key code (0 for bytes
+// the game has no use for). Returns the bytes used, or 0 when an escape
+// sequence is still incomplete.
+int DecodeTerminalKey(const unsigned char* buf, int len, int* key, int* modifier) {
+    *key = 0;
+    *modifier = 0;
+
+    unsigned char c = buf[0];
+    if (c != 0x1B) {
+        if (c == '\r' || c == '\n') *key = VK_RETURN;
+        else if (c >= 'a' && c <= 'z') *key = c - 'a' + 'A';
+        else if (c >= 32 && c < 127) *key = c;
+        return 1;
+    }
+
+    if (len < 2) return 0;
+    if (buf[1] == 'O') {
+        // SS3 function keys: ESC O P is F1
+        if (len < 3) return 0;
+        if (buf[2] == 'P') *key = VK_F1;
+        return 3;
+    }
+    if (buf[1] != '[') {
+        *key = VK_ESCAPE;
+        return 1;
+    }
+
+    // CSI: ESC [ number ; modifier final
+    int params[2] = { 0, 0 };
+    int param = 0;
+    int i = 2;
+    while (i < len && (isdigit(buf[i]) || buf[i] == ';')) {
+        if (buf[i] == ';') param = 1;
+        else params[param] = params[param] * 10 + (buf[i] - '0');
+        i++;
+    }
+    if (i == len) return 0;
+
+    if (params[1] == 2) *modifier = VK_SHIFT;
+    else if (params[1] == 5) *modifier = VK_CONTROL;
+
+    switch (buf[i]) {
+    case 'A': *key = VK_UP; break;
+    case 'B': *key = VK_DOWN; break;
+    case 'C': *key = VK_RIGHT; break;
+    case 'D': *key = VK_LEFT; break;
+    case 'P': *key = VK_F1; break;
+    case '~':
+        if (params[0] == 11) *key = VK_F1;
+        else if (params[0] == 15) *key = VK_F5;
+        else if (params[0] == 20) *key = VK_F9;
+        break;
+    }
+    return i + 1;
+}
+
+void InputReaderThread() {
+    InputQueue* queue = &inputQueue;
+#ifdef _WIN32
+    // The console has no event stream we can wait on; sample at 1 kHz so
+    // taps shorter than a frame still produce a press and a release
+    unsigned char down[256];
+    memset(down, 0, sizeof(down));
+    timeBeginPeriod(1);     // Sleep(1) would otherwise last a 15.6 ms tick
+    while (!queue->stop.load()) {
+        long long now = GetTimeNs();
+        int changed = 0;
+        for (int k = 1; k < 256; k++) {
+            int state = (GetAsyncKeyState(k) & 0x8000) != 0;
+            if (state != down[k]) {
+                PushInputCommand(k, state, now);
+                down[k] = (unsigned char)state;
+                changed = 1;
+            }
+        }
+        if (changed) WakeInputWaiter();
+        Sleep(1);
+    }
+    timeEndPeriod(1);
+#else
+    unsigned char buf[64];
+    int len = 0;
+    while (!queue->stop.load()) {
+        struct pollfd pfd = { queue->fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, len > 0 ? INPUT_ESCAPE_MS : 50);
+        if (ready < 0) continue;
+        if (ready == 0) {
+            // Nothing completed the escape sequence: it was the ESC key
+            if (len > 0) {
+                PushInputTap(VK_ESCAPE, 0, GetTimeNs());
+                WakeInputWaiter();
+            }
+            len = 0;
+            continue;
+        }
+
+        int got = (int)read(queue->fd, buf + len, sizeof(buf) - len);
+        if (got <= 0) {
+            // No more input will come; release anyone waiting for it
+            queue->stop = 1;
+            WakeInputWaiter();
+            break;
+        }
+        long long now = GetTimeNs();
+        len += got;
+
+        int pos = 0;
+        while (pos < len) {
+            int key, modifier;
+            int used = DecodeTerminalKey(buf + pos, len - pos, &key, &modifier);
+            if (used == 0) break;
+            if (key) PushInputTap(key, modifier, now);
+            pos += used;
+        }
+        memmove(buf, buf + pos, len - pos);
+        len -= pos;
+        if (len == (int)sizeof(buf)) len = 0;
+        if (pos > 0) WakeInputWaiter();
+    }
+#endif
+}
+
+// Taking the lock orders the notify after a waiter's empty check
+void WakeInputWaiter() {
+    InputQueue* queue = &inputQueue;
+    {
+        std::lock_guard<std::mutex> guard(queue->wakeLock);
+    }
+    queue->wake.notify_one();
+}
+
+// Blocks until a key command is queued, or for at most timeoutMs (-1 waits
+// for input only)
+void WaitForInput(int timeoutMs) {
+    InputQueue* queue = &inputQueue;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    std::unique_lock<std::mutex> guard(queue->wakeLock);
+    while (queue->head.load() == queue->tail.load() && !queue->stop.load()) {
+        if (timeoutMs < 0) queue->wake.wait(guard);
+        else if (queue->wake.wait_until(guard, deadline) == std::cv_status::timeout) break;
+    }
+}
+
+// How long the loop may wait for input after this frame: 0 while anything
+// moves on its own, PULSE_WAKE_MS while mission targets pulse on a paused
+// mission, -1 when only a key can change the screen
+int IdleWaitMs(int showMissionStart) {
+    if (debugMode) return 0;     // the overlay shows live counters
+    for (int i = 0; i < 256; i++) {
+        if (inputManager.keys[i]) return 0;     // held, or a tap whose release is next frame
+    }
+    if (currentMode == 0 || currentMode == 4) return -1;
+    if (currentMode == 2 && (showMissionStart || missionComplete || missionFailed)) return -1;
+
+    if (isSimulating || dragPoint >= 0) return 0;
+    if (screenShake > 0) return 0;                          // shake redraws at random offsets
+    if (currentMode == 3 && hangmanGameOver && hangmanWon) return 0;    // victory fountain
+    return currentMode == 2 ? PULSE_WAKE_MS : -1;
+}
+
+double ProcessCpuSeconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0.0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) / 1e7;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+void StartInputThread(int fd) {
+    InputQueue* queue = &inputQueue;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->stop = 0;
+    queue->dropped = 0;
+    queue->latencyCount = 0;
+    memset(queue->keys, 0, sizeof(queue->keys));
+    memset(queue->frameKeys, 0, sizeof(queue->frameKeys));
+    queue->fd = fd;
+
+#ifndef _WIN32
+    // Keys arrive as they are typed, without echo
+    queue->rawMode = 0;
+    if (isatty(fd) && tcgetattr(fd, &queue->savedMode) == 0) {
+        struct termios raw = queue->savedMode;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_iflag &= ~(ICRNL | IXON);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        queue->rawMode = tcsetattr(fd, TCSANOW, &raw) == 0;
+    }
+
+    // An exit or a kill that skips StopInputThread must not leave the
+    // shell without echo
+    static int hooked = 0;
+    if (queue->rawMode && !hooked) {
+        atexit(RestoreTerminalMode);
+        signal(SIGINT, RestoreTerminalOnSignal);
+        signal(SIGTERM, RestoreTerminalOnSignal);
+        hooked = 1;
+    }
+#endif
+
+    queue->reader = std::thread(InputReaderThread);
+    queue->running = 1;
+}
+
+void StopInputThread() {
+    InputQueue* queue = &inputQueue;
+    if (!queue->running) return;
+
+    queue->stop = 1;
+    WakeInputWaiter();
+    queue->reader.join();
+    queue->running = 0;
+    RestoreTerminalMode();
+}
+
+void RestoreTerminalMode() {
+#ifndef _WIN32
+    InputQueue* queue = &inputQueue;
+    if (queue->rawMode) tcsetattr(queue->fd, TCSANOW, &queue->savedMode);
+    queue->rawMode = 0;
+#endif
+}
+
+// Only async-signal-safe calls here; the default action then ends the process
+void RestoreTerminalOnSignal(int sig) {
+#ifndef _WIN32
+    RestoreTerminalMode();
+    signal(sig, SIG_DFL);
+    raise(sig);
+#endif
+}
+
+// Applies the commands that arrived since the last step. A key pressed and
+// released in between still reads as down for this one step.
+void DrainInputCommands() {
+    InputQueue* queue = &inputQueue;
+    unsigned char tapped[256];
+    memset(tapped, 0, sizeof(tapped));
+    long long now = GetTimeNs();
+
+    int tail = queue->tail.load(std::memory_order_relaxed);
+    int head = queue->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+        const InputCommand* cmd = &queue->items[tail % INPUT_RING_SIZE];
+        if (!cmd->down) {
+            queue->keys[cmd->key] = 0;
+            continue;
+        }
+
+        if (!queue->keys[cmd->key]) tapped[cmd->key] = 1;
+        queue->keys[cmd->key] = 1;
+
+        // A modifier arrives with the key it modifies, which is sampled instead
+        if (cmd->key == VK_SHIFT || cmd->key == VK_CONTROL) continue;
+        queue->latencyUs[queue->latencyCount % INPUT_LATENCY_SAMPLES] = (int)((now - cmd->timeNs) / 1000);
+        queue->latencyCount++;
+    }
+    queue->tail.store(tail, std::memory_order_release);
+
+    for (int i = 0; i < 256; i++) queue->frameKeys[i] = queue->keys[i] | tapped[i];
+}
+
+int CompareInts(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Input-to-step latency percentiles over the latest samples
+void FormatInputLatency(char* out, int size) {
+    static int sorted[INPUT_LATENCY_SAMPLES];
+    InputQueue* queue = &inputQueue;
+    int count = queue->latencyCount < INPUT_LATENCY_SAMPLES ? queue->latencyCount : INPUT_LATENCY_SAMPLES;
+    if (count == 0) {
+        sprintf_s(out, size, "no key presses, %d dropped", queue->dropped.load());
+        return;
+    }
+
+    memcpy(sorted, queue->latencyUs, count * sizeof(int));
+    qsort(sorted, count, sizeof(int), CompareInts);
+    sprintf_s(out, size, "%d presses, %d dropped, latency p50 %.2f ms p95 %.2f ms p99 %.2f ms max %.2f ms",
+        queue->latencyCount, queue->dropped.load(),
+        sorted[count * 50 / 100] / 1000.0, sorted[count * 95 / 100] / 1000.0,
+        sorted[count * 99 / 100] / 1000.0, sorted[count - 1] / 1000.0);
+}
+
+#ifndef _WIN32
+// Types a fixed mix of letters, arrows, modified arrows and function keys
+// with random gaps, as a terminal would deliver them
+void InputBenchmarkWriter(int fd, int taps, std::atomic<int>* done) {
+    static const char* sequences[] = {
+        "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+        "\x1b[A", "\x1b[B", "\x1b[1;2C", "\x1b[1;5D", "\r", " ", "\x1b[15~", "\x1bOP"
+    };
+    const int sequenceCount = (int)(sizeof(sequences) / sizeof(sequences[0]));
+
+    unsigned int state = 12345;
+    for (int t = 0; t < taps; t++) {
+        Sleep(SolverRand(&state) % 20);
+        const char* s = sequences[t % sequenceCount];
+        if (write(fd, s, strlen(s)) < 0) break;
+    }
+    close(fd);
+    *done = 1;
+}
+#endif
+
+// Feeds taps through a pipe at random moments while the game loop steps
+// at its usual 33 ms, and checks that every tap reaches a step.
+int RunInputBenchmark(int taps) {
+#ifdef _WIN32
+    printf("--bench-input reads a pipe and needs a POSIX build\n");
+    return 2;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return 2;
+    InitInputManager();
+    StartInputThread(fds[0]);
+
+    std::atomic<int> writerDone(0);
+    std::thread writer(InputBenchmarkWriter, fds[1], taps, &writerDone);
+
+    const int frameTime = 33;
+    int seen = 0, frames = 0, idleFrames = 0;
+    while (idleFrames < 3) {
+        DWORD start = GetTickCount();
+        UpdateInputManager(frameTime);
+        int pressed = 0;
+        for (int k = 0; k < 256; k++) {
+            if (k != VK_SHIFT && k != VK_CONTROL && inputManager.keysPressed[k]) pressed++;
+        }
+        seen += pressed;
+        frames++;
+
+        // Done once the writer has finished and nothing is left queued
+        if (writerDone.load() && inputQueue.head.load() == inputQueue.tail.load()) idleFrames++;
+        DWORD elapsed = GetTickCount() - start;
+        if (elapsed < (DWORD)frameTime) Sleep(frameTime - elapsed);
+    }
+    writer.join();
+    StopInputThread();
+    close(fds[0]);
+
+    char report[160];
+    FormatInputLatency(report, sizeof(report));
+    printf("Input: %d taps sent, %d seen in %d frames of %d ms\n", taps, seen, frames, frameTime);
+    printf("  %s\n", report);
+    return seen == taps ? 0 : 1;
+#endif
+}
+
+//---------------------------------------------------------------------
+// CURSOR AND INPUT FUNCTIONS
+//---------------------------------------------------------------------
+
+void UpdateCursor() {
+    // Speed modifiers
+    if (IsKeyDown(VK_SHIFT)) {
+        cursorSpeedMultiplier = CURSOR_SPEED_FAST;
+    }
+    else if (IsKeyDown(VK_CONTROL)) {
+        cursorSpeedMultiplier = CURSOR_SPEED_PRECISE;
+    }
+    else {
+        cursorSpeedMultiplier = CURSOR_SPEED_NORMAL;
+    }
+
+    // Movement
+    int moveAmount = (int)cursorSpeedMultiplier;
+    if (moveAmount < 1) moveAmount = 1;
+
+    if (IsKeyDown(VK_LEFT)) curX -= moveAmount;
+    if (IsKeyDown(VK_RIGHT)) curX += moveAmount;
+    if (IsKeyDown(VK_UP)) curY -= moveAmount;
+    if (IsKeyDown(VK_DOWN)) curY += moveAmount;
+
+    // Clamp
+    if (curX < 0) curX = 0;
+    if (curX >= WIDTH) curX = WIDTH - 1;
+    if (curY < GAME_AREA_TOP) curY = GAME_AREA_TOP;
+    if (curY >= HEIGHT - 2) curY = HEIGHT - 3;
+}
+
+void DrawEnhancedCursor() {
+    // Main cursor
+    char cursorChar = dragMode ? 'X' : '+';
+    int cursorColor = dragMode ? COLOR_BRIGHT_RED : COLOR_BRIGHT_MAGENTA;
+
+    PutChar(curX, curY, cursorChar, cursorColor);
 
     // Crosshair for precise mode
     if (cursorSpeedMultiplier == CURSOR_SPEED_PRECISE) {
@@ -634,39 +4003,36 @@ void DrawToolSelection() {
 }
 
 void DrawStatusBar() {
-    static DWORD lastFPSTime = GetTickCount();
-    static int frameCount = 0;
-    static int currentFPS = 0;
+    int currentFPS = RecentFrameRate(&framePacer);
+    char frameStats[40];
+    FormatTimePercentiles(&frameTimes, frameStats, sizeof(frameStats));
 
-    frameCount++;
-    DWORD currentTime = GetTickCount();
-    if (currentTime - lastFPSTime >= 1000) {
-        currentFPS = frameCount;
-        frameCount = 0;
-        lastFPSTime = currentTime;
-    }
-
-    // Status bar content
-    char status[WIDTH];
+    // Status bar content; lines may run past the screen, drawing clips them
+    char status[WIDTH * 2];
 
     if (currentMode == 1) {
-        sprintf_s(status, WIDTH,
-            "Objects: %d/%d | FPS: %d | Coins: %d | [SHIFT]=Fast [CTRL]=Precise | [U]=Undo(%d)",
-            pointCount, MAX_POINTS, currentFPS, gameStats.coins, undoCount);
+        // The key hints give way when the frame times need the room
+        const char* format = "Objects: %d/%d | FPS: %d (%s) | Coins: %d | %s[U]=Undo(%d) [Y]=Redo(%d)";
+        int len = sprintf_s(status, sizeof(status), format, pointCount, MAX_POINTS, currentFPS, frameStats,
+            gameStats.coins, "[SHIFT]=Fast [CTRL]=Precise | ", undoCount, journalCount - undoCount);
+        if (len > WIDTH) {
+            sprintf_s(status, sizeof(status), format, pointCount, MAX_POINTS, currentFPS, frameStats,
+                gameStats.coins, "", undoCount, journalCount - undoCount);
+        }
     }
     else if (currentMode == 2) {
-        sprintf_s(status, WIDTH,
-            "Mission: %d/%d | Time: %.1f/%.1f | Targets: %d/%d | FPS: %d | Coins: %d",
+        sprintf_s(status, sizeof(status),
+            "Mission: %d/%d | Time: %.1f/%.1f | Targets: %d/%d | FPS: %d (%s) | Coins: %d",
             currentMission, maxMissions, missionTimer, missionTimeLimit,
-            targetsReached, targetCount, currentFPS, gameStats.coins);
+            targetsReached, targetCount, currentFPS, frameStats, gameStats.coins);
     }
     else if (currentMode == 3) {
-        sprintf_s(status, WIDTH,
+        sprintf_s(status, sizeof(status),
             "Hangman | Wrong: %d/%d | Coins: %d",
             wrongGuesses, maxWrongGuesses, gameStats.coins);
     }
     else if (currentMode == 4) {
-        sprintf_s(status, WIDTH,
+        sprintf_s(status, sizeof(status),
             "SHOP | Coins: %d | [ENTER]=Buy/Equip [ARROWS]=Navigate [ESC]=Back",
             gameStats.coins);
     }
@@ -713,7 +4079,9 @@ void DrawHelpOverlay() {
         "SPACE - Play/Pause simulation",
         "R - Reset world",
         "D - Toggle drag mode",
-        "U - Undo last action",
+        "U - Undo last action (reset included)",
+        "Y - Redo",
+        "F5/F9 - Save/Load sandbox snapshot",
         "SHIFT - Fast cursor movement",
         "CTRL - Precise cursor movement",
         "",
@@ -733,12 +4101,18 @@ void DrawHelpOverlay() {
         }
     }
 }
+void DrawDebugLine(int y, const char* text, int color) {
+    int len = (int)strlen(text);
+    for (int i = 0; i < len; i++) {
+        PutChar(2 + i, y, text[i], color);
+    }
+}
+
 
 void DrawDebugInfo() {
     if (!debugMode) return;
 
     int debugY = 3;
-    int debugX = 2;
 
     char debug[100];
 
@@ -749,10 +4123,7 @@ void DrawDebugInfo() {
     sprintf_s(temp, 20, "%d", activePoints);
     strcat_s(debug, 100, temp);
 
-    for (int i = 0; i < strlen(debug); i++) {
-        PutChar(debugX + i, debugY, debug[i], COLOR_YELLOW);
-    }
-    debugY++;
+    DrawDebugLine(debugY++, debug, COLOR_YELLOW);
 
     sprintf_s(debug, 100, "[DEBUG] Sticks: %d/%d Active: ", stickCount, MAX_STICKS);
     int activeSticks = 0;
@@ -760,10 +4131,13 @@ void DrawDebugInfo() {
     sprintf_s(temp, 20, "%d", activeSticks);
     strcat_s(debug, 100, temp);
 
-    for (int i = 0; i < strlen(debug); i++) {
-        PutChar(debugX + i, debugY, debug[i], COLOR_YELLOW);
-    }
-    debugY++;
+    DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+
+    UpdateEntityIndex();
+    sprintf_s(debug, 100, "[DEBUG] Entities: %d ragdolls %d ropes %d boxes %d bombs %d coins %d",
+        entityCount, entityIndex.kindCount[ENTITY_RAGDOLL], entityIndex.kindCount[ENTITY_ROPE],
+        entityIndex.kindCount[ENTITY_BOX], entityIndex.kindCount[ENTITY_BOMB], entityIndex.kindCount[ENTITY_COIN]);
+    DrawDebugLine(debugY++, debug, COLOR_YELLOW);
 
     sprintf_s(debug, 100, "[DEBUG] Particles: ");
     int activeParticles = 0;
@@ -771,22 +4145,84 @@ void DrawDebugInfo() {
     sprintf_s(temp, 20, "%d/%d", activeParticles, MAX_PARTICLES);
     strcat_s(debug, 100, temp);
 
-    for (int i = 0; i < strlen(debug); i++) {
-        PutChar(debugX + i, debugY, debug[i], COLOR_YELLOW);
-    }
-    debugY++;
+    DrawDebugLine(debugY++, debug, COLOR_YELLOW);
 
     sprintf_s(debug, 100, "[DEBUG] Cursor: (%d, %d) Tool: %d", curX, curY, currentTool);
-    for (int i = 0; i < strlen(debug); i++) {
-        PutChar(debugX + i, debugY, debug[i], COLOR_YELLOW);
+    DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+
+    char pacing[200];
+    FormatFrameJitter(&framePacer, pacing, sizeof(pacing));
+    sprintf_s(debug, 100, "[DEBUG] Pacing: %s", pacing);
+    DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+
+    TimeHistogram* hists[3] = { &frameTimes, &simTimes, &renderTimes };
+    for (int h = 0; h < 3; h++) {
+        char times[40];
+        FormatTimePercentiles(hists[h], times, sizeof(times));
+        sprintf_s(debug, 100, "[DEBUG] %s p50/p95/p99/max: %s", hists[h]->name, times);
+        DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+    }
+
+    if (perfCountersEnabled) {
+        char status[120];
+        FormatPerfStatus(status, sizeof(status));
+        sprintf_s(debug, 100, "[DEBUG] Counters: %s", status);
+        DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+        for (int p = 0; p < PHASE_COUNT && perfGroupsOpen.load() > 0; p++) {
+            char counters[100];
+            FormatPhaseCounters(p, counters, sizeof(counters));
+            sprintf_s(debug, 100, "[DEBUG] %s", counters);
+            DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+        }
+    }
+
+    char jobs[100];
+    FormatJobUtilization(jobs, sizeof(jobs));
+    sprintf_s(debug, 100, "[DEBUG] Jobs: %s", jobs);
+    DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+
+    if (framePipeline.slots) {
+        int presented = framePipeline.framesPresented.load();
+        sprintf_s(debug, 100, "[DEBUG] Pipeline: %d frames, render %.0fus/frame, waited %.0fus/frame",
+            presented, presented ? framePipeline.renderNs.load() / 1000.0 / presented : 0.0,
+            presented ? framePipeline.waitNs / 1000.0 / presented : 0.0);
+        DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+    }
+
+    sprintf_s(debug, 100, "[DEBUG] Sound: voices %d/%d merged %d preempted %d dropped %d",
+        soundEngine.activeVoices.load(), MAX_VOICES, soundEngine.eventsMerged.load(),
+        soundEngine.voicesPreempted.load(), soundEngine.eventsDropped.load());
+    DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+
+    if (levelStream.active) {
+        sprintf_s(debug, 100, "[DEBUG] Stream: chunks %d-%d of %d, in %d out %d, %.0fus max page",
+            levelStream.firstResident, levelStream.lastResident, levelStream.chunkCount,
+            levelStream.pageIns, levelStream.pageOuts, levelStream.maxPageNs / 1000.0);
+        DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+    }
+
+    if (saveService.requests > 0) {
+        int writes = saveService.writes.load();
+        sprintf_s(debug, 100, "[DEBUG] Save: %d marks %.1fus/mark, %d writes %.2fms/write",
+            saveService.requests, saveService.mainNs / 1000.0 / saveService.requests,
+            writes, writes ? saveService.writeNs.load() / 1000000.0 / writes : 0.0);
+        DrawDebugLine(debugY++, debug, COLOR_YELLOW);
+    }
+
+    if (castRecorder.file) {
+        sprintf_s(debug, 100, "[DEBUG] Cast: %d frames %d dropped %.1fus/frame %lldKB",
+            castRecorder.framesCaptured, castRecorder.framesDropped,
+            castRecorder.framesCaptured ? castRecorder.captureNs / 1000.0 / castRecorder.framesCaptured : 0.0,
+            castRecorder.bytesWritten.load() / 1024);
+        DrawDebugLine(debugY, debug, COLOR_YELLOW);
     }
 }
 
 void DrawShop() {
     // Clear screen
     for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        screenBuf[i] = ' ';
-        colorBuf[i] = COLOR_WHITE;
+        drawTarget->chars[i] = ' ';
+        drawTarget->colors[i] = COLOR_WHITE;
     }
 
     // Draw title
@@ -918,34 +4354,30 @@ void HandleShopInput() {
         itemsToShow = MAX_SHOP_ITEMS - shopPage * itemsPerPage;
     }
 
-    if (IsKeyPressed(VK_UP)) {
+    if (IsKeyRepeated(VK_UP)) {
         shopSelection--;
         if (shopSelection < 0) shopSelection = itemsToShow - 1;
         PlaySoundClick();
-        Sleep(100);
     }
 
-    if (IsKeyPressed(VK_DOWN)) {
+    if (IsKeyRepeated(VK_DOWN)) {
         shopSelection++;
         if (shopSelection >= itemsToShow) shopSelection = 0;
         PlaySoundClick();
-        Sleep(100);
     }
 
-    if (IsKeyPressed(VK_LEFT)) {
+    if (IsKeyRepeated(VK_LEFT)) {
         shopPage--;
         if (shopPage < 0) shopPage = (MAX_SHOP_ITEMS + itemsPerPage - 1) / itemsPerPage - 1;
         shopSelection = 0;
         PlaySoundClick();
-        Sleep(100);
     }
 
-    if (IsKeyPressed(VK_RIGHT)) {
+    if (IsKeyRepeated(VK_RIGHT)) {
         shopPage++;
         if (shopPage >= (MAX_SHOP_ITEMS + itemsPerPage - 1) / itemsPerPage) shopPage = 0;
         shopSelection = 0;
         PlaySoundClick();
-        Sleep(100);
     }
 
     if (IsKeyPressed(VK_RETURN)) {
@@ -958,7 +4390,6 @@ void HandleShopInput() {
                 BuyItem(index);
             }
         }
-        Sleep(100);
     }
 }
 
@@ -975,7 +4406,7 @@ void BuyItem(int index) {
         shopItems[index].unlocked = 1;
         EquipHead(index);
         PlaySoundCoin();
-        SaveGame();
+        MarkProfileDirty();
     }
     else {
         PlaySoundFailure();
@@ -988,7 +4419,7 @@ void EquipHead(int index) {
     if (shopItems[index].unlocked) {
         currentHeadIndex = index;
         PlaySoundSuccess();
-        SaveGame();
+        MarkProfileDirty();
     }
 }
 
@@ -997,22 +4428,28 @@ void EquipHead(int index) {
 //---------------------------------------------------------------------
 
 void SpawnParticle(float x, float y, int color, char symbol, float speed) {
+    if (particleStage.active) {
+        StageParticle(x, y, color, symbol, speed);
+        return;
+    }
     for (int i = 0; i < MAX_PARTICLES; i++) {
         if (!particles[i].active) {
             particles[i].active = 1;
             particles[i].x = x;
             particles[i].y = y;
-            float angle = (rand() % 360) * 3.14159f / 180.0f;
-            float force = (rand() % 100 / 100.0f) * speed;
+            float angle = (SimRand() % 360) * 3.14159f / 180.0f;
+            float force = (SimRand() % 100 / 100.0f) * speed;
             particles[i].vx = cosf(angle) * force;
             particles[i].vy = sinf(angle) * force;
-            particles[i].life = 20 + rand() % 20;
+            particles[i].life = 20 + SimRand() % 20;
             particles[i].maxLife = particles[i].life;
             particles[i].color = color;
             particles[i].symbol = symbol;
+            CountMetric(METRIC_PARTICLE_SPAWNS, 1);
             return;
         }
     }
+    CountMetric(METRIC_PARTICLES_DROPPED, 1);
 }
 
 void SpawnExplosionParticles(float x, float y) {
@@ -1023,14 +4460,16 @@ void SpawnExplosionParticles(float x, float y) {
 
     // Secondary fire
     for (int i = 0; i < 20; i++) {
-        SpawnParticle(x + (rand() % 5 - 2), y + (rand() % 5 - 2),
-            COLOR_BRIGHT_YELLOW, '+', 2.0f);
+        float ox = (float)(SimRand() % 5 - 2);
+        float oy = (float)(SimRand() % 5 - 2);
+        SpawnParticle(x + ox, y + oy, COLOR_BRIGHT_YELLOW, '+', 2.0f);
     }
 
     // Smoke
     for (int i = 0; i < 15; i++) {
-        SpawnParticle(x + (rand() % 7 - 3), y + (rand() % 7 - 3),
-            COLOR_DARK_GRAY, 'o', 1.0f);
+        float ox = (float)(SimRand() % 7 - 3);
+        float oy = (float)(SimRand() % 7 - 3);
+        SpawnParticle(x + ox, y + oy, COLOR_DARK_GRAY, 'o', 1.0f);
     }
 
     // Sparks
@@ -1050,7 +4489,9 @@ void SpawnSuccessParticles(float x, float y) {
     for (int i = 0; i < 20; i++) {
         int colors[] = { COLOR_BRIGHT_GREEN, COLOR_BRIGHT_YELLOW, COLOR_BRIGHT_CYAN };
         char symbols[] = { '*', '+', 'o' };
-        SpawnParticle(x, y, colors[rand() % 3], symbols[rand() % 3], 1.5f);
+        int color = colors[SimRand() % 3];
+        char symbol = symbols[SimRand() % 3];
+        SpawnParticle(x, y, color, symbol, 1.5f);
     }
 }
 
@@ -1081,7 +4522,7 @@ void UpdateParticles() {
     }
 }
 
-void DrawPointWithEffects(Point* p, int shakeX, int shakeY) {
+void DrawPointWithEffects(const Point* p, int shakeX, int shakeY) {
     // Calculate velocity
     float dx = p->x - p->oldX;
     float dy = p->y - p->oldY;
@@ -1107,21 +4548,22 @@ void DrawPointWithEffects(Point* p, int shakeX, int shakeY) {
         p->symbol, p->color);
 }
 
-void DrawAnimatedTargets() {
-    for (int i = 0; i < targetCount; i++) {
-        if (targets[i].isActive == 0) continue;
+void DrawAnimatedTargets(const Target* list, int count, int offsetX, float time) {
+    for (int i = 0; i < count; i++) {
+        const Target* target = &list[i];
+        if (target->isActive == 0) continue;
 
-        int tx = (int)(targets[i].x + 0.5f);
-        int ty = (int)(targets[i].y + 0.5f);
+        int tx = (int)(target->x + 0.5f) + offsetX;
+        int ty = (int)(target->y + 0.5f);
 
         // Pulse effect
-        float pulse = 0.5f + 0.5f * sinf(gameTime * PULSE_SPEED);
-        int baseRadius = (int)(targets[i].radius);
+        float pulse = 0.5f + 0.5f * sinf(time * PULSE_SPEED);
+        int baseRadius = (int)(target->radius);
         int animRadius = baseRadius + (int)(pulse * 2);
 
-        int targetColor = (targets[i].ragdollTouching == 1) ?
+        int targetColor = (target->ragdollTouching == 1) ?
             COLOR_BRIGHT_GREEN : COLOR_BRIGHT_YELLOW;
-        char outerChar = (targets[i].ragdollTouching == 1) ? 'O' : 'o';
+        char outerChar = (target->ragdollTouching == 1) ? 'O' : 'o';
 
         // Inner ring (static)
         for (int angle = 0; angle < 360; angle += 30) {
@@ -1132,7 +4574,7 @@ void DrawAnimatedTargets() {
         }
 
         // Center
-        char centerChar = (targets[i].ragdollTouching == 1) ? 'X' : '*';
+        char centerChar = (target->ragdollTouching == 1) ? 'X' : '*';
         PutChar(tx, ty, centerChar, targetColor);
 
         // Number
@@ -1141,7 +4583,7 @@ void DrawAnimatedTargets() {
         PutChar(tx + 2, ty, numStr[0], targetColor);
 
         // Success indicator
-        if (targets[i].ragdollTouching == 1) {
+        if (target->ragdollTouching == 1) {
             PutChar(tx - 3, ty, '>', COLOR_BRIGHT_GREEN);
             PutChar(tx + 3, ty, '<', COLOR_BRIGHT_GREEN);
         }
@@ -1160,8 +4602,8 @@ float GetDistance(float x1, float y1, float x2, float y2) {
 
 void PutChar(int x, int y, char c, int color) {
     if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT) return;
-    screenBuf[y * WIDTH + x] = c;
-    colorBuf[y * WIDTH + x] = color;
+    drawTarget->chars[y * WIDTH + x] = c;
+    drawTarget->colors[y * WIDTH + x] = color;
 }
 
 void DrawLine(int x0, int y0, int x1, int y1, char c, int color) {
@@ -1194,8 +4636,10 @@ int AddPoint(float x, float y, char symbol, int locked, float radius, int isRagd
     points[pointCount].isRagdollPart = isRagdoll;
     points[pointCount].color = color;
     points[pointCount].isSpecialHead = isSpecial;
+    points[pointCount].pickup = PICKUP_NONE;
 
     pointCount++;
+    worldRevision++;
     gameStats.objectsSpawned++;
     return pointCount - 1;
 }
@@ -1203,16 +4647,99 @@ int AddPoint(float x, float y, char symbol, int locked, float radius, int isRagd
 void AddStick(int p1, int p2, int isRagdoll) {
     if (stickCount >= MAX_STICKS) return;
 
-    sticks[stickCount].p1 = p1;
-    sticks[stickCount].p2 = p2;
-    sticks[stickCount].length = GetDistance(
-        points[p1].x, points[p1].y,
-        points[p2].x, points[p2].y
-    );
-    sticks[stickCount].active = 1;
-    sticks[stickCount].isRagdollStick = isRagdoll;
+    sticks[stickCount].p1 = p1;
+    sticks[stickCount].p2 = p2;
+    sticks[stickCount].length = GetDistance(
+        points[p1].x, points[p1].y,
+        points[p2].x, points[p2].y
+    );
+    sticks[stickCount].active = 1;
+    sticks[stickCount].isRagdollStick = isRagdoll;
+
+    stickCount++;
+}
+
+// Every stick break goes through here so the break counters stay exact
+void BreakStick(int s) {
+    if (!sticks[s].active) return;
+    sticks[s].active = 0;
+    stickBreakCount++;
+    CountMetric(METRIC_BREAKS, 1);
+    if (sticks[s].isRagdollStick) pointIndex.brokenRagdollSticks++;
+}
+
+Entity MakeEntity(int kind, int firstPoint, int pointTotal, int firstStick, int stickTotal, int head) {
+    Entity e;
+    e.kind = kind;
+    e.firstPoint = firstPoint;
+    e.pointCount = pointTotal;
+    e.firstStick = firstStick;
+    e.stickCount = stickTotal;
+    e.head = head;
+    e.minX = e.minY = e.maxX = e.maxY = 0;
+    return e;
+}
+
+// Ranges must lie inside the given arrays; used on loaded records
+int ValidEntity(const Entity* e, int pointTotal, int stickTotal) {
+    if (e->kind < 0 || e->kind >= ENTITY_KIND_COUNT) return 0;
+    if (e->firstPoint < 0 || e->pointCount < 1 || e->firstPoint + e->pointCount > pointTotal) return 0;
+    if (e->firstStick < 0 || e->stickCount < 0 || e->firstStick + e->stickCount > stickTotal) return 0;
+    if (e->head != -1 && (e->head < e->firstPoint || e->head >= e->firstPoint + e->pointCount)) return 0;
+    return e->kind != ENTITY_RAGDOLL || (e->pointCount == RAGDOLL_PARTS && e->stickCount == RAGDOLL_BONES);
+}
+
+void ComputeEntityBounds(Entity* e) {
+    int first = 1;
+    for (int i = e->firstPoint; i < e->firstPoint + e->pointCount; i++) {
+        const Point* p = &points[i];
+        if (!p->isActive) continue;
+        if (first || p->x < e->minX) e->minX = p->x;
+        if (first || p->x > e->maxX) e->maxX = p->x;
+        if (first || p->y < e->minY) e->minY = p->y;
+        if (first || p->y > e->maxY) e->maxY = p->y;
+        first = 0;
+    }
+}
+
+// Once per step, after the points have moved
+void UpdateEntityBounds() {
+    for (int n = 0; n < entityCount; n++) ComputeEntityBounds(&entities[n]);
+}
+
+// Claims the points and sticks added since firstPoint and firstStick.
+// Spawns that ran out of room are left as loose points.
+int RegisterEntity(int kind, int firstPoint, int firstStick, int head) {
+    if (entityCount >= MAX_ENTITIES || head < 0) return -1;
+
+    Entity e = MakeEntity(kind, firstPoint, pointCount - firstPoint, firstStick, stickCount - firstStick, head);
+    if (!ValidEntity(&e, pointCount, stickCount)) return -1;
+    ComputeEntityBounds(&e);
+    entities[entityCount] = e;
+    return entityCount++;
+}
+
+// Rebuilds the kind lists and pointEntity when entities or points change
+void UpdateEntityIndex() {
+    if (entityIndex.revision == worldRevision && entityIndex.builtCount == entityCount &&
+        entityIndex.builtPointCount == pointCount) return;
+
+    for (int k = 0; k < ENTITY_KIND_COUNT; k++) entityIndex.kindCount[k] = 0;
+    for (int i = 0; i < pointCount; i++) pointEntity[i] = -1;
+    for (int n = 0; n < entityCount; n++) {
+        const Entity* e = &entities[n];
+        entityIndex.ofKind[e->kind][entityIndex.kindCount[e->kind]++] = n;
+        for (int i = e->firstPoint; i < e->firstPoint + e->pointCount; i++) pointEntity[i] = n;
+    }
+    entityIndex.revision = worldRevision;
+    entityIndex.builtCount = entityCount;
+    entityIndex.builtPointCount = pointCount;
+}
 
-    stickCount++;
+Entity* FirstRagdoll() {
+    UpdateEntityIndex();
+    if (entityIndex.kindCount[ENTITY_RAGDOLL] == 0) return NULL;
+    return &entities[entityIndex.ofKind[ENTITY_RAGDOLL][0]];
 }
 
 int AddBox(float x, float y, float w, float h, int solid, int isWall) {
@@ -1231,7 +4758,7 @@ int AddBox(float x, float y, float w, float h, int solid, int isWall) {
 }
 
 void AddTarget(float x, float y, float radius) {
-    if (targetCount >= 5) return;
+    if (targetCount >= MAX_TARGETS) return;
 
     targets[targetCount].x = x;
     targets[targetCount].y = y;
@@ -1243,8 +4770,9 @@ void AddTarget(float x, float y, float radius) {
 }
 
 void SpawnRagdoll(int x, int y) {
-    SaveState();
+    BeginEdit();
     gameStats.ragdollsCreated++;
+    int firstStick = stickCount;
 
     // Use current head from shop
     int head = AddPoint(x, y, shopItems[currentHeadIndex].symbol, 0, 1.2f, 1, shopItems[currentHeadIndex].color, 1);
@@ -1261,7 +4789,10 @@ void SpawnRagdoll(int x, int y) {
     int leftFoot = AddPoint(x - 3, y + 18, '/', 0, 0.9f, 1, COLOR_WHITE, 0);
     int rightFoot = AddPoint(x + 3, y + 18, '\\', 0, 0.9f, 1, COLOR_WHITE, 0);
 
-    if (head < 0) return;
+    if (head < 0) {
+        EndEdit();
+        return;
+    }
 
     AddStick(head, neck, 1);
     AddStick(neck, chest, 1);
@@ -1276,22 +4807,28 @@ void SpawnRagdoll(int x, int y) {
     AddStick(leftKnee, leftFoot, 1);
     AddStick(rightKnee, rightFoot, 1);
 
+    RegisterEntity(ENTITY_RAGDOLL, head, firstStick, head);
+    EndEdit();
     PlaySoundPlace();
 }
 
 void SpawnBomb(int x, int y) {
-    SaveState();
-    AddPoint(x, y, '@', 0, 1.5f, 0, COLOR_BRIGHT_RED, 0);
+    BeginEdit();
+    int p = AddPoint(x, y, '@', 0, 1.5f, 0, COLOR_BRIGHT_RED, 0);
+    RegisterEntity(ENTITY_BOMB, p, stickCount, p);
+    EndEdit();
     PlaySoundPlace();
 }
 
 void SpawnRope(int x1, int y1, int x2, int y2) {
-    SaveState();
+    BeginEdit();
     int segments = 10;
     float dx = (float)(x2 - x1) / segments;
     float dy = (float)(y2 - y1) / segments;
+    int firstStick = stickCount;
 
     int prevPoint = AddPoint(x1, y1, 'O', 1, 0.5f, 0, COLOR_BRIGHT_YELLOW, 0);
+    int anchor = prevPoint;
 
     for (int i = 1; i <= segments; i++) {
         int isLast = (i == segments);
@@ -1311,28 +4848,35 @@ void SpawnRope(int x1, int y1, int x2, int y2) {
         }
         prevPoint = currentPoint;
     }
+    RegisterEntity(ENTITY_ROPE, anchor, firstStick, anchor);
+    EndEdit();
     PlaySoundPlace();
 }
 
 void SpawnPlatform(int x, int y, int width) {
-    SaveState();
+    BeginEdit();
     int segments = width / 3;
     int startX = x - width / 2;
+    int firstPoint = pointCount;
+    int firstStick = stickCount;
 
     for (int i = 0; i <= segments; i++) {
         float px = startX + (i * width / (float)segments);
         int p = AddPoint(px, y, '=', 1, 0.6f, 0, COLOR_BRIGHT_GREEN, 0);
         if (i > 0) AddStick(p - 1, p, 0);
     }
+    RegisterEntity(ENTITY_PLATFORM, firstPoint, firstStick, firstPoint + segments / 2);
 
     AddBox(x, y + 1.5f, width, 3, 1, 1);
+    EndEdit();
     PlaySoundPlace();
 }
 
 void SpawnMovableBox(int x, int y) {
-    SaveState();
+    BeginEdit();
     int size = 5;
     int startIdx = pointCount;
+    int firstStick = stickCount;
 
     for (int row = 0; row < 3; row++) {
         for (int col = 0; col < 3; col++) {
@@ -1352,141 +4896,302 @@ void SpawnMovableBox(int x, int y) {
             if (row < 2 && col > 0) AddStick(idx, idx + 2, 0);
         }
     }
+    RegisterEntity(ENTITY_BOX, startIdx, firstStick, startIdx + 4);
+    EndEdit();
     PlaySoundPlace();
 }
-
 void SpawnCoin(int x, int y) {
-    AddPoint(x, y, '$', 0, 0.5f, 0, COLOR_BRIGHT_YELLOW, 0);
+    int p = AddPoint(x, y, '$', 0, 0.5f, 0, COLOR_BRIGHT_YELLOW, 0);
+    if (p < 0) return;
+    points[p].pickup = PICKUP_COIN;
+    RegisterEntity(ENTITY_COIN, p, stickCount, p);
 }
 
 //---------------------------------------------------------------------
 // HANGMAN FUNCTIONS
 //---------------------------------------------------------------------
 
-void BreakRandomStick() {
-    int sticksToBreak[][2] = {
-        {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}
-    };
+// Dictionary words are lines of 3-32 letters; other lines are skipped.
+// Returns 1 and the next word's span and letter mask, 0 at the end.
+int NextDictWord(const unsigned char* data, size_t size, size_t* pos, size_t* start, int* length, unsigned int* mask) {
+    while (*pos < size) {
+        size_t begin = *pos;
+        size_t end = begin;
+        unsigned int letters = 0;
+        int valid = 1;
+        while (end < size && data[end] != '\n') {
+            // Folds case with one OR; only letters land in 0-25
+            unsigned int c = (unsigned int)((data[end] | 0x20) - 'a');
+            if (c < 26) letters |= 1u << c;
+            else if (!(data[end] == '\r' && (end + 1 == size || data[end + 1] == '\n'))) valid = 0;
+            end++;
+        }
+        *pos = end + 1;
+
+        int len = (int)(end - begin);
+        if (len > 0 && data[end - 1] == '\r') len--;
+        if (valid && len >= MIN_WORD_LENGTH && len <= MAX_WORD_LENGTH) {
+            *start = begin;
+            *length = len;
+            *mask = letters;
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    for (int i = 0; i < stickCount; i++) {
-        if (sticks[i].isRagdollStick == 1 && sticks[i].active == 1) {
-            int p1 = sticks[i].p1;
-            int p2 = sticks[i].p2;
-            int p1Symbol = points[p1].symbol;
-            int p2Symbol = points[p2].symbol;
+int CountBits(unsigned int v) {
+    int n = 0;
+    while (v) {
+        v &= v - 1;
+        n++;
+    }
+    return n;
+}
 
-            if ((p1Symbol == '/' && p2Symbol == '/') || (p1Symbol == '\\' && p2Symbol == '\\')) {
-                if (sticksToBreak[0][0] == -1) sticksToBreak[0][0] = i;
-                else if (sticksToBreak[0][1] == -1) sticksToBreak[0][1] = i;
-            }
-            else if ((p1Symbol == '/' && p2Symbol == 'V') || (p1Symbol == 'V' && p2Symbol == '/') ||
-                (p1Symbol == '\\' && p2Symbol == 'V') || (p1Symbol == 'V' && p2Symbol == '\\')) {
-                if (sticksToBreak[1][0] == -1) sticksToBreak[1][0] = i;
-                else if (sticksToBreak[1][1] == -1) sticksToBreak[1][1] = i;
-            }
+// Easy words use only the twelve most common letters, hard ones three or
+// more of the rest
+int WordDifficulty(unsigned int mask) {
+    int rare = CountBits(mask & ~COMMON_LETTER_MASK);
+    return rare == 0 ? DICT_EASY : rare <= 2 ? DICT_MEDIUM : DICT_HARD;
+}
 
-            else if ((p1Symbol == '[' && p2Symbol == '|') || (p1Symbol == '|' && p2Symbol == '[') ||
-                (p1Symbol == ']' && p2Symbol == '|') || (p1Symbol == '|' && p2Symbol == ']')) {
-                if (sticksToBreak[2][0] == -1) sticksToBreak[2][0] = i;
-                else if (sticksToBreak[2][1] == -1) sticksToBreak[2][1] = i;
-            }
-            else if ((p1Symbol == 'V' && p2Symbol == '#') || (p1Symbol == '#' && p2Symbol == 'V')) {
-                sticksToBreak[3][0] = i;
-            }
-            else if ((p1Symbol == '#' && p2Symbol == '|') || (p1Symbol == '|' && p2Symbol == '#')) {
-                sticksToBreak[4][0] = i;
-            }
-            else if ((p1Symbol == 'O' && p2Symbol == '|') || (p1Symbol == '|' && p2Symbol == 'O')) {
-                sticksToBreak[5][0] = i;
-            }
+// Maps a word list and sorts its words by difficulty, then length, with a
+// counting sort so every filter is one contiguous range. Words stay in the
+// mapping; the index holds offsets.
+int LoadDictionary(const char* path) {
+    CloseDictionary();
+    if (!OpenMappedFile(&dictionary.file, path)) return 0;
+    const unsigned char* data = dictionary.file.data;
+    size_t size = dictionary.file.size;
+    if (size > 0xFFFFFFFFu) {
+        CloseDictionary();
+        return 0;
+    }
+
+    int counts[DICT_DIFFICULTIES][MAX_WORD_LENGTH + 1];
+    memset(counts, 0, sizeof(counts));
+    size_t pos = 0, start;
+    int length;
+    unsigned int mask;
+    int total = 0;
+    while (NextDictWord(data, size, &pos, &start, &length, &mask)) {
+        counts[WordDifficulty(mask)][length]++;
+        total++;
+    }
+    if (total == 0) {
+        CloseDictionary();
+        return 0;
+    }
+
+    int next[DICT_DIFFICULTIES][MAX_WORD_LENGTH + 1];
+    int sum = 0;
+    for (int d = 0; d < DICT_DIFFICULTIES; d++) {
+        for (int len = 0; len <= MAX_WORD_LENGTH; len++) {
+            dictionary.bucketStart[d][len] = next[d][len] = sum;
+            sum += counts[d][len];
         }
+        dictionary.bucketStart[d][MAX_WORD_LENGTH + 1] = sum;
+    }
+
+    dictionary.words = (DictWord*)malloc((size_t)total * sizeof(DictWord));
+    if (!dictionary.words) {
+        CloseDictionary();
+        return 0;
+    }
+    pos = 0;
+    while (NextDictWord(data, size, &pos, &start, &length, &mask)) {
+        int d = WordDifficulty(mask);
+        DictWord* w = &dictionary.words[next[d][length]++];
+        w->offset = (unsigned int)start;
+        w->letterMask = mask;
+        w->length = (unsigned char)length;
+        w->difficulty = (unsigned char)d;
+    }
+    dictionary.count = total;
+    return 1;
+}
+
+void CloseDictionary() {
+    if (dictionary.file.data) CloseMappedFile(&dictionary.file);
+    free(dictionary.words);
+    memset(&dictionary, 0, sizeof(dictionary));
+}
+
+// Words matching the length and difficulty filters; difficulty -1 is any
+int CountDictWords(int minLength, int maxLength, int difficulty) {
+    if (minLength < 0) minLength = 0;
+    if (maxLength > MAX_WORD_LENGTH) maxLength = MAX_WORD_LENGTH;
+    if (!dictionary.words || minLength > maxLength) return 0;
+    int n = 0;
+    for (int d = 0; d < DICT_DIFFICULTIES; d++) {
+        if (difficulty >= 0 && d != difficulty) continue;
+        n += dictionary.bucketStart[d][maxLength + 1] - dictionary.bucketStart[d][minLength];
+    }
+    return n;
+}
+
+// Uniform pick among the matching words: at most one range per difficulty
+const DictWord* PickDictWord(int minLength, int maxLength, int difficulty) {
+    int n = CountDictWords(minLength, maxLength, difficulty);
+    if (n == 0) return NULL;
+    if (minLength < 0) minLength = 0;
+    if (maxLength > MAX_WORD_LENGTH) maxLength = MAX_WORD_LENGTH;
+
+    int r = (int)((((unsigned int)SimRand() << 15) | (unsigned int)SimRand()) % (unsigned int)n);
+    for (int d = 0; d < DICT_DIFFICULTIES; d++) {
+        if (difficulty >= 0 && d != difficulty) continue;
+        int first = dictionary.bucketStart[d][minLength];
+        int count = dictionary.bucketStart[d][maxLength + 1] - first;
+        if (r < count) return &dictionary.words[first + r];
+        r -= count;
+    }
+    return NULL;
+}
+
+// Sets the secret word and the per-letter position masks guesses use
+void SetHangmanWord(const char* word, int length) {
+    wordLength = length;
+    for (int i = 0; i < 26; i++) letterPositions[i] = 0;
+    for (int i = 0; i < length; i++) {
+        hangmanWord[i] = (char)toupper((unsigned char)word[i]);
+        guessedWord[i] = '_';
+        int c = hangmanWord[i] - 'A';
+        if (c >= 0 && c < 26) letterPositions[c] |= 1u << i;
     }
+    hangmanWord[length] = '\0';
+    guessedWord[length] = '\0';
+    revealedMask = 0;
+    guessedMask = 0;
+}
+
+// Times a cold load of a generated word list, then picks and guesses
+int RunDictionaryBenchmark(int wordTotal) {
+    const char* path = "bench_dict.txt";
+    const int picks = 1000000;
+    const char* letters = "ETAOINSHRDLCUMWFGYPBVKJXQZ";
+
+    FILE* file;
+    if (fopen_s(&file, path, "wb") != 0 || !file) {
+        printf("Cannot write %s\n", path);
+        return 1;
+    }
+    unsigned int rng = 2463534242u;
+    for (int i = 0; i < wordTotal; i++) {
+        char word[MAX_WORD_LENGTH + 2];
+        int len = 3 + SolverRand(&rng) % 12;
+        for (int c = 0; c < len; c++) {
+            // Squared draw favours common letters, like real text
+            unsigned int r = SolverRand(&rng) % 26;
+            word[c] = letters[r * r / 26];
+        }
+        word[len] = '\n';
+        fwrite(word, 1, len + 1, file);
+    }
+    fclose(file);
+
+    long long start = GetTimeNs();
+    int loaded = LoadDictionary(path);
+    long long loadNs = GetTimeNs() - start;
+    if (!loaded) return 1;
+    size_t fileSize = dictionary.file.size;
+
+    start = GetTimeNs();
+    const int reloads = 10;
+    for (int i = 0; i < reloads; i++) LoadDictionary(path);
+    long long warmNs = (GetTimeNs() - start) / reloads;
+
+    int easy = CountDictWords(0, MAX_WORD_LENGTH, DICT_EASY);
+    int medium = CountDictWords(0, MAX_WORD_LENGTH, DICT_MEDIUM);
+    int hard = CountDictWords(0, MAX_WORD_LENGTH, DICT_HARD);
+
+    simRandState = 1;
+    unsigned int check = 0;
+    start = GetTimeNs();
+    for (int i = 0; i < picks; i++) {
+        const DictWord* w = PickDictWord(5, 9, -1);
+        check += w ? w->letterMask : 0;
+    }
+    long long pickNs = GetTimeNs() - start;
+
+    // Whole games: every letter guessed in frequency order
+    int games = picks / 10;
+    start = GetTimeNs();
+    for (int i = 0; i < games; i++) {
+        const DictWord* w = PickDictWord(5, 9, -1);
+        SetHangmanWord((const char*)dictionary.file.data + w->offset, w->length);
+        unsigned int full = (wordLength >= 32) ? 0xFFFFFFFFu : (1u << wordLength) - 1;
+        for (int c = 0; c < 26 && revealedMask != full; c++) revealedMask |= letterPositions[letters[c] - 'A'];
+        check += revealedMask;
+    }
+    long long gameNs = GetTimeNs() - start;
+
+    printf("Dictionary: %d words (%d easy, %d medium, %d hard), %.1f MB, index %.1f MB (%s)\n", dictionary.count,
+        easy, medium, hard, fileSize / 1048576.0, dictionary.count * sizeof(DictWord) / 1048576.0,
+        check ? "ok" : "empty");
+    printf("  first load (map + index): %8.2f ms\n", loadNs / 1e6);
+    printf("  warm reload:              %8.2f ms\n", warmNs / 1e6);
+    printf("  pick, length 5-9:         %8.2f ns\n", (double)pickNs / picks);
+    printf("  pick + solve by masks:    %8.2f ns\n", (double)gameNs / games);
+
+    CloseDictionary();
+    remove(path);
+    return 0;
+}
+
+// Breaks the bone if it is still whole; returns 1 if it did
+int BreakBone(const Entity* ragdoll, int bone) {
+    int s = ragdoll->firstStick + bone;
+    if (!sticks[s].active) return 0;
+    BreakStick(s);
+    return 1;
+}
+
+void FreePart(const Entity* ragdoll, int part) {
+    points[ragdoll->firstPoint + part].isLocked = 0;
+}
+
+// Each wrong guess takes the next limbs off the hangman's ragdoll
+void BreakRandomStick() {
+    Entity* ragdoll = FirstRagdoll();
+    if (!ragdoll) return;
 
     switch (wrongGuesses) {
     case 1:
-        if (sticksToBreak[0][0] != -1) {
-            sticks[sticksToBreak[0][0]].active = 0;
-            int p1 = sticks[sticksToBreak[0][0]].p1;
-            int p2 = sticks[sticksToBreak[0][0]].p2;
-            if (points[p1].symbol == '/') points[p1].isLocked = 0;
-            if (points[p2].symbol == '/') points[p2].isLocked = 0;
+        if (BreakBone(ragdoll, BONE_LEFT_SHIN)) {
+            FreePart(ragdoll, PART_LEFT_KNEE);
+            FreePart(ragdoll, PART_LEFT_FOOT);
         }
         break;
     case 2:
-        if (sticksToBreak[0][1] != -1) sticks[sticksToBreak[0][1]].active = 0;
-        if (sticksToBreak[1][0] != -1) {
-            sticks[sticksToBreak[1][0]].active = 0;
-            int p1 = sticks[sticksToBreak[1][0]].p1;
-            int p2 = sticks[sticksToBreak[1][0]].p2;
-            if (points[p1].symbol == '/' || points[p1].symbol == '\\') points[p1].isLocked = 0;
-            if (points[p2].symbol == '/' || points[p2].symbol == '\\') points[p2].isLocked = 0;
-        }
+        if (BreakBone(ragdoll, BONE_LEFT_THIGH)) FreePart(ragdoll, PART_LEFT_KNEE);
         break;
     case 3:
-        if (sticksToBreak[1][1] != -1) sticks[sticksToBreak[1][1]].active = 0;
-        if (sticksToBreak[2][0] != -1) {
-            sticks[sticksToBreak[2][0]].active = 0;
-            int p1 = sticks[sticksToBreak[2][0]].p1;
-            int p2 = sticks[sticksToBreak[2][0]].p2;
-            if (points[p1].symbol == '[' || points[p1].symbol == ']') points[p1].isLocked = 0;
-            if (points[p2].symbol == '[' || points[p2].symbol == ']') points[p2].isLocked = 0;
-        }
+        if (BreakBone(ragdoll, BONE_LEFT_ARM)) FreePart(ragdoll, PART_LEFT_HAND);
         break;
     case 4:
-        if (sticksToBreak[2][1] != -1) sticks[sticksToBreak[2][1]].active = 0;
-        if (sticksToBreak[3][0] != -1) {
-            sticks[sticksToBreak[3][0]].active = 0;
-            int p1 = sticks[sticksToBreak[3][0]].p1;
-            int p2 = sticks[sticksToBreak[3][0]].p2;
-            if (points[p1].symbol == 'V') points[p1].isLocked = 0;
-            if (points[p2].symbol == 'V') points[p2].isLocked = 0;
-        }
+        if (BreakBone(ragdoll, BONE_WAIST)) FreePart(ragdoll, PART_HIPS);
         break;
     case 5:
-        if (sticksToBreak[4][0] != -1) {
-            sticks[sticksToBreak[4][0]].active = 0;
-            int p1 = sticks[sticksToBreak[4][0]].p1;
-            int p2 = sticks[sticksToBreak[4][0]].p2;
-            if (points[p1].symbol == '#') points[p1].isLocked = 0;
-            if (points[p2].symbol == '#') points[p2].isLocked = 0;
-        }
-        for (int i = 0; i < stickCount; i++) {
-            if (sticks[i].isRagdollStick == 1 && sticks[i].active == 1) {
-                int p1 = sticks[i].p1;
-                int p2 = sticks[i].p2;
-                if ((points[p1].symbol == '[' || points[p1].symbol == ']') ||
-                    (points[p2].symbol == '[' || points[p2].symbol == ']')) {
-                    sticks[i].active = 0;
-                    break;
-                }
-            }
-        }
+        if (BreakBone(ragdoll, BONE_SPINE)) FreePart(ragdoll, PART_CHEST);
+        if (!BreakBone(ragdoll, BONE_LEFT_ARM)) BreakBone(ragdoll, BONE_RIGHT_ARM);
         break;
     case 6:
-        if (sticksToBreak[5][0] != -1) sticks[sticksToBreak[5][0]].active = 0;
-        for (int i = 0; i < pointCount; i++) {
-            if (points[i].isRagdollPart == 1) {
-                points[i].isLocked = 0;
-            }
-        }
-        for (int i = 0; i < stickCount; i++) {
-            if (sticks[i].isRagdollStick == 1 && sticks[i].active == 1) {
-                sticks[i].active = 0;
-            }
-        }
+        for (int part = 0; part < RAGDOLL_PARTS; part++) FreePart(ragdoll, part);
+        for (int bone = 0; bone < RAGDOLL_BONES; bone++) BreakBone(ragdoll, bone);
         break;
     }
 
-    for (int i = 0; i < pointCount; i++) {
-        if (points[i].isRagdollPart == 1 && points[i].isLocked == 0) {
-            points[i].oldX = points[i].x + (rand() % 3 - 1) * 1.0f;
-            points[i].oldY = points[i].y + (rand() % 2) * 1.0f;
+    for (int i = ragdoll->firstPoint; i < ragdoll->firstPoint + ragdoll->pointCount; i++) {
+        if (points[i].isLocked == 0) {
+            points[i].oldX = points[i].x + (SimRand() % 3 - 1) * 1.0f;
+            points[i].oldY = points[i].y + (SimRand() % 2) * 1.0f;
         }
     }
 }
 
 void InitHangmanMode() {
-    srand(time(NULL));
+    SeedRandom();
     ClearWorld();
     hangmanModeActive = 1;
     wrongGuesses = 0;
@@ -1498,26 +5203,27 @@ void InitHangmanMode() {
     for (int i = 0; i < 26; i++) guessedLetters[i] = 0;
     guessedLetters[26] = '\0';
 
-    const char* wordList[] = {
-        "SIRFAISAL", "PHYSICS", "SIMULATION", "GRAVITY",
-        "STICKMAN", "PROGRAM", "COMPUTER", "WINDOWS", "CONSOLE", "GAMING"
-    };
-
-    int wordCount = 10;
-    strcpy_s(hangmanWord, wordList[rand() % wordCount]);
+    // --dict replaces the built-in words
+    const DictWord* picked = PickDictWord(dictMinLength, dictMaxLength, dictDifficulty);
+    if (picked) {
+        SetHangmanWord((const char*)dictionary.file.data + picked->offset, picked->length);
+    }
+    else {
+        const char* wordList[] = {
+            "SIRFAISAL", "PHYSICS", "SIMULATION", "GRAVITY",
+            "STICKMAN", "PROGRAM", "COMPUTER", "WINDOWS", "CONSOLE", "GAMING"
+        };
 
-    wordLength = (int)strlen(hangmanWord);
-    for (int i = 0; i < wordLength; i++) {
-        guessedWord[i] = '_';
+        int wordCount = 10;
+        const char* word = wordList[SimRand() % wordCount];
+        SetHangmanWord(word, (int)strlen(word));
     }
-    guessedWord[wordLength] = '\0';
 
     SpawnRagdoll(WIDTH / 2, HEIGHT / 2 - 5);
 
-    for (int i = 0; i < pointCount; i++) {
-        if (points[i].isRagdollPart == 1) {
-            points[i].isLocked = 1;
-        }
+    Entity* ragdoll = FirstRagdoll();
+    for (int i = 0; ragdoll && i < ragdoll->pointCount; i++) {
+        points[ragdoll->firstPoint + i].isLocked = 1;
     }
 
     isSimulating = 1;
@@ -1527,48 +5233,34 @@ void ProcessHangmanGuess(char letter) {
     if (hangmanGameOver) return;
 
     letter = toupper(letter);
+    if (letter < 'A' || letter > 'Z') return;
 
     // Check if already guessed
-    for (int i = 0; i < 26; i++) {
-        if (guessedLetters[i] == letter) return;
-    }
-
-    // Add to guessed letters
-    for (int i = 0; i < 26; i++) {
-        if (guessedLetters[i] == 0) {
-            guessedLetters[i] = letter;
-            break;
-        }
-    }
-
-    int found = 0;
-    for (int i = 0; i < wordLength; i++) {
-        if (hangmanWord[i] == letter) {
-            guessedWord[i] = letter;
-            found = 1;
+    unsigned int letterBit = 1u << (letter - 'A');
+    if (guessedMask & letterBit) return;
+    guessedMask |= letterBit;
+    guessedLetters[CountBits(guessedMask) - 1] = letter;
+
+    unsigned int positions = letterPositions[letter - 'A'];
+    if (positions) {
+        revealedMask |= positions;
+        for (int i = 0; i < wordLength; i++) {
+            if (positions & (1u << i)) guessedWord[i] = letter;
         }
     }
-
-    if (!found) {
+    else {
         wrongGuesses++;
         BreakRandomStick();
         currentHangmanStage = wrongGuesses;
     }
 
-    int complete = 1;
-    for (int i = 0; i < wordLength; i++) {
-        if (guessedWord[i] == '_') {
-            complete = 0;
-            break;
-        }
-    }
-
-    if (complete) {
+    unsigned int wordMask = (wordLength >= 32) ? 0xFFFFFFFFu : (1u << wordLength) - 1;
+    if (revealedMask == wordMask) {
         hangmanWon = 1;
         hangmanGameOver = 1;
         gameStats.coins += 50;  // Win bonus
         PlaySoundSuccess();
-        SaveGame();
+        MarkProfileDirty();
     }
 
     if (wrongGuesses >= maxWrongGuesses) {
@@ -1623,8 +5315,6 @@ void DrawHangmanUI() {
             startX = (WIDTH - len) / 2;
             for (int i = 0; i < len; i++) PutChar(startX + i, 9, winMsg[i], COLOR_BRIGHT_GREEN);
 
-            SpawnSuccessParticles(WIDTH / 2, HEIGHT / 2 - 5);
-
             char restart[] = "Press R to play again, ESC for menu";
             len = (int)strlen(restart);
             startX = (WIDTH - len) / 2;
@@ -1665,6 +5355,7 @@ void Explode(int x, int y) {
     // Play sound only once
     PlaySoundExplosion();
     gameStats.explosionsTriggered++;
+    CountMetric(METRIC_EXPLOSIONS, 1);
 
     for (int i = 0; i < pointCount; i++) {
         if (points[i].isActive == 0) continue;
@@ -1703,7 +5394,7 @@ void Explode(int x, int y) {
         float dist = GetDistance(midX, midY, (float)x, (float)y);
 
         if (dist < explosionRadius * 0.5f) {
-            sticks[s].active = 0;
+            BreakStick(s);
             SpawnBreakParticles(midX, midY);
         }
     }
@@ -1770,54 +5461,946 @@ void ResolveBoxCollisions() {
         }
     }
 }
-
+// Valid after UpdateTargetOccupancy() for the current frame
 int CheckRagdollInTarget(int targetIndex) {
+    return targetOccupant[targetIndex] >= 0 ? 1 : 0;
+}
+
+int CheckRagdollIntegrity() {
+    UpdatePointIndex();
+    if (pointIndex.brokenRagdollSticks > 0) return 0;
+    if (pointIndex.ragdollPartCount == 0) return 0;
+    return points[pointIndex.ragdollParts[0]].isActive ? 1 : 0;
+}
+
+void ClearWorld() {
+    pointCount = 0;
+    stickCount = 0;
+    boxCount = 0;
+    targetCount = 0;
+    entityCount = 0;
+    dragPoint = -1;
+    ropeStartX = -1;
+    ropeStartY = -1;
+    ragdollBroken = 0;
+    hangmanModeActive = 0;
+    ClearJournal();
+    StopStreaming();
+
+    for (int i = 0; i < MAX_PARTICLES; i++) particles[i].active = 0;
+}
+
+//---------------------------------------------------------------------
+// SPATIAL INDEX
+//---------------------------------------------------------------------
+
+int GridCell(const SpatialGrid* grid, float x, float y) {
+    int cx = (int)((x - grid->originX) / grid->cellSize);
+    int cy = (int)((y - grid->originY) / grid->cellSize);
+    if (cx < 0) cx = 0;
+    if (cx >= grid->cols) cx = grid->cols - 1;
+    if (cy < 0) cy = 0;
+    if (cy >= grid->rows) cy = grid->rows - 1;
+    return cy * grid->cols + cx;
+}
+
+void BuildGrid(SpatialGrid* grid, const Point* pts, const int* indices, int count, float cellSize) {
+    if (count > MAX_POINTS) count = MAX_POINTS;
+
+    float minX = 0, minY = 0, maxX = 0, maxY = 0;
+    for (int i = 0; i < count; i++) {
+        const Point* p = &pts[indices[i]];
+        if (i == 0 || p->x < minX) minX = p->x;
+        if (i == 0 || p->x > maxX) maxX = p->x;
+        if (i == 0 || p->y < minY) minY = p->y;
+        if (i == 0 || p->y > maxY) maxY = p->y;
+    }
+
+    grid->originX = minX;
+    grid->originY = minY;
+    grid->cellSize = cellSize;
+    while (1) {
+        grid->cols = (int)((maxX - minX) / grid->cellSize) + 1;
+        grid->rows = (int)((maxY - minY) / grid->cellSize) + 1;
+        if ((long long)grid->cols * grid->rows <= GRID_MAX_CELLS) break;
+        grid->cellSize *= 2.0f;
+    }
+
+    int cells = grid->cols * grid->rows;
+    for (int c = 0; c <= cells; c++) grid->cellStart[c] = 0;
+    for (int i = 0; i < count; i++) {
+        grid->cellStart[GridCell(grid, pts[indices[i]].x, pts[indices[i]].y) + 1]++;
+    }
+    for (int c = 0; c < cells; c++) grid->cellStart[c + 1] += grid->cellStart[c];
+
+    // cellStart[c] doubles as the fill cursor, then is shifted back
+    for (int i = 0; i < count; i++) {
+        int c = GridCell(grid, pts[indices[i]].x, pts[indices[i]].y);
+        grid->items[grid->cellStart[c]++] = indices[i];
+    }
+    for (int c = cells; c > 0; c--) grid->cellStart[c] = grid->cellStart[c - 1];
+    grid->cellStart[0] = 0;
+    grid->itemCount = count;
+}
+
+// Points of the grid strictly closer than radius to (x, y), in cell order
+int QueryGrid(const SpatialGrid* grid, const Point* pts, float x, float y, float radius, int* out, int maxOut) {
+    if (grid->itemCount == 0) return 0;
+
+    int x0 = (int)floorf((x - radius - grid->originX) / grid->cellSize);
+    int x1 = (int)floorf((x + radius - grid->originX) / grid->cellSize);
+    int y0 = (int)floorf((y - radius - grid->originY) / grid->cellSize);
+    int y1 = (int)floorf((y + radius - grid->originY) / grid->cellSize);
+    if (x1 < 0 || y1 < 0 || x0 >= grid->cols || y0 >= grid->rows) return 0;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 >= grid->cols) x1 = grid->cols - 1;
+    if (y1 >= grid->rows) y1 = grid->rows - 1;
+
+    float radiusSq = radius * radius;
+    int found = 0;
+    for (int cy = y0; cy <= y1; cy++) {
+        for (int cx = x0; cx <= x1; cx++) {
+            int c = cy * grid->cols + cx;
+            for (int k = grid->cellStart[c]; k < grid->cellStart[c + 1]; k++) {
+                const Point* p = &pts[grid->items[k]];
+                float dx = p->x - x;
+                float dy = p->y - y;
+                if (dx * dx + dy * dy < radiusSq && found < maxOut) out[found++] = grid->items[k];
+            }
+        }
+    }
+    return found;
+}
+
+void UpdatePointIndex() {
+    if (pointIndex.revision == worldRevision && pointIndex.builtCount == pointCount &&
+        pointIndex.builtStickCount == stickCount) return;
+
+    pointIndex.pickupCount = 0;
+    pointIndex.ragdollPartCount = 0;
     for (int i = 0; i < pointCount; i++) {
-        if (points[i].isActive == 0) continue;
-        if (points[i].isRagdollPart == 0) continue;
+        if (points[i].pickup != PICKUP_NONE) pointIndex.pickups[pointIndex.pickupCount++] = i;
+        if (points[i].isRagdollPart) pointIndex.ragdollParts[pointIndex.ragdollPartCount++] = i;
+    }
+    pointIndex.brokenRagdollSticks = 0;
+    for (int s = 0; s < stickCount; s++) {
+        if (sticks[s].isRagdollStick && !sticks[s].active) pointIndex.brokenRagdollSticks++;
+    }
+    pointIndex.revision = worldRevision;
+    pointIndex.builtCount = pointCount;
+    pointIndex.builtStickCount = stickCount;
+}
+
+// Finds, for each target, a live ragdoll part inside its circle. Only
+// ragdoll parts are gridded, so walls, coins and debris cost nothing.
+void UpdateTargetOccupancy() {
+    static int live[MAX_POINTS];
+    int hit[1];
+
+    // Ragdolls whose bounds miss every target are skipped whole
+    UpdateEntityIndex();
+    int liveCount = 0;
+    for (int r = 0; r < entityIndex.kindCount[ENTITY_RAGDOLL]; r++) {
+        const Entity* ragdoll = &entities[entityIndex.ofKind[ENTITY_RAGDOLL][r]];
+        int near = 0;
+        for (int t = 0; t < targetCount && !near; t++) {
+            near = targets[t].x + targets[t].radius > ragdoll->minX && targets[t].x - targets[t].radius < ragdoll->maxX &&
+                targets[t].y + targets[t].radius > ragdoll->minY && targets[t].y - targets[t].radius < ragdoll->maxY;
+        }
+        if (!near) continue;
+        for (int i = ragdoll->firstPoint; i < ragdoll->firstPoint + ragdoll->pointCount; i++) {
+            if (points[i].isActive) live[liveCount++] = i;
+        }
+    }
+    BuildGrid(&ragdollGrid, points, live, liveCount, 4.0f);
+
+    for (int t = 0; t < targetCount; t++) {
+        targetOccupant[t] = -1;
+        if (QueryGrid(&ragdollGrid, points, targets[t].x, targets[t].y, targets[t].radius, hit, 1) > 0) {
+            targetOccupant[t] = hit[0];
+        }
+    }
+}
+
+// Pick index: a bucket grid like SpatialGrid, but over any (pts, count)
+// and with each item's entity kind, so picks can skip whole kinds.
+// Distances are compared squared throughout.
+
+int PickCell(const PickIndex* index, float x, float y, int* cx, int* cy) {
+    *cx = (int)floorf((x - index->originX) / index->cellSize);
+    *cy = (int)floorf((y - index->originY) / index->cellSize);
+    if (*cx < 0) *cx = 0;
+    if (*cx >= index->cols) *cx = index->cols - 1;
+    if (*cy < 0) *cy = 0;
+    if (*cy >= index->rows) *cy = index->rows - 1;
+    return *cy * index->cols + *cx;
+}
+
+// kinds[i] is the entity kind of pts[i], ENTITY_KIND_COUNT for loose
+// points; NULL treats every point as loose. Inactive points are left out.
+int BuildPickIndex(PickIndex* index, const Point* pts, const unsigned char* kinds, int count, float cellSize) {
+    float minX = 0, minY = 0, maxX = 0, maxY = 0;
+    int live = 0;
+    for (int i = 0; i < count; i++) {
+        if (!pts[i].isActive) continue;
+        if (live == 0 || pts[i].x < minX) minX = pts[i].x;
+        if (live == 0 || pts[i].x > maxX) maxX = pts[i].x;
+        if (live == 0 || pts[i].y < minY) minY = pts[i].y;
+        if (live == 0 || pts[i].y > maxY) maxY = pts[i].y;
+        live++;
+    }
+
+    // About one cell per point at most
+    int maxCells = count > GRID_MAX_CELLS ? count : GRID_MAX_CELLS;
+    index->originX = minX;
+    index->originY = minY;
+    index->cellSize = cellSize;
+    while (1) {
+        index->cols = (int)((maxX - minX) / index->cellSize) + 1;
+        index->rows = (int)((maxY - minY) / index->cellSize) + 1;
+        if ((long long)index->cols * index->rows <= maxCells) break;
+        index->cellSize *= 2.0f;
+    }
+    int cells = index->cols * index->rows;
+
+    if (cells + 1 > index->cellCapacity) {
+        int* grown = (int*)realloc(index->cellStart, (cells + 1) * sizeof(int));
+        if (!grown) return 0;
+        index->cellStart = grown;
+        index->cellCapacity = cells + 1;
+    }
+    if (live > index->itemCapacity) {
+        int* items = (int*)realloc(index->items, live * sizeof(int));
+        if (items) index->items = items;
+        float* xs = (float*)realloc(index->xs, live * sizeof(float));
+        if (xs) index->xs = xs;
+        float* ys = (float*)realloc(index->ys, live * sizeof(float));
+        if (ys) index->ys = ys;
+        unsigned char* itemKinds = (unsigned char*)realloc(index->kinds, live);
+        if (itemKinds) index->kinds = itemKinds;
+        if (!items || !xs || !ys || !itemKinds) return 0;
+        index->itemCapacity = live;
+    }
+
+    int cx, cy;
+    for (int c = 0; c <= cells; c++) index->cellStart[c] = 0;
+    for (int i = 0; i < count; i++) {
+        if (pts[i].isActive) index->cellStart[PickCell(index, pts[i].x, pts[i].y, &cx, &cy) + 1]++;
+    }
+    for (int c = 0; c < cells; c++) index->cellStart[c + 1] += index->cellStart[c];
+
+    // cellStart[c] doubles as the fill cursor, then is shifted back
+    for (int i = 0; i < count; i++) {
+        if (!pts[i].isActive) continue;
+        int c = PickCell(index, pts[i].x, pts[i].y, &cx, &cy);
+        int n = index->cellStart[c]++;
+        index->items[n] = i;
+        index->xs[n] = pts[i].x;
+        index->ys[n] = pts[i].y;
+        index->kinds[n] = kinds ? kinds[i] : (unsigned char)ENTITY_KIND_COUNT;
+    }
+    for (int c = cells; c > 0; c--) index->cellStart[c] = index->cellStart[c - 1];
+    index->cellStart[0] = 0;
+
+    index->itemCount = live;
+    return 1;
+}
+
+void FreePickIndex(PickIndex* index) {
+    free(index->cellStart);
+    free(index->items);
+    free(index->xs);
+    free(index->ys);
+    free(index->kinds);
+    memset(index, 0, sizeof(*index));
+}
+
+// Up to k points strictly within radius, nearest first; ties go to the
+// lower index, as a front-to-back scan would. Cells are visited in rings
+// around the query and the search stops once no farther ring can beat
+// the k-th distance found.
+int PickKNearest(const PickIndex* index, float x, float y, float radius, int kindMask, int k, int* out) {
+    if (index->itemCount == 0 || k <= 0) return 0;
+
+    float bestSq[PICK_MAX_K];
+    if (k > PICK_MAX_K) k = PICK_MAX_K;
+    float radiusSq = radius * radius;
+    int found = 0;
+
+    int cx, cy;
+    PickCell(index, x, y, &cx, &cy);
+    int maxRing = index->cols > index->rows ? index->cols : index->rows;
+    for (int ring = 0; ring <= maxRing; ring++) {
+        // Every cell of this ring is at least this far from the query
+        float reach = (ring - 1) * index->cellSize;
+        if (ring > 0 && (reach * reach >= radiusSq || (found == k && reach * reach > bestSq[k - 1]))) break;
+
+        for (int gy = cy - ring; gy <= cy + ring; gy++) {
+            if (gy < 0 || gy >= index->rows) continue;
+            int edgeRow = (gy == cy - ring || gy == cy + ring);
+            for (int gx = cx - ring; gx <= cx + ring; gx += (edgeRow || ring == 0) ? 1 : 2 * ring) {
+                if (gx < 0 || gx >= index->cols) continue;
+                int c = gy * index->cols + gx;
+                for (int n = index->cellStart[c]; n < index->cellStart[c + 1]; n++) {
+                    if (!(kindMask & (1 << index->kinds[n]))) continue;
+                    float dx = index->xs[n] - x;
+                    float dy = index->ys[n] - y;
+                    float dSq = dx * dx + dy * dy;
+                    if (dSq >= radiusSq) continue;
+                    int item = index->items[n];
+
+                    // Insertion into the sorted best list
+                    int slot = found;
+                    while (slot > 0 && (dSq < bestSq[slot - 1] || (dSq == bestSq[slot - 1] && item < out[slot - 1]))) slot--;
+                    if (slot >= k) continue;
+                    int last = (found < k) ? found : k - 1;
+                    for (int s = last; s > slot; s--) {
+                        bestSq[s] = bestSq[s - 1];
+                        out[s] = out[s - 1];
+                    }
+                    bestSq[slot] = dSq;
+                    out[slot] = item;
+                    if (found < k) found++;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+int PickNearest(const PickIndex* index, float x, float y, float radius, int kindMask) {
+    int nearest;
+    return PickKNearest(index, x, y, radius, kindMask, 1, &nearest) ? nearest : -1;
+}
+
+// Points inside the rectangle, edges included, in cell order
+int PickRect(const PickIndex* index, float x0, float y0, float x1, float y1, int kindMask, int* out, int maxOut) {
+    if (index->itemCount == 0) return 0;
+    if (x1 < x0) { float t = x0; x0 = x1; x1 = t; }
+    if (y1 < y0) { float t = y0; y0 = y1; y1 = t; }
+
+    int cx0, cy0, cx1, cy1;
+    PickCell(index, x0, y0, &cx0, &cy0);
+    PickCell(index, x1, y1, &cx1, &cy1);
+    int found = 0;
+    for (int gy = cy0; gy <= cy1; gy++) {
+        for (int gx = cx0; gx <= cx1; gx++) {
+            int c = gy * index->cols + gx;
+            for (int n = index->cellStart[c]; n < index->cellStart[c + 1] && found < maxOut; n++) {
+                if (!(kindMask & (1 << index->kinds[n]))) continue;
+                if (index->xs[n] >= x0 && index->xs[n] <= x1 && index->ys[n] >= y0 && index->ys[n] <= y1) {
+                    out[found++] = index->items[n];
+                }
+            }
+        }
+    }
+    return found;
+}
+
+int PickIndexCurrent() {
+    return pickIndexBuilt && pickRevision == worldRevision && pickPositionRevision == positionRevision &&
+        pickPointCount == pointCount;
+}
+
+// Rebuilds the live world's pick index when points were added, removed
+// or moved since the last pick
+void UpdatePickIndex() {
+    static unsigned char kinds[MAX_POINTS];
+    if (PickIndexCurrent()) return;
+
+    UpdateEntityIndex();
+    for (int i = 0; i < pointCount; i++) {
+        kinds[i] = pointEntity[i] >= 0 ? (unsigned char)entities[pointEntity[i]].kind : (unsigned char)ENTITY_KIND_COUNT;
+    }
+    pickIndexBuilt = BuildPickIndex(&pickIndex, points, kinds, pointCount, PICK_CELL_SIZE);
+    pickRevision = worldRevision;
+    pickPositionRevision = positionRevision;
+    pickPointCount = pointCount;
+}
+
+// The old linear pick, kept as the benchmark's reference
+int ScanNearestPoint(const Point* pts, int count, float x, float y, float maxDist) {
+    int bestPoint = -1;
+    float bestDistance = maxDist;
+    for (int i = 0; i < count; i++) {
+        if (pts[i].isActive == 0) continue;
+        float distance = GetDistance(pts[i].x, pts[i].y, x, y);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            bestPoint = i;
+        }
+    }
+    return bestPoint;
+}
 
-        float dist = GetDistance(points[i].x, points[i].y,
-            targets[targetIndex].x, targets[targetIndex].y);
-        if (dist < targets[targetIndex].radius) {
+int RunPickBenchmark(int pointTotal) {
+    const int queries = 1000000;
+    const int scanQueries = 2000;
+    const int rebuildQueries = 200;
+    const float radius = 5.0f;
+    const float areaW = 2000.0f, areaH = 400.0f;
+
+    Point* pts = (Point*)calloc(pointTotal, sizeof(Point));
+    unsigned char* kinds = (unsigned char*)malloc(pointTotal);
+    float* qx = (float*)malloc(queries * sizeof(float));
+    float* qy = (float*)malloc(queries * sizeof(float));
+    if (!pts || !kinds || !qx || !qy) return 1;
+
+    unsigned int rng = 88172645u;
+    for (int i = 0; i < pointTotal; i++) {
+        pts[i].x = pts[i].oldX = (SolverRand(&rng) % 100000) / 100000.0f * areaW;
+        pts[i].y = pts[i].oldY = (SolverRand(&rng) % 100000) / 100000.0f * areaH;
+        pts[i].isActive = 1;
+        kinds[i] = (unsigned char)(i / 10 % 4 == 0 ? ENTITY_RAGDOLL : i / 10 % 4 == 1 ? ENTITY_ROPE : ENTITY_KIND_COUNT);
+    }
+    for (int q = 0; q < queries; q++) {
+        qx[q] = (SolverRand(&rng) % 100000) / 100000.0f * areaW;
+        qy[q] = (SolverRand(&rng) % 100000) / 100000.0f * areaH;
+    }
+
+    PickIndex index;
+    memset(&index, 0, sizeof(index));
+    long long start = GetTimeNs();
+    if (!BuildPickIndex(&index, pts, kinds, pointTotal, PICK_CELL_SIZE)) return 1;
+    long long buildNs = GetTimeNs() - start;
+
+    // Linear scan on a sample; it is too slow for all queries
+    int mismatches = 0;
+    for (int q = 0; q < scanQueries; q++) {
+        if (ScanNearestPoint(pts, pointTotal, qx[q], qy[q], radius) != PickNearest(&index, qx[q], qy[q], radius, PICK_ANY)) {
+            mismatches++;
+        }
+    }
+    start = GetTimeNs();
+    long long hits = 0;
+    for (int q = 0; q < scanQueries; q++) hits += ScanNearestPoint(pts, pointTotal, qx[q], qy[q], radius) >= 0;
+    long long scanNs = GetTimeNs() - start;
+
+    start = GetTimeNs();
+    for (int q = 0; q < queries; q++) hits += PickNearest(&index, qx[q], qy[q], radius, PICK_ANY) >= 0;
+    long long nearNs = GetTimeNs() - start;
+
+    start = GetTimeNs();
+    for (int q = 0; q < queries; q++) hits += PickNearest(&index, qx[q], qy[q], radius, 1 << ENTITY_RAGDOLL) >= 0;
+    long long kindNs = GetTimeNs() - start;
+
+    int out[PICK_MAX_K * 8];
+    start = GetTimeNs();
+    for (int q = 0; q < queries; q++) hits += PickKNearest(&index, qx[q], qy[q], 1e9f, PICK_ANY, 8, out);
+    long long knnNs = GetTimeNs() - start;
+
+    start = GetTimeNs();
+    for (int q = 0; q < queries; q++) hits += PickRect(&index, qx[q], qy[q], qx[q] + 8.0f, qy[q] + 4.0f, PICK_ANY, out, PICK_MAX_K * 8);
+    long long rectNs = GetTimeNs() - start;
+
+    // A pick after the world moved: rebuild, then one query
+    start = GetTimeNs();
+    for (int q = 0; q < rebuildQueries; q++) {
+        BuildPickIndex(&index, pts, kinds, pointTotal, PICK_CELL_SIZE);
+        hits += PickNearest(&index, qx[q], qy[q], radius, PICK_ANY) >= 0;
+    }
+    long long rebuildNs = GetTimeNs() - start;
+
+    printf("Pick: %d points over %.0fx%.0f, %d cols x %d rows of %.0f (%lld hits)\n", pointTotal, areaW, areaH,
+        index.cols, index.rows, index.cellSize, hits);
+    printf("  build:                    %8.2f ms\n", buildNs / 1e6);
+    printf("  linear scan, radius %.0f:   %8.2f ns/query\n", radius, (double)scanNs / scanQueries);
+    printf("  nearest, radius %.0f:       %8.2f ns/query\n", radius, (double)nearNs / queries);
+    printf("  nearest ragdoll part:     %8.2f ns/query\n", (double)kindNs / queries);
+    printf("  8 nearest, any distance:  %8.2f ns/query\n", (double)knnNs / queries);
+    printf("  8x4 rectangle:            %8.2f ns/query\n", (double)rectNs / queries);
+    printf("  rebuild + one pick:       %8.2f ns/query\n", (double)rebuildNs / rebuildQueries);
+    printf("  %d/%d sampled picks differ from the linear scan\n", mismatches, scanQueries);
+
+    FreePickIndex(&index);
+    free(pts);
+    free(kinds);
+    free(qx);
+    free(qy);
+    return mismatches ? 1 : 0;
+}
+
+//---------------------------------------------------------------------
+// MISSION FILES
+//---------------------------------------------------------------------
+// missions/missionN.lvl, loaded in order until the first missing number.
+// One command per line, '#' starts a comment:
+//   title|desc|hint TEXT          start screen text
+//   time SECONDS                  time limit
+//   reward COINS                  base reward before the time bonus
+//   ragdoll X Y                   player ragdoll
+//   box X Y W H [SOLID WALL]      static box (SOLID and WALL default to 1)
+//   platform X Y WIDTH
+//   bomb X Y
+//   coin X Y
+//   target X Y RADIUS             every target must be reached
+//   point ID X Y SYMBOL LOCKED RADIUS COLOR
+//                                 ID names the point for stick/push, - for none
+//   stick ID ID
+//   push ID DX DY                 initial velocity of a named point
+// Each level is compiled to missionN.lvc beside it, tagged with the source
+// file's size and modification time, so a cache hit never reads the text.
+// A stale or damaged cache is simply rebuilt.
+
+// Start screen text of the built-in missions
+const char* builtinMissionText[5][3] = {
+    { "MISSION 1: TRAINING GROUNDS", "Navigate the simple course. Use SPACE to play/pause, D to drag.",
+        "HINT: Drag the stickman's head to move it around." },
+    { "MISSION 2: THE MAZE", "Find your way through the maze to reach the target.",
+        "HINT: Use bombs strategically to clear paths." },
+    { "MISSION 3: OBSTACLE COURSE", "Navigate through moving platforms and obstacles.",
+        "HINT: Time your movements with platform swings." },
+    { "MISSION 4: PINBALL CHALLENGE", "Use bumpers and flippers to reach the top target.",
+        "HINT: Create momentum with bombs and ropes." },
+    { "MISSION 5: FINAL BOSS", "The ultimate challenge! Multiple stages to complete.",
+        "HINT: You'll need all your skills for this one!" }
+};
+
+struct LevelColor {
+    const char* name;
+    int color;
+};
+
+const LevelColor levelColors[] = {
+    { "black", COLOR_BLACK }, { "white", COLOR_WHITE }, { "red", COLOR_BRIGHT_RED },
+    { "green", COLOR_BRIGHT_GREEN }, { "yellow", COLOR_BRIGHT_YELLOW }, { "cyan", COLOR_BRIGHT_CYAN },
+    { "magenta", COLOR_BRIGHT_MAGENTA }, { "blue", COLOR_BRIGHT_BLUE }, { "gray", COLOR_GRAY },
+    { "darkgray", COLOR_DARK_GRAY }, { "orange", COLOR_ORANGE }
+};
+
+// Command name, op, number of numeric arguments (-1 for text commands)
+struct LevelCommand {
+    const char* name;
+    int op;
+    int minArgs;
+    int maxArgs;
+};
+
+const LevelCommand levelCommands[] = {
+    { "ragdoll", LEVEL_OP_RAGDOLL, 2, 2 },
+    { "box", LEVEL_OP_BOX, 4, 6 },
+    { "platform", LEVEL_OP_PLATFORM, 3, 3 },
+    { "bomb", LEVEL_OP_BOMB, 2, 2 },
+    { "coin", LEVEL_OP_COIN, 2, 2 },
+    { "target", LEVEL_OP_TARGET, 3, 3 }
+};
+
+int LevelError(char* error, int errorSize, int line, const char* format, const char* arg) {
+    char message[100];
+    sprintf_s(message, 100, format, arg);
+    sprintf_s(error, errorSize, "line %d: %s", line, message);
+    return 0;
+}
+
+// Returns the slot for a point name, adding it if asked
+int LevelId(char names[][32], int* nameCount, const char* name, int add) {
+    for (int i = 0; i < *nameCount; i++) {
+        if (strcmp(names[i], name) == 0) return i;
+    }
+    if (!add || *nameCount >= MAX_LEVEL_IDS || strlen(name) >= 32) return -1;
+    strcpy_s(names[*nameCount], 32, name);
+    return (*nameCount)++;
+}
+
+int ParseLevelColor(const char* word, int* color) {
+    if (isdigit((unsigned char)word[0])) {
+        *color = atoi(word) & 0x0F;
+        return 1;
+    }
+    for (int i = 0; i < (int)(sizeof(levelColors) / sizeof(levelColors[0])); i++) {
+        if (strcmp(levelColors[i].name, word) == 0) {
+            *color = levelColors[i].color;
             return 1;
         }
     }
     return 0;
 }
 
-int CheckRagdollIntegrity() {
-    for (int i = 0; i < stickCount; i++) {
-        if (sticks[i].isRagdollStick == 1 && sticks[i].active == 0) {
+int CompileLevel(const char* text, size_t size, MissionDef* def, char* error, int errorSize) {
+    char names[MAX_LEVEL_IDS][32];
+    int nameCount = 0;
+
+    memset(def, 0, sizeof(MissionDef));
+    def->info.timeLimit = 30.0f;
+    def->info.reward = 50;
+
+    size_t pos = 0;
+    int lineNum = 0;
+    while (pos < size) {
+        char line[256];
+        int len = 0;
+        while (pos < size && text[pos] != '\n') {
+            if (len < 255) line[len++] = text[pos];
+            pos++;
+        }
+        pos++;
+        lineNum++;
+        while (len > 0 && isspace((unsigned char)line[len - 1])) len--;
+        line[len] = '\0';
+
+        char* cursor = line;
+        while (isspace((unsigned char)*cursor)) cursor++;
+        if (*cursor == '\0' || *cursor == '#') continue;
+
+        // Split into words; text commands keep the rest of the line
+        char* words[10];
+        int wordCount = 0;
+        int isText = 0;
+        while (*cursor && wordCount < 10 && !isText) {
+            words[wordCount++] = cursor;
+            while (*cursor && !isspace((unsigned char)*cursor)) cursor++;
+            if (*cursor) *cursor++ = '\0';
+            while (isspace((unsigned char)*cursor)) cursor++;
+            isText = strcmp(words[0], "title") == 0 || strcmp(words[0], "desc") == 0 || strcmp(words[0], "hint") == 0;
+        }
+        if (*cursor && !isText) return LevelError(error, errorSize, lineNum, "too many arguments to '%s'", words[0]);
+
+        const char* cmd = words[0];
+        int args = wordCount - 1;
+
+        if (isText) {
+            const char* rest = cursor;
+            char* dest = cmd[0] == 't' ? def->info.title : cmd[0] == 'd' ? def->info.desc : def->info.hint;
+            int destSize = cmd[0] == 't' ? sizeof(def->info.title) : sizeof(def->info.desc);
+            if ((int)strlen(rest) >= destSize) return LevelError(error, errorSize, lineNum, "%s text too long", cmd);
+            strcpy_s(dest, destSize, rest);
+            continue;
+        }
+
+        // Everything else takes numbers, apart from point ids, symbols and colors
+        float v[6] = { 0 };
+        int numeric = (strcmp(cmd, "point") == 0 || strcmp(cmd, "stick") == 0 || strcmp(cmd, "push") == 0) ? 0 : 1;
+        for (int a = 1; numeric && a < wordCount; a++) {
+            char* end;
+            v[a - 1] = strtof(words[a], &end);
+            if (*end) return LevelError(error, errorSize, lineNum, "'%s' is not a number", words[a]);
+        }
+
+        if (strcmp(cmd, "time") == 0 || strcmp(cmd, "reward") == 0) {
+            if (args != 1) return LevelError(error, errorSize, lineNum, "%s takes one value", cmd);
+            if (cmd[0] == 't') def->info.timeLimit = v[0];
+            else def->info.reward = (int)v[0];
+            continue;
+        }
+
+        if (def->info.opCount >= MAX_LEVEL_OPS) return LevelError(error, errorSize, lineNum, "too many objects at '%s'", cmd);
+        LevelOp* op = &def->ops[def->info.opCount];
+
+        if (numeric) {
+            const LevelCommand* command = NULL;
+            for (int c = 0; c < (int)(sizeof(levelCommands) / sizeof(levelCommands[0])); c++) {
+                if (strcmp(levelCommands[c].name, cmd) == 0) command = &levelCommands[c];
+            }
+            if (!command) return LevelError(error, errorSize, lineNum, "unknown command '%s'", cmd);
+            if (args < command->minArgs || args > command->maxArgs) {
+                return LevelError(error, errorSize, lineNum, "wrong number of arguments to '%s'", cmd);
+            }
+            op->op = (unsigned char)command->op;
+            for (int a = 0; a < 4; a++) op->v[a] = v[a];
+            if (command->op == LEVEL_OP_BOX) {
+                int solid = args > 4 ? (int)v[4] : 1;
+                int wall = args > 5 ? (int)v[5] : 1;
+                op->flags = (solid ? 1 : 0) | (wall ? 2 : 0);
+            }
+        }
+        else if (strcmp(cmd, "point") == 0) {
+            if (args != 7) return LevelError(error, errorSize, lineNum, "wrong number of arguments to '%s'", cmd);
+            char* end;
+            for (int a = 0; a < 2; a++) {
+                op->v[a] = strtof(words[2 + a], &end);
+                if (*end) return LevelError(error, errorSize, lineNum, "'%s' is not a number", words[2 + a]);
+            }
+            op->v[2] = strtof(words[6], &end);
+            if (*end) return LevelError(error, errorSize, lineNum, "'%s' is not a number", words[6]);
+            if (strlen(words[4]) != 1) return LevelError(error, errorSize, lineNum, "symbol '%s' must be one character", words[4]);
+            if (!ParseLevelColor(words[7], &op->color)) return LevelError(error, errorSize, lineNum, "unknown color '%s'", words[7]);
+
+            op->op = LEVEL_OP_POINT;
+            op->symbol = words[4][0];
+            op->flags = atoi(words[5]) ? 1 : 0;
+            op->id = 0xFF;
+            if (strcmp(words[1], "-") != 0) {
+                int id = LevelId(names, &nameCount, words[1], 1);
+                if (id < 0) return LevelError(error, errorSize, lineNum, "cannot name point '%s'", words[1]);
+                op->id = (unsigned char)id;
+            }
+        }
+        else if (strcmp(cmd, "stick") == 0 || strcmp(cmd, "push") == 0) {
+            int isStick = (cmd[0] == 's');
+            if (args != (isStick ? 2 : 3)) return LevelError(error, errorSize, lineNum, "wrong number of arguments to '%s'", cmd);
+            int id = LevelId(names, &nameCount, words[1], 0);
+            int id2 = isStick ? LevelId(names, &nameCount, words[2], 0) : 0;
+            if (id < 0) return LevelError(error, errorSize, lineNum, "unknown point '%s'", words[1]);
+            if (id2 < 0) return LevelError(error, errorSize, lineNum, "unknown point '%s'", words[2]);
+
+            op->op = isStick ? LEVEL_OP_STICK : LEVEL_OP_PUSH;
+            op->id = (unsigned char)id;
+            op->id2 = (unsigned char)id2;
+            if (!isStick) {
+                char* end;
+                for (int a = 0; a < 2; a++) {
+                    op->v[a] = strtof(words[2 + a], &end);
+                    if (*end) return LevelError(error, errorSize, lineNum, "'%s' is not a number", words[2 + a]);
+                }
+            }
+        }
+        else {
+            return LevelError(error, errorSize, lineNum, "unknown command '%s'", cmd);
+        }
+        def->info.opCount++;
+    }
+    return 1;
+}
+
+char* ReadWholeFile(const char* path, size_t* size) {
+    FILE* file;
+    if (fopen_s(&file, path, "rb") != 0 || !file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)malloc(length > 0 ? length : 1);
+    *size = data ? fread(data, 1, length > 0 ? length : 0, file) : 0;
+    fclose(file);
+    return data;
+}
+
+int StatLevelSource(const char* path, long long* size, long long* time) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr)) return 0;
+    *size = ((long long)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    *time = ((long long)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    *size = (long long)st.st_size;
+#ifdef __linux__
+    *time = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    *time = (long long)st.st_mtime;
+#endif
+#endif
+    return 1;
+}
+
+// The cache is a few KB at most, so one buffered read beats mapping it
+int ReadLevelCache(const char* path, long long sourceSize, long long sourceTime, MissionDef* def) {
+    static char buffer[sizeof(LevelCacheHeader) + sizeof(MissionDef) + 1];
+    FILE* file;
+    if (fopen_s(&file, path, "rb") != 0 || !file) return 0;
+    size_t size = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+
+    int ok = size >= sizeof(LevelCacheHeader) + sizeof(MissionInfo);
+    const LevelCacheHeader* header = (const LevelCacheHeader*)buffer;
+    const MissionInfo* info = (const MissionInfo*)(buffer + sizeof(LevelCacheHeader));
+    ok = ok && memcmp(header->magic, LEVEL_CACHE_MAGIC, 4) == 0 && header->version == LEVEL_CACHE_VERSION;
+    ok = ok && header->sourceSize == sourceSize && header->sourceTime == sourceTime;
+    ok = ok && info->opCount >= 0 && info->opCount <= MAX_LEVEL_OPS;
+    ok = ok && size == sizeof(LevelCacheHeader) + sizeof(MissionInfo) + info->opCount * sizeof(LevelOp);
+    if (ok) {
+        def->info = *info;
+        memcpy(def->ops, info + 1, info->opCount * sizeof(LevelOp));
+    }
+    return ok;
+}
+
+void WriteLevelCache(const char* path, long long sourceSize, long long sourceTime, const MissionDef* def) {
+    LevelCacheHeader header;
+    memcpy(header.magic, LEVEL_CACHE_MAGIC, 4);
+    header.version = LEVEL_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+
+    FILE* file;
+    if (fopen_s(&file, path, "wb") != 0 || !file) return;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&def->info, sizeof(MissionInfo), 1, file) == 1;
+    if (def->info.opCount > 0) ok = ok && fwrite(def->ops, sizeof(LevelOp), def->info.opCount, file) == (size_t)def->info.opCount;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) remove(path);      // never leave a partial cache behind
+}
+
+// Loads path (missionN.lvl) through its cache; the source is only read
+// and compiled on a miss
+int LoadLevel(const char* path, MissionDef* def, int* fromCache, char* error, int errorSize) {
+    long long sourceSize, sourceTime;
+    if (!StatLevelSource(path, &sourceSize, &sourceTime)) {
+        sprintf_s(error, errorSize, "cannot read file");
+        return 0;
+    }
+
+    char cachePath[260];
+    sprintf_s(cachePath, 260, "%s", path);
+    char* ext = strrchr(cachePath, '.');
+    if (ext) strcpy_s(ext, 5, ".lvc");
+
+    *fromCache = ReadLevelCache(cachePath, sourceSize, sourceTime, def);
+    if (*fromCache) return 1;
+
+    size_t size;
+    char* text = ReadWholeFile(path, &size);
+    if (!text) {
+        sprintf_s(error, errorSize, "cannot read file");
+        return 0;
+    }
+    int ok = CompileLevel(text, size, def, error, errorSize);
+    // A source changed while it was read may not match its stat; skip the cache then
+    if (ok && size == (size_t)sourceSize) WriteLevelCache(cachePath, sourceSize, sourceTime, def);
+    free(text);
+    return ok;
+}
+
+// Fills missionDefs from the mission directory. Without any files the
+// built-in missions are used. Returns 0 after printing a load error.
+int LoadMissions() {
+    int count = 0;
+    for (int n = 1; n <= MAX_MISSIONS; n++) {
+        char path[260];
+        sprintf_s(path, 260, "%s/mission%d.lvl", MISSION_DIR, n);
+        FILE* probe;
+        if (fopen_s(&probe, path, "rb") != 0 || !probe) break;
+        fclose(probe);
+
+        char error[160];
+        int fromCache;
+        if (!LoadLevel(path, &missionDefs[n - 1], &fromCache, error, 160)) {
+            printf("%s: %s\n", path, error);
             return 0;
         }
+        count++;
     }
 
-    for (int i = 0; i < pointCount; i++) {
-        if (points[i].isRagdollPart == 1) {
-            if (points[i].isActive == 0) {
-                return 0;
+    builtinMissions = (count == 0);
+    maxMissions = builtinMissions ? 5 : count;
+    for (int n = 0; builtinMissions && n < maxMissions; n++) {
+        MissionInfo* info = &missionDefs[n].info;
+        strcpy_s(info->title, builtinMissionText[n][0]);
+        strcpy_s(info->desc, builtinMissionText[n][1]);
+        strcpy_s(info->hint, builtinMissionText[n][2]);
+        info->reward = (n + 1) * 50;
+        info->opCount = 0;
+    }
+    return 1;
+}
+
+// Runs the level ops through the same spawn calls the built-in missions use
+void SpawnLevel(const MissionDef* def) {
+    int ids[MAX_LEVEL_IDS];
+    for (int i = 0; i < MAX_LEVEL_IDS; i++) ids[i] = -1;
+
+    for (int i = 0; i < def->info.opCount; i++) {
+        const LevelOp* op = &def->ops[i];
+        switch (op->op) {
+        case LEVEL_OP_RAGDOLL:
+            SpawnRagdoll((int)op->v[0], (int)op->v[1]);
+            break;
+        case LEVEL_OP_BOX:
+            AddBox(op->v[0], op->v[1], op->v[2], op->v[3], op->flags & 1, (op->flags >> 1) & 1);
+            break;
+        case LEVEL_OP_PLATFORM:
+            SpawnPlatform((int)op->v[0], (int)op->v[1], (int)op->v[2]);
+            break;
+        case LEVEL_OP_BOMB:
+            SpawnBomb((int)op->v[0], (int)op->v[1]);
+            break;
+        case LEVEL_OP_COIN:
+            SpawnCoin((int)op->v[0], (int)op->v[1]);
+            break;
+        case LEVEL_OP_TARGET:
+            AddTarget(op->v[0], op->v[1], op->v[2]);
+            break;
+        case LEVEL_OP_POINT: {
+            int p = AddPoint(op->v[0], op->v[1], op->symbol, op->flags, op->v[2], 0, op->color, 0);
+            if (op->id < MAX_LEVEL_IDS) ids[op->id] = p;
+            break;
+        }
+        case LEVEL_OP_STICK:
+            if (ids[op->id] >= 0 && ids[op->id2] >= 0) AddStick(ids[op->id], ids[op->id2], 0);
+            break;
+        case LEVEL_OP_PUSH:
+            if (ids[op->id] >= 0) {
+                points[ids[op->id]].oldX = points[ids[op->id]].x - op->v[0];
+                points[ids[op->id]].oldY = points[ids[op->id]].y - op->v[1];
             }
-            return 1;
+            break;
         }
     }
+}
+
+// Times text compilation against cache loads for each mission file
+int RunMissionBenchmark() {
+    const int runs = 2000;
+    headlessMode = 1;
+    if (!LoadMissions()) return 1;
+    if (builtinMissions) {
+        printf("No mission files in %s/\n", MISSION_DIR);
+        return 1;
+    }
+
+    printf("Mission   ops   text(us)   cached(us)   spawn(us)\n");
+    for (int n = 1; n <= maxMissions; n++) {
+        char path[260];
+        sprintf_s(path, 260, "%s/mission%d.lvl", MISSION_DIR, n);
+        char error[160];
+        MissionDef def;
+
+        // Read and compile, what a load without the cache costs
+        long long start = GetTimeNs();
+        for (int i = 0; i < runs; i++) {
+            size_t size;
+            char* text = ReadWholeFile(path, &size);
+            CompileLevel(text, size, &def, error, 160);
+            free(text);
+        }
+        long long compileNs = (GetTimeNs() - start) / runs;
+
+        int fromCache = 0;
+        start = GetTimeNs();
+        for (int i = 0; i < runs; i++) LoadLevel(path, &def, &fromCache, error, 160);
+        long long cachedNs = (GetTimeNs() - start) / runs;
 
+        currentMode = 2;
+        start = GetTimeNs();
+        for (int i = 0; i < runs; i++) InitMission(n);
+        long long spawnNs = (GetTimeNs() - start) / runs;
+
+        printf("%7d %5d %10.2f %12.2f %11.2f%s\n", n, def.info.opCount,
+            compileNs / 1e3, cachedNs / 1e3, spawnNs / 1e3, fromCache ? "" : "  (cache not written)");
+    }
     return 0;
 }
 
-void ClearWorld() {
-    pointCount = 0;
-    stickCount = 0;
-    boxCount = 0;
-    targetCount = 0;
-    dragPoint = -1;
-    ropeStartX = -1;
-    ropeStartY = -1;
-    ragdollBroken = 0;
-    hangmanModeActive = 0;
-    undoCount = 0;
-    currentUndoIndex = 0;
-
-    for (int i = 0; i < MAX_PARTICLES; i++) particles[i].active = 0;
+// Builds each mission from its file and from the built-in code and
+// compares the resulting worlds, before and after a few physics steps
+int VerifyMissions() {
+    headlessMode = 1;
+    if (!LoadMissions()) return 1;
+    if (builtinMissions) {
+        printf("No mission files in %s/\n", MISSION_DIR);
+        return 1;
+    }
+
+    int failures = 0;
+    currentMode = 2;
+    for (int n = 1; n <= 5 && n <= maxMissions; n++) {
+        unsigned long long hashes[2][2];
+        for (int pass = 0; pass < 2; pass++) {
+            builtinMissions = pass;
+            simRandState = 12345;
+            currentMission = n;
+            InitMission(n);
+            hashes[pass][0] = WorldHash();
+            for (int step = 0; step < 120; step++) UpdatePhysics();
+            hashes[pass][1] = WorldHash();
+        }
+        int same = hashes[0][0] == hashes[1][0] && hashes[0][1] == hashes[1][1];
+        printf("Mission %d: file %016llx built-in %016llx %s\n", n, hashes[0][1], hashes[1][1],
+            same ? "identical" : "DIFFERENT");
+        if (!same) failures++;
+    }
+    builtinMissions = 0;
+    return failures ? 1 : 0;
 }
 
 //---------------------------------------------------------------------
@@ -1826,41 +6409,14 @@ void ClearWorld() {
 
 void DrawMissionStartScreen(HANDLE hOut, int missionNum) {
     for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        screenBuf[i] = ' ';
-        colorBuf[i] = COLOR_WHITE;
+        drawTarget->chars[i] = ' ';
+        drawTarget->colors[i] = COLOR_WHITE;
     }
 
-    char missionTitle[100];
-    char missionDesc[200];
-    char missionHint[200];
-
-    switch (missionNum) {
-    case 1:
-        strcpy_s(missionTitle, "MISSION 1: TRAINING GROUNDS");
-        strcpy_s(missionDesc, "Navigate the simple course. Use SPACE to play/pause, D to drag.");
-        strcpy_s(missionHint, "HINT: Drag the stickman's head to move it around.");
-        break;
-    case 2:
-        strcpy_s(missionTitle, "MISSION 2: THE MAZE");
-        strcpy_s(missionDesc, "Find your way through the maze to reach the target.");
-        strcpy_s(missionHint, "HINT: Use bombs strategically to clear paths.");
-        break;
-    case 3:
-        strcpy_s(missionTitle, "MISSION 3: OBSTACLE COURSE");
-        strcpy_s(missionDesc, "Navigate through moving platforms and obstacles.");
-        strcpy_s(missionHint, "HINT: Time your movements with platform swings.");
-        break;
-    case 4:
-        strcpy_s(missionTitle, "MISSION 4: PINBALL CHALLENGE");
-        strcpy_s(missionDesc, "Use bumpers and flippers to reach the top target.");
-        strcpy_s(missionHint, "HINT: Create momentum with bombs and ropes.");
-        break;
-    case 5:
-        strcpy_s(missionTitle, "MISSION 5: FINAL BOSS");
-        strcpy_s(missionDesc, "The ultimate challenge! Multiple stages to complete.");
-        strcpy_s(missionHint, "HINT: You'll need all your skills for this one!");
-        break;
-    }
+    const MissionInfo* info = &missionDefs[missionNum - 1].info;
+    const char* missionTitle = info->title;
+    const char* missionDesc = info->desc;
+    const char* missionHint = info->hint;
 
     int y = HEIGHT / 2 - 5;
     int len = strlen(missionTitle);
@@ -1876,7 +6432,7 @@ void DrawMissionStartScreen(HANDLE hOut, int missionNum) {
     for (int i = 0; i < len; i++) PutChar(startX + i, y + 4, missionHint[i], COLOR_GREEN);
 
     char reward[100];
-    sprintf_s(reward, "REWARD: %d COINS", missionNum * 50);
+    sprintf_s(reward, "REWARD: %d COINS", info->reward);
     len = strlen(reward);
     startX = (WIDTH - len) / 2;
     for (int i = 0; i < len; i++) PutChar(startX + i, y + 6, reward[i], COLOR_BRIGHT_MAGENTA);
@@ -1886,15 +6442,7 @@ void DrawMissionStartScreen(HANDLE hOut, int missionNum) {
     startX = (WIDTH - len) / 2;
     for (int i = 0; i < len; i++) PutChar(startX + i, y + 8, pressKey[i], COLOR_WHITE);
 
-    CHAR_INFO buffer[WIDTH * HEIGHT];
-    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        buffer[i].Char.UnicodeChar = (WCHAR)screenBuf[i];
-        buffer[i].Attributes = colorBuf[i];
-    }
-    COORD bufferSize = { (short)WIDTH, (short)HEIGHT };
-    COORD bufferCoord = { 0, 0 };
-    SMALL_RECT writeRegion = { 0, 0, (short)(WIDTH - 1), (short)(HEIGHT - 1) };
-    WriteConsoleOutput(hOut, buffer, bufferSize, bufferCoord, &writeRegion);
+    PresentScreen(hOut);
 }
 
 void InitMission(int missionNum) {
@@ -1910,6 +6458,19 @@ void InitMission(int missionNum) {
         targets[i].ragdollTouching = 0;
     }
 
+    if (builtinMissions) {
+        InitBuiltinMission(missionNum);
+        return;
+    }
+
+    const MissionDef* def = &missionDefs[missionNum - 1];
+    missionTimeLimit = def->info.timeLimit;
+    SpawnLevel(def);
+}
+
+
+// Original hardcoded missions, used when no mission files are present
+void InitBuiltinMission(int missionNum) {
     // NEW AND IMPROVED MISSIONS
     if (missionNum == 1) {
         // Mission 1: Basic Training - Simple ramp to target
@@ -2044,31 +6605,114 @@ void InitMission(int missionNum) {
     }
 }
 
-void UpdateMissionWithStats(float deltaTime) {
-    if (missionComplete == 1 || missionFailed == 1) return;
+// Collects every pickup within reach of a ragdoll part. A frame's pickups
+// make one stat update, one sound and one save request.
+void CollectPickups() {
+    static int live[MAX_POINTS];
+    int found[64];
+
+    UpdatePointIndex();
+    if (pointIndex.pickupCount == 0 || pointIndex.ragdollPartCount == 0) return;
+
+    int liveCount = 0;
+    for (int i = 0; i < pointIndex.pickupCount; i++) {
+        if (points[pointIndex.pickups[i]].isActive) live[liveCount++] = pointIndex.pickups[i];
+    }
+    if (liveCount == 0) return;
+    BuildGrid(&pickupGrid, points, live, liveCount, PICKUP_RADIUS);
+
+    int earned = 0;
+    for (int r = 0; r < pointIndex.ragdollPartCount; r++) {
+        const Point* part = &points[pointIndex.ragdollParts[r]];
+        if (!part->isActive) continue;
+
+        int n = QueryGrid(&pickupGrid, points, part->x, part->y, PICKUP_RADIUS, found, 64);
+        for (int k = 0; k < n; k++) {
+            Point* item = &points[found[k]];
+            if (!item->isActive) continue;
+            item->isActive = 0;
+            earned += pickupValues[item->pickup];
+            SpawnCoinParticles(item->x, item->y);
+        }
+    }
 
-    missionTimer = missionTimer + deltaTime;
+    if (earned > 0) {
+        gameStats.coins += earned;
+        PlaySoundCoin();
+        MarkProfileDirty();
+    }
+}
 
-    // Check for coin collection
-    for (int i = 0; i < pointCount; i++) {
-        if (points[i].isActive && points[i].symbol == '$') {
-            // Check if ragdoll touches coin
-            for (int j = 0; j < pointCount; j++) {
-                if (points[j].isRagdollPart && points[j].isActive) {
-                    float dist = GetDistance(points[i].x, points[i].y,
-                        points[j].x, points[j].y);
-                    if (dist < 3.0f) {
-                        points[i].isActive = 0;
-                        gameStats.coins += 10;
-                        SpawnCoinParticles(points[i].x, points[i].y);
-                        PlaySoundCoin();
-                        SaveGame();
+// Sweeps a ragdoll over a field of coins and times the indexed pickup
+// against the old all-points scan from the same starting world
+int RunPickupBenchmark(int coinTotal) {
+    const int frames = 600;
+    headlessMode = 1;
+    currentMode = 2;
+    if (coinTotal > MAX_POINTS - 16) coinTotal = MAX_POINTS - 16;
+
+    long long totalNs[2] = { 0, 0 };
+    int collected[2] = { 0, 0 };
+    for (int pass = 0; pass < 2; pass++) {
+        ClearWorld();
+        simRandState = 7;
+        SpawnRagdoll(4, 2);
+        for (int i = 0; i < coinTotal; i++) {
+            SpawnCoin(2 + SimRand() % (WIDTH - 4), GAME_AREA_TOP + SimRand() % (HEIGHT - 4));
+        }
+        int coinsBefore = gameStats.coins;
+
+        for (int f = 0; f < frames; f++) {
+            // Zigzag sweep, one screen row band per pass
+            int lane = f / 60;
+            float x = (lane % 2 == 0) ? 4.0f + (f % 60) * 1.9f : WIDTH - 4.0f - (f % 60) * 1.9f;
+            float y = 2.0f + lane * 2.0f;
+            float dx = x - points[0].x;
+            float dy = y - points[0].y;
+            for (int i = 0; i < pointCount; i++) {
+                if (!points[i].isRagdollPart) continue;
+                points[i].x += dx;
+                points[i].y += dy;
+                points[i].oldX = points[i].x;
+                points[i].oldY = points[i].y;
+            }
+
+            long long start = GetTimeNs();
+            if (pass == 1) {
+                CollectPickups();
+            }
+            else {
+                for (int i = 0; i < pointCount; i++) {
+                    if (!points[i].isActive || points[i].symbol != '$') continue;
+                    for (int j = 0; j < pointCount; j++) {
+                        if (!points[j].isRagdollPart || !points[j].isActive) continue;
+                        if (GetDistance(points[i].x, points[i].y, points[j].x, points[j].y) < 3.0f) {
+                            points[i].isActive = 0;
+                            gameStats.coins += 10;
+                            SpawnCoinParticles(points[i].x, points[i].y);
+                            break;
+                        }
                     }
                 }
             }
+            totalNs[pass] += GetTimeNs() - start;
         }
+        collected[pass] = (gameStats.coins - coinsBefore) / 10;
     }
 
+    printf("Pickups: %d coins, %d frames, %d points\n", coinTotal, frames, pointCount);
+    printf("  all-points scan: %8.2f us/frame, %d collected\n", totalNs[0] / 1e3 / frames, collected[0]);
+    printf("  indexed grid:    %8.2f us/frame, %d collected\n", totalNs[1] / 1e3 / frames, collected[1]);
+    return collected[0] == collected[1] ? 0 : 1;
+}
+
+void UpdateMissionWithStats(float deltaTime) {
+    if (missionComplete == 1 || missionFailed == 1) return;
+
+    missionTimer = missionTimer + deltaTime;
+
+    CollectPickups();
+
     if (CheckRagdollIntegrity() == 0) {
         ragdollBroken = 1;
         missionFailed = 1;
@@ -2082,6 +6726,7 @@ void UpdateMissionWithStats(float deltaTime) {
         return;
     }
 
+    UpdateTargetOccupancy();
     int totalTouched = 0;
     for (int i = 0; i < targetCount; i++) {
         if (targets[i].isActive == 0) continue;
@@ -2100,23 +6745,898 @@ void UpdateMissionWithStats(float deltaTime) {
         isSimulating = 0;
         gameStats.missionsCompleted++;
 
-        // Award coins based on mission number and time
-        int baseReward = currentMission * 50;
+        // Award coins based on mission reward and time
+        int baseReward = missionDefs[currentMission - 1].info.reward;
         int timeBonus = (int)((missionTimeLimit - missionTimer) * 2);
         int totalReward = baseReward + timeBonus;
 
         gameStats.coins += totalReward;
         PlaySoundSuccess();
-        SaveGame();
+        MarkProfileDirty();
+    }
+}
+
+// Mission play for one frame once the mission is running; shared by the
+// game loop and the solver so solved runs replay exactly
+void UpdateActiveMission(float deltaTime) {
+    if (IsKeyPressed(VK_SPACE)) {
+        isSimulating = (isSimulating == 1) ? 0 : 1;
+        PlaySoundClick();
+    }
+
+    if (IsKeyPressed('D')) {
+        dragMode = (dragMode == 1) ? 0 : 1;
+        dragPoint = -1;
+        PlaySoundDrag();
+    }
+
+    UpdateCursor();
+
+    if (IsKeyPressed(VK_RETURN) && dragMode == 1) {
+        int nearPoint = FindNearestPoint(curX + cameraX, curY, 5.0f);
+        if (nearPoint >= 0) {
+            if (points[nearPoint].isLocked == 1) {
+                points[nearPoint].isLocked = 0;
+                dragPoint = -1;
+            }
+            else {
+                points[nearPoint].isLocked = 1;
+                dragPoint = nearPoint;
+            }
+            PlaySoundClick();
+        }
+    }
+
+    if (dragPoint >= 0 && points[dragPoint].isLocked == 1) {
+        float targetX = (float)(curX + cameraX);
+        float targetY = (float)curY;
+        points[dragPoint].x = points[dragPoint].x + (targetX - points[dragPoint].x) * DRAG_SMOOTHNESS;
+        points[dragPoint].y = points[dragPoint].y + (targetY - points[dragPoint].y) * DRAG_SMOOTHNESS;
+        points[dragPoint].oldX = points[dragPoint].x;
+        points[dragPoint].oldY = points[dragPoint].y;
+        positionRevision++;
+    }
+
+    if (isSimulating == 1) {
+        for (int s = 0; s < simSteps; s++) StepWorld(1, deltaTime);
+    }
+}
+
+//---------------------------------------------------------------------
+// MISSION SOLVER
+//---------------------------------------------------------------------
+// --solve searches drag plans for every mission in order. Each mission is
+// split across one worker process per core (--solve-worker, same binary),
+// since the simulation lives in globals. A worker plays random plans and
+// mutations of its best one through UpdateActiveMission with scripted
+// keys. The parent replays the overall winner in process to carry the
+// cursor and RNG into the next mission, and writes the keys as a replay
+// that starts from the main menu.
+
+const int solverKeyCodes[SOLVER_KEY_COUNT] = { VK_LEFT, VK_RIGHT, VK_UP, VK_DOWN, VK_SHIFT, VK_RETURN, 'D' };
+
+unsigned int SolverRand(unsigned int* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Arrow keys toward a cursor cell; SHIFT when it cannot overshoot
+int SteerKeys(int x, int y) {
+    int dx = x - curX;
+    int dy = y - curY;
+    int keys = 0;
+    if (dx < 0) keys |= SOLVER_KEY_LEFT;
+    if (dx > 0) keys |= SOLVER_KEY_RIGHT;
+    if (dy < 0) keys |= SOLVER_KEY_UP;
+    if (dy > 0) keys |= SOLVER_KEY_DOWN;
+    int ax = abs(dx), ay = abs(dy);
+    if (keys && (ax == 0 || ax >= 2) && (ay == 0 || ay >= 2)) keys |= SOLVER_KEY_SHIFT;
+    return keys;
+}
+
+// A key that is already down has to come up before it can be pressed again
+int TapKey(int key, int prevKeys) {
+    return (prevKeys & key) ? 0 : key;
+}
+
+int ClampCursorX(int x) {
+    return x < 0 ? 0 : x >= WIDTH ? WIDTH - 1 : x;
+}
+
+int ClampCursorY(int y) {
+    return y < GAME_AREA_TOP ? GAME_AREA_TOP : y > HEIGHT - 3 ? HEIGHT - 3 : y;
+}
+
+// Keys to hold this frame: turn drag mode on, walk the cursor to the
+// plan's ragdoll part and grab it, drag it through the waypoints, then
+// optionally let go
+int PlanKeys(const SolverPlan* plan, SolverProgress* progress, int prevKeys) {
+    if (progress->phase == SOLVE_IDLE) return 0;
+    if (dragMode == 0) return TapKey(SOLVER_KEY_DRAG, prevKeys);
+
+    if (progress->phase == SOLVE_APPROACH) {
+        Entity* ragdoll = FirstRagdoll();
+        if (dragPoint >= 0) {
+            progress->phase = SOLVE_DRAG;
+            progress->waypoint = 0;
+            progress->holdLeft = plan->hold[0];
+        }
+        else if (!ragdoll || progress->tries > 10) {
+            progress->phase = SOLVE_IDLE;
+            return 0;
+        }
+        else {
+            const Point* part = &points[ragdoll->firstPoint + plan->part];
+            int x = ClampCursorX((int)floorf(part->x + 0.5f) - cameraX);
+            int y = ClampCursorY((int)floorf(part->y + 0.5f));
+            if (abs(x - curX) > 1 || abs(y - curY) > 1) return SteerKeys(x, y);
+            if (prevKeys & SOLVER_KEY_RETURN) return 0;
+            progress->tries++;
+            return SOLVER_KEY_RETURN;
+        }
+    }
+
+    // Dropped by a break or a stray grab: leave the rest to physics
+    if (dragPoint < 0) {
+        progress->phase = SOLVE_IDLE;
+        return 0;
+    }
+    while (progress->waypoint < plan->waypointCount) {
+        int x = plan->x[progress->waypoint];
+        int y = plan->y[progress->waypoint];
+        if (x != curX || y != curY) return SteerKeys(x, y);
+        if (progress->holdLeft > 0) {
+            progress->holdLeft--;
+            return 0;
+        }
+        progress->waypoint++;
+        if (progress->waypoint < plan->waypointCount) progress->holdLeft = plan->hold[progress->waypoint];
+    }
+    if (!plan->release) return 0;
+    if (prevKeys & SOLVER_KEY_RETURN) return 0;
+    progress->phase = SOLVE_IDLE;
+    return SOLVER_KEY_RETURN;
+}
+
+void SetScriptKeys(int keys) {
+    for (int k = 0; k < SOLVER_KEY_COUNT; k++) inputLog.replayKeys[solverKeyCodes[k]] = (keys >> k) & 1;
+}
+
+// Plays one plan from the start state; trace receives the held keys of
+// each frame. The mission start screen's Enter is still down at frame 0.
+int RunPlan(const SolverPlan* plan, const SolverStart* start, int missionNum, unsigned char* trace, float* time) {
+    curX = start->curX;
+    curY = start->curY;
+    dragMode = start->dragMode;
+    simRandState = start->rng;
+    currentMode = 2;
+    currentMission = missionNum;
+    InitMission(missionNum);
+    if (start->jitter > 0) JitterPoints(start->jitter);
+
+    // Enter is still down from the start screen, pressed one frame ago;
+    // earlier presses are too old to matter for the debounce
+    inputLog.mode = INPUT_LOG_SCRIPT;
+    for (int i = 0; i < 256; i++) inputLog.replayKeys[i] = 0;
+    InitInputManager();
+    inputManager.keys[VK_RETURN] = 1;
+    inputManager.lastKeyTime[VK_RETURN] = inputManager.now;
+
+    SolverProgress progress = { SOLVE_APPROACH, 0, 0, 0 };
+    int prevKeys = SOLVER_KEY_RETURN;
+    int frames = 0;
+    while (!missionComplete && !missionFailed && frames < SOLVER_MAX_FRAMES) {
+        int keys = PlanKeys(plan, &progress, prevKeys);
+        SetScriptKeys(keys);
+        UpdateInputManager(SOLVER_FRAME_MS);
+        UpdateActiveMission(SOLVER_FRAME_MS / 1000.0f);
+        trace[frames++] = (unsigned char)keys;
+        prevKeys = keys;
+    }
+    inputLog.mode = INPUT_LOG_OFF;
+
+    *time = missionTimer;
+    return frames;
+}
+
+void RandomWaypoint(SolverPlan* plan, int w, unsigned int* rng) {
+    if (targetCount > 0 && SolverRand(rng) % 2) {
+        const Target* t = &targets[SolverRand(rng) % targetCount];
+        plan->x[w] = ClampCursorX((int)t->x - cameraX + (int)(SolverRand(rng) % 11) - 5);
+        plan->y[w] = ClampCursorY((int)t->y + (int)(SolverRand(rng) % 11) - 5);
+    }
+    else {
+        plan->x[w] = ClampCursorX(SolverRand(rng) % WIDTH);
+        plan->y[w] = ClampCursorY(GAME_AREA_TOP + SolverRand(rng) % (HEIGHT - 2 - GAME_AREA_TOP));
+    }
+    plan->hold[w] = SolverRand(rng) % 30;
+}
+
+// Waypoints aim at the targets half of the time; call after InitMission
+void RandomPlan(SolverPlan* plan, unsigned int* rng) {
+    plan->part = SolverRand(rng) % RAGDOLL_PARTS;
+    plan->waypointCount = 1 + SolverRand(rng) % SOLVER_WAYPOINTS;
+    for (int w = 0; w < SOLVER_WAYPOINTS; w++) RandomWaypoint(plan, w, rng);
+    plan->release = SolverRand(rng) % 2;
+}
+
+void MutatePlan(SolverPlan* plan, unsigned int* rng) {
+    int w = SolverRand(rng) % plan->waypointCount;
+    switch (SolverRand(rng) % 6) {
+    case 0: plan->part = SolverRand(rng) % RAGDOLL_PARTS; break;
+    case 1: plan->waypointCount = 1 + SolverRand(rng) % SOLVER_WAYPOINTS; break;
+    case 2: plan->release = !plan->release; break;
+    case 3: RandomWaypoint(plan, w, rng); break;
+    default:
+        plan->x[w] = ClampCursorX(plan->x[w] + (int)(SolverRand(rng) % 7) - 3);
+        plan->y[w] = ClampCursorY(plan->y[w] + (int)(SolverRand(rng) % 7) - 3);
+        plan->hold[w] = abs(plan->hold[w] + (int)(SolverRand(rng) % 11) - 5);
+        break;
+    }
+}
+
+// Worker side of --solve. Prints one stats line and the best plan.
+int RunSolveWorker(int missionNum, unsigned int seed, int candidates, const SolverStart* start) {
+    static unsigned char trace[SOLVER_MAX_FRAMES];
+    headlessMode = 1;
+    InitShop();
+    if (!LoadMissions() || missionNum < 1 || missionNum > maxMissions) return 1;
+
+    unsigned int rng = seed ? seed : 1;
+    SolverPlan plan, best;
+    float bestTime = 0;
+    int haveBest = 0, solved = 0, randomTried = 0, randomSolved = 0;
+    long long steps = 0;
+
+    InitMission(missionNum);
+    for (int i = 0; i < candidates; i++) {
+        int mutated = haveBest && SolverRand(&rng) % 2;
+        if (mutated) {
+            plan = best;
+            MutatePlan(&plan, &rng);
+        }
+        else {
+            RandomPlan(&plan, &rng);
+        }
+
+        float time;
+        steps += RunPlan(&plan, start, missionNum, trace, &time);
+        int ok = missionComplete == 1;
+        solved += ok;
+        if (!mutated) {
+            randomTried++;
+            randomSolved += ok;
+        }
+        if (ok && (!haveBest || time < bestTime)) {
+            best = plan;
+            bestTime = time;
+            haveBest = 1;
+        }
+    }
+
+    printf("stats %d %d %d %d %lld\n", candidates, solved, randomTried, randomSolved, steps);
+    if (haveBest) {
+        printf("best %.4f %d %d %d", bestTime, best.part, best.waypointCount, best.release);
+        for (int w = 0; w < SOLVER_WAYPOINTS; w++) printf(" %d %d %d", best.x[w], best.y[w], best.hold[w]);
+        printf("\n");
+    }
+    return 0;
+}
+
+// Replay frame with the keys that differ from the previous frame
+void WriteSolverFrame(FILE* file, int keys, int* prevKeys, int* frameCount) {
+    unsigned char toggled[SOLVER_KEY_COUNT];
+    int count = 0;
+    for (int k = 0; k < SOLVER_KEY_COUNT; k++) {
+        if (((keys ^ *prevKeys) >> k) & 1) toggled[count++] = (unsigned char)solverKeyCodes[k];
+    }
+    fputc(REPLAY_TAG_FRAME, file);
+    WriteVarint(file, SOLVER_FRAME_MS);
+    fputc(count, file);
+    fwrite(toggled, 1, count, file);
+    *prevKeys = keys;
+    (*frameCount)++;
+}
+
+int RunSolver(const char* exe, int candidates, const char* replayPath) {
+    static unsigned char trace[SOLVER_MAX_FRAMES];
+    headlessMode = 1;
+    InitShop();
+    if (!LoadMissions()) return 1;
+
+    int workers = (int)std::thread::hardware_concurrency();
+    if (workers < 1) workers = 1;
+    if (workers > SOLVER_MAX_WORKERS) workers = SOLVER_MAX_WORKERS;
+    int perWorker = (candidates + workers - 1) / workers;
+
+    // The replay brings a fresh profile: no coins, classic head
+    FILE* file;
+    if (fopen_s(&file, replayPath, "wb") != 0 || !file) {
+        printf("Cannot write %s\n", replayPath);
+        return 1;
+    }
+    fwrite(REPLAY_MAGIC, 1, 4, file);
+    fputc(REPLAY_VERSION, file);
+    WriteU32(file, 0);
+    WriteU32(file, 0);
+    WriteU32(file, 0);
+    for (int i = 0; i < MAX_SHOP_ITEMS; i++) fputc(i == 0 ? 1 : 0, file);
+    fputc(REPLAY_TAG_SEED, file);
+    WriteU32(file, SOLVER_REPLAY_SEED);
+    gameStats.coins = 0;
+    currentHeadIndex = 0;
+
+    // Main menu: down to Missions, Enter
+    int keys = 0, frameCount = 0;
+    WriteSolverFrame(file, 0, &keys, &frameCount);
+    WriteSolverFrame(file, SOLVER_KEY_DOWN, &keys, &frameCount);
+    WriteSolverFrame(file, 0, &keys, &frameCount);
+    WriteSolverFrame(file, SOLVER_KEY_RETURN, &keys, &frameCount);
+    WriteSolverFrame(file, 0, &keys, &frameCount);
+    currentMode = 2;
+    currentMission = 1;
+
+    SolverStart start = { curX, curY, dragMode, SOLVER_REPLAY_SEED, 0.0f };
+    int unsolved = 0;
+    long long totalSteps = 0;
+    long long totalNs = 0;
+    printf("Solver: %d candidates per mission on %d workers\n", perWorker * workers, workers);
+
+    for (int m = 1; m <= maxMissions && !unsolved; m++) {
+        FILE* pipes[SOLVER_MAX_WORKERS];
+        long long startNs = GetTimeNs();
+        for (int w = 0; w < workers; w++) {
+            char command[1024];
+            sprintf_s(command, sizeof(command), "\"%s\" --solve-worker %d %u %d %d %d %d %u", exe, m,
+                (unsigned int)(m * 7919 + w * 104729 + 1), perWorker, start.curX, start.curY, start.dragMode, start.rng);
+            pipes[w] = popen(command, "r");
+        }
+
+        SolverPlan best;
+        float bestTime = 0;
+        int haveBest = 0, tried = 0, solved = 0, randomTried = 0, randomSolved = 0;
+        long long steps = 0;
+        for (int w = 0; w < workers; w++) {
+            if (!pipes[w]) continue;
+            char line[512];
+            while (fgets(line, sizeof(line), pipes[w])) {
+                int a, b, c, d;
+                long long s;
+                SolverPlan plan;
+                float time;
+                if (sscanf_s(line, "stats %d %d %d %d %lld", &a, &b, &c, &d, &s) == 5) {
+                    tried += a;
+                    solved += b;
+                    randomTried += c;
+                    randomSolved += d;
+                    steps += s;
+                }
+                else if (sscanf_s(line, "best %f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d", &time,
+                    &plan.part, &plan.waypointCount, &plan.release,
+                    &plan.x[0], &plan.y[0], &plan.hold[0], &plan.x[1], &plan.y[1], &plan.hold[1],
+                    &plan.x[2], &plan.y[2], &plan.hold[2], &plan.x[3], &plan.y[3], &plan.hold[3]) == 16) {
+                    if (!haveBest || time < bestTime) {
+                        best = plan;
+                        bestTime = time;
+                        haveBest = 1;
+                    }
+                }
+            }
+            pclose(pipes[w]);
+        }
+        long long ns = GetTimeNs() - startNs;
+        totalSteps += steps;
+        totalNs += ns;
+
+        printf("Mission %d: %d/%d plans solved (%.1f%%, random plans %.1f%%), ", m, solved, tried,
+            tried ? 100.0 * solved / tried : 0.0, randomTried ? 100.0 * randomSolved / randomTried : 0.0);
+        if (!haveBest) {
+            printf("no solution, %.0fk steps/s\n", ns > 0 ? steps * 1e6 / ns : 0.0);
+            unsolved = m;
+            break;
+        }
+
+        // Replay the winner here to check it and to carry its end state on
+        float time;
+        int frames = RunPlan(&best, &start, m, trace, &time);
+        if (!missionComplete) {
+            printf("best plan did not reproduce\n");
+            unsolved = m;
+            break;
+        }
+        printf("best %.2f s of %.0f s, %.0fk steps/s\n", time, missionTimeLimit, ns > 0 ? steps * 1e6 / ns : 0.0);
+
+        // Enter on the start screen, the run, then Enter past the result screen
+        WriteSolverFrame(file, SOLVER_KEY_RETURN, &keys, &frameCount);
+        for (int f = 0; f < frames; f++) WriteSolverFrame(file, trace[f], &keys, &frameCount);
+        WriteSolverFrame(file, 0, &keys, &frameCount);
+        WriteSolverFrame(file, SOLVER_KEY_RETURN, &keys, &frameCount);
+        WriteSolverFrame(file, 0, &keys, &frameCount);
+        currentMission = m + 1;
+        if (currentMission > maxMissions) {
+            currentMode = 0;
+            currentMission = 1;
+        }
+
+        start.curX = curX;
+        start.curY = curY;
+        start.dragMode = dragMode;
+        start.rng = simRandState;
+    }
+
+    unsigned long long hash = WorldHash();
+    fputc(REPLAY_TAG_END, file);
+    WriteU32(file, (unsigned int)frameCount);
+    WriteU32(file, (unsigned int)(hash & 0xFFFFFFFF));
+    WriteU32(file, (unsigned int)(hash >> 32));
+    fclose(file);
+
+    printf("Physics: %lld steps in %.2f s, %.0fk steps/s\n", totalSteps, totalNs / 1e9,
+        totalNs > 0 ? totalSteps * 1e6 / totalNs : 0.0);
+    printf("Replay: %s, %d frames, missions 1-%d\n", replayPath, frameCount, unsolved ? unsolved - 1 : maxMissions);
+    return unsolved ? 1 : 0;
+}
+
+//---------------------------------------------------------------------
+// MISSION BALANCING
+//---------------------------------------------------------------------
+// --balance plays every mission many times with random drag plans (the
+// kind the solver samples), each under its own simulation seed, cursor
+// start and a small offset on every free point. Worker processes print
+// one CSV row per run; the parent reads them round-robin, copies each row
+// to the CSV as it arrives and keeps only per-mission counters and a coin
+// histogram, so memory does not grow with the run count.
+
+const char* const balanceOutcomeNames[BALANCE_OUTCOME_COUNT] = { "complete", "broken", "timeout", "unfinished" };
+
+// Offsets every free point by up to +-amount cells without adding speed
+void JitterPoints(float amount) {
+    for (int i = 0; i < pointCount; i++) {
+        if (!points[i].isActive || points[i].isLocked) continue;
+        float dx = (SimRand() % 2001 - 1000) / 1000.0f * amount;
+        float dy = (SimRand() % 2001 - 1000) / 1000.0f * amount;
+        points[i].x += dx;
+        points[i].y += dy;
+        points[i].oldX += dx;
+        points[i].oldY += dy;
+    }
+    positionRevision++;
+}
+
+unsigned int BalanceSeed(int missionNum, int run) {
+    unsigned int h = 2166136261u;
+    h = (h ^ (unsigned int)missionNum) * 16777619u;
+    h = (h ^ (unsigned int)run) * 16777619u;
+    h ^= h >> 15;
+    return h ? h : 1;
+}
+
+// Worker side of --balance: runs [firstRun, firstRun + runs) of a mission
+int RunBalanceWorker(int missionNum, int firstRun, int runs) {
+    static unsigned char trace[SOLVER_MAX_FRAMES];
+    headlessMode = 1;
+    InitShop();
+    if (!LoadMissions() || missionNum < 1 || missionNum > maxMissions) return 1;
+
+    InitMission(missionNum);
+    for (int run = firstRun; run < firstRun + runs; run++) {
+        unsigned int seed = BalanceSeed(missionNum, run);
+        unsigned int rng = seed;
+        SolverPlan plan;
+        RandomPlan(&plan, &rng);
+        SolverStart start = { ClampCursorX(SolverRand(&rng) % WIDTH), ClampCursorY(SolverRand(&rng) % HEIGHT), 0, seed,
+            BALANCE_JITTER };
+
+        int coinsBefore = gameStats.coins;
+        float time;
+        RunPlan(&plan, &start, missionNum, trace, &time);
+        int outcome = missionComplete ? BALANCE_COMPLETE : ragdollBroken ? BALANCE_BROKEN :
+            missionFailed ? BALANCE_TIMEOUT : BALANCE_UNFINISHED;
+        printf("%d,%d,%u,%s,%.3f,%d,%d\n", missionNum, run, seed, balanceOutcomeNames[outcome], time,
+            gameStats.coins - coinsBefore, targetsReached);
+    }
+    return 0;
+}
+
+int CoinPercentile(const BalanceStats* stats, float fraction) {
+    int total = 0;
+    for (int b = 0; b < BALANCE_COIN_BUCKETS; b++) total += stats->coinHistogram[b];
+    int seen = 0;
+    for (int b = 0; b < BALANCE_COIN_BUCKETS; b++) {
+        seen += stats->coinHistogram[b];
+        if (seen > 0 && seen >= fraction * total) return b * BALANCE_COIN_BUCKET_SIZE;
+    }
+    return 0;
+}
+
+int RunBalance(const char* exe, int runs, const char* csvPath) {
+    headlessMode = 1;
+    InitShop();
+    if (!LoadMissions()) return 1;
+
+    FILE* csv;
+    if (fopen_s(&csv, csvPath, "w") != 0 || !csv) {
+        printf("Cannot write %s\n", csvPath);
+        return 1;
+    }
+    fputs("mission,run,seed,outcome,time,coins,targets\n", csv);
+
+    int workers = (int)std::thread::hardware_concurrency();
+    if (workers < 1) workers = 1;
+    if (workers > SOLVER_MAX_WORKERS) workers = SOLVER_MAX_WORKERS;
+    if (workers > runs) workers = runs;
+    printf("Balance: %d runs per mission on %d workers, points jittered by %.2f\n", runs, workers, BALANCE_JITTER);
+
+    long long startNs = GetTimeNs();
+    int totalRuns = 0;
+    for (int m = 1; m <= maxMissions; m++) {
+        FILE* pipes[SOLVER_MAX_WORKERS];
+        int open = 0;
+        for (int w = 0; w < workers; w++) {
+            int first = runs * w / workers;
+            int count = runs * (w + 1) / workers - first;
+            char command[1024];
+            sprintf_s(command, sizeof(command), "\"%s\" --balance-worker %d %d %d", exe, m, first, count);
+            pipes[w] = popen(command, "r");
+            if (pipes[w]) open++;
+        }
+
+        BalanceStats stats;
+        memset(&stats, 0, sizeof(stats));
+        while (open > 0) {
+            for (int w = 0; w < workers; w++) {
+                if (!pipes[w]) continue;
+                char line[256];
+                if (!fgets(line, sizeof(line), pipes[w])) {
+                    pclose(pipes[w]);
+                    pipes[w] = NULL;
+                    open--;
+                    continue;
+                }
+                fputs(line, csv);
+
+                // mission,run,seed,outcome,time,coins,targets
+                const char* field = line;
+                for (int f = 0; f < 3 && field; f++) {
+                    field = strchr(field, ',');
+                    if (field) field++;
+                }
+                int outcome = -1;
+                for (int o = 0; field && o < BALANCE_OUTCOME_COUNT; o++) {
+                    size_t len = strlen(balanceOutcomeNames[o]);
+                    if (strncmp(field, balanceOutcomeNames[o], len) == 0 && field[len] == ',') outcome = o;
+                }
+                float time;
+                int coins, reached;
+                if (outcome < 0 || sscanf_s(strchr(field, ',') + 1, "%f,%d,%d", &time, &coins, &reached) != 3) continue;
+
+                stats.outcomes[outcome]++;
+                if (outcome == BALANCE_COMPLETE) stats.completeTime += time;
+                int bucket = coins / BALANCE_COIN_BUCKET_SIZE;
+                if (bucket < 0) bucket = 0;
+                if (bucket >= BALANCE_COIN_BUCKETS) bucket = BALANCE_COIN_BUCKETS - 1;
+                stats.coinHistogram[bucket]++;
+                stats.coinTotal += coins;
+                stats.runs++;
+            }
+        }
+        fflush(csv);
+        totalRuns += stats.runs;
+
+        float n = stats.runs > 0 ? (float)stats.runs : 1.0f;
+        int completed = stats.outcomes[BALANCE_COMPLETE];
+        printf("Mission %d: %d runs, complete %.1f%%, broken %.1f%%, timeout %.1f%%, mean clear %.2f s\n", m, stats.runs,
+            100.0f * completed / n, 100.0f * stats.outcomes[BALANCE_BROKEN] / n,
+            100.0f * stats.outcomes[BALANCE_TIMEOUT] / n, completed ? stats.completeTime / completed : 0.0f);
+        printf("  coins: mean %.1f, p10 %d, p50 %d, p90 %d (buckets of %d)\n", stats.coinTotal / n,
+            CoinPercentile(&stats, 0.1f), CoinPercentile(&stats, 0.5f), CoinPercentile(&stats, 0.9f),
+            BALANCE_COIN_BUCKET_SIZE);
+    }
+    fclose(csv);
+
+    double seconds = (GetTimeNs() - startNs) / 1e9;
+    printf("Wrote %d runs to %s in %.2f s (%.0f runs/s)\n", totalRuns, csvPath, seconds,
+        seconds > 0 ? totalRuns / seconds : 0.0);
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// JOB SYSTEM
+//---------------------------------------------------------------------
+// A frame phase is a small graph of jobs with dependency counters. Each
+// worker owns a deque: it pushes and pops jobs that became ready at the
+// bottom, idle workers steal from the top of others. The calling thread
+// is worker 0 and runs jobs until its graph is done, so with no worker
+// threads a graph simply runs inline in dependency order.
+
+thread_local int jobWorkerIndex = 0;
+
+void ResetJobGraph(JobGraph* graph) {
+    graph->jobCount = 0;
+}
+
+int AddJob(JobGraph* graph, JobFunc func, void* data) {
+    Job* job = &graph->jobs[graph->jobCount];
+    job->func = func;
+    job->data = data;
+    job->graph = graph;
+    job->dependencyCount = 0;
+    job->dependentCount = 0;
+    return graph->jobCount++;
+}
+
+// after waits for before
+void AddDependency(JobGraph* graph, int before, int after) {
+    Job* job = &graph->jobs[before];
+    job->dependents[job->dependentCount++] = after;
+    graph->jobs[after].dependencyCount++;
+}
+
+void PushJob(int worker, Job* job) {
+    JobDeque* deque = &jobSystem.workers[worker].deque;
+    {
+        std::lock_guard<std::mutex> lock(deque->lock);
+        deque->items[deque->bottom % JOB_DEQUE_SIZE] = job;
+        deque->bottom++;
+    }
+    if (jobSystem.workerCount > 0) {
+        {
+            std::lock_guard<std::mutex> lock(jobSystem.sleepLock);
+            jobSystem.generation.fetch_add(1, std::memory_order_relaxed);
+        }
+        jobSystem.wake.notify_one();
+    }
+}
+
+// Owner end: newest first, while its data is still in cache
+Job* PopJob(int worker) {
+    JobDeque* deque = &jobSystem.workers[worker].deque;
+    std::lock_guard<std::mutex> lock(deque->lock);
+    if (deque->bottom == deque->top) return NULL;
+    deque->bottom--;
+    return deque->items[deque->bottom % JOB_DEQUE_SIZE];
+}
+
+// Thief end: oldest first
+Job* StealJob(int thief) {
+    int total = jobSystem.workerCount + 1;
+    for (int n = 1; n < total; n++) {
+        JobDeque* deque = &jobSystem.workers[(thief + n) % total].deque;
+        std::lock_guard<std::mutex> lock(deque->lock);
+        if (deque->bottom == deque->top) continue;
+        Job* job = deque->items[deque->top % JOB_DEQUE_SIZE];
+        deque->top++;
+        jobSystem.workers[thief].steals.fetch_add(1, std::memory_order_relaxed);
+        return job;
+    }
+    return NULL;
+}
+
+void ExecuteJob(int worker, Job* job) {
+    JobWorker* self = &jobSystem.workers[worker];
+    long long start = GetTimeNs();
+    job->func(job->data);
+    self->busyNs.fetch_add(GetTimeNs() - start, std::memory_order_relaxed);
+    self->jobsRun.fetch_add(1, std::memory_order_relaxed);
+
+    JobGraph* graph = job->graph;
+    for (int d = 0; d < job->dependentCount; d++) {
+        Job* next = &graph->jobs[job->dependents[d]];
+        if (next->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) PushJob(worker, next);
+    }
+    graph->remaining.fetch_sub(1, std::memory_order_release);
+}
+
+void JobWorkerLoop(int worker) {
+    jobWorkerIndex = worker;
+    while (!jobSystem.stop.load()) {
+        // Read before looking: a job pushed after this changes the
+        // generation, so the wait below cannot miss it
+        int seen = jobSystem.generation.load(std::memory_order_acquire);
+        Job* job = PopJob(worker);
+        if (!job) job = StealJob(worker);
+        if (job) {
+            ExecuteJob(worker, job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(jobSystem.sleepLock);
+        while (!jobSystem.stop.load() && jobSystem.generation.load(std::memory_order_relaxed) == seen) {
+            jobSystem.wake.wait(lock);
+        }
+    }
+    ClosePerfCounters();
+}
+
+// Runs the graph to completion; the caller works on it too
+void RunJobGraph(JobGraph* graph) {
+    int self = jobWorkerIndex;
+    graph->remaining.store(graph->jobCount);
+    for (int j = 0; j < graph->jobCount; j++) graph->jobs[j].pending.store(graph->jobs[j].dependencyCount);
+    for (int j = 0; j < graph->jobCount; j++) {
+        if (graph->jobs[j].dependencyCount == 0) PushJob(self, &graph->jobs[j]);
+    }
+
+    while (graph->remaining.load(std::memory_order_acquire) > 0) {
+        Job* job = PopJob(self);
+        if (!job) job = StealJob(self);
+        if (job) ExecuteJob(self, job);
+        else std::this_thread::yield();
+    }
+}
+
+void StartJobSystem(int threads) {
+    if (threads > MAX_JOB_WORKERS) threads = MAX_JOB_WORKERS;
+    if (threads < 0) threads = 0;
+    jobSystem.stop.store(0);
+    jobSystem.workerCount = threads;
+    jobSystem.startNs = GetTimeNs();
+    for (int w = 0; w <= threads; w++) {
+        jobSystem.workers[w].busyNs.store(0);
+        jobSystem.workers[w].jobsRun.store(0);
+        jobSystem.workers[w].steals.store(0);
+    }
+    for (int w = 1; w <= threads; w++) jobSystem.workers[w].thread = std::thread(JobWorkerLoop, w);
+}
+
+void StopJobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(jobSystem.sleepLock);
+        jobSystem.stop.store(1);
+    }
+    jobSystem.wake.notify_all();
+    for (int w = 1; w <= jobSystem.workerCount; w++) {
+        if (jobSystem.workers[w].thread.joinable()) jobSystem.workers[w].thread.join();
+    }
+    jobSystem.workerCount = 0;
+}
+
+// Busy share of wall time since start, per worker; worker 0 is the game thread
+void FormatJobUtilization(char* out, int size) {
+    long long wall = GetTimeNs() - jobSystem.startNs;
+    int len = sprintf_s(out, size, "%d+1 threads, busy", jobSystem.workerCount);
+    long long steals = 0;
+    for (int w = 0; w <= jobSystem.workerCount && len < size; w++) {
+        len += sprintf_s(out + len, size - len, " %.0f%%", wall > 0 ? 100.0 * jobSystem.workers[w].busyNs.load() / wall : 0.0);
+        steals += jobSystem.workers[w].steals.load();
+    }
+    if (len < size) sprintf_s(out + len, size - len, ", %lld steals", steals);
+}
+
+// Steps a busy sandbox scene serially, then on the job system, and checks
+// both end in the same world
+int RunJobBenchmark(int frames) {
+    long long ns[2];
+    unsigned long long hash[2];
+    char report[160] = "";
+    int threads = jobThreads >= 0 ? jobThreads : (int)std::thread::hardware_concurrency() - 1;
+
+    for (int pass = 0; pass < 2; pass++) {
+        headlessMode = 1;
+        ClearWorld();
+        for (int i = 0; i < MAX_PARTICLES; i++) particles[i].active = 0;
+        simRandState = 1;
+        for (int r = 0; r < 12; r++) SpawnRagdoll(8 + r * 9, 6 + (r % 3) * 4);
+        for (int r = 0; r < 6; r++) SpawnRope(10 + r * 18, 2, 16 + r * 18, 12);
+        SpawnPlatform(WIDTH / 2, HEIGHT - 8, 40);
+
+        if (pass == 1) StartJobSystem(threads);
+        long long start = GetTimeNs();
+        for (int f = 0; f < frames; f++) {
+            if (f % 15 == 0) SpawnBomb(6 + (f * 7) % (WIDTH - 12), 3);
+            UpdatePhysics();
+        }
+        ns[pass] = GetTimeNs() - start;
+        hash[pass] = WorldHash();
+        if (pass == 1) {
+            FormatJobUtilization(report, sizeof(report));
+            StopJobSystem();
+        }
     }
+
+    printf("Jobs: %d frames, %d points, %d sticks\n", frames, pointCount, stickCount);
+    printf("  serial:      %8.2f us/frame\n", ns[0] / 1e3 / frames);
+    printf("  job graph:   %8.2f us/frame (%s)\n", ns[1] / 1e3 / frames, report);
+    printf("  world hash %016llx / %016llx: %s\n", hash[0], hash[1], hash[0] == hash[1] ? "same" : "DIFFERENT");
+    return hash[0] == hash[1] ? 0 : 1;
 }
 
 //---------------------------------------------------------------------
 // PHYSICS SIMULATION
 //---------------------------------------------------------------------
 
-void UpdatePhysics() {
+// Particles only touch their own array, so they update alongside the
+// solver. Spawns the solver makes meanwhile are staged with their random
+// draws taken in the usual order, then placed after both jobs finish;
+// the budget is the number of slots the particle update leaves free, so
+// the result is the same as running the two one after the other.
+void StageParticle(float x, float y, int color, char symbol, float speed) {
+    if (particleStage.count >= particleStage.budget) {
+        CountMetric(METRIC_PARTICLES_DROPPED, 1);
+        return;
+    }
+    Particle* p = &particleStage.items[particleStage.count++];
+    p->active = 1;
+    p->x = x;
+    p->y = y;
+    float angle = (SimRand() % 360) * 3.14159f / 180.0f;
+    float force = (SimRand() % 100 / 100.0f) * speed;
+    p->vx = cosf(angle) * force;
+    p->vy = sinf(angle) * force;
+    p->life = 20 + SimRand() % 20;
+    p->maxLife = p->life;
+    p->color = color;
+    p->symbol = symbol;
+}
+
+void ParticlesJob(void*) {
+    PerfSample sample;
+    BeginPhaseCounters(&sample);
     UpdateParticles();
+    EndPhaseCounters(PHASE_PARTICLES, &sample, pointCount);
+}
+
+void SolverJob(void*) {
+    PerfSample sample;
+    BeginPhaseCounters(&sample);
+    SolveWorld();
+    EndPhaseCounters(PHASE_SOLVER, &sample, pointCount);
+}
+
+void PlaceStagedParticlesJob(void*) {
+    particleStage.active = 0;
+    int slot = 0;
+    int placed = 0;
+    for (; placed < particleStage.count; placed++) {
+        while (slot < MAX_PARTICLES && particles[slot].active) slot++;
+        if (slot == MAX_PARTICLES) break;
+        particles[slot] = particleStage.items[placed];
+    }
+    CountMetric(METRIC_PARTICLE_SPAWNS, placed);
+    CountMetric(METRIC_PARTICLES_DROPPED, particleStage.count - placed);
+}
+
+void MissionChecksJob(void* data) {
+    UpdateMissionWithStats(*(float*)data);
+}
+
+// One simulation step:
+//   particles --+
+//               +--> place staged spawns --> mission checks (missions only)
+//   solver -----+
+void StepWorld(int missionChecks, float deltaTime) {
+    static JobGraph graph;
+    long long stepStart = GetTimeNs();
+    positionRevision++;
+
+    particleStage.count = 0;
+    particleStage.budget = 0;
+    for (int i = 0; i < MAX_PARTICLES; i++) {
+        if (!particles[i].active || particles[i].life <= 1) particleStage.budget++;
+    }
+    particleStage.active = 1;
+
+    ResetJobGraph(&graph);
+    int particlesJob = AddJob(&graph, ParticlesJob, NULL);
+    int solverJob = AddJob(&graph, SolverJob, NULL);
+    int placeJob = AddJob(&graph, PlaceStagedParticlesJob, NULL);
+    AddDependency(&graph, particlesJob, placeJob);
+    AddDependency(&graph, solverJob, placeJob);
+    if (missionChecks) AddDependency(&graph, placeJob, AddJob(&graph, MissionChecksJob, &deltaTime));
+    RunJobGraph(&graph);
+    long long stepNs = GetTimeNs() - stepStart;
+    RecordTime(&simTimes, stepNs);
+    ObserveMetric(METRIC_STEP_SECONDS, stepNs);
+    CountMetric(METRIC_STEPS, 1);
+}
+
+void UpdatePhysics() {
+    StepWorld(0, 0.0f);
+}
+
+// Everything in a step except the particles
+void SolveWorld() {
     if (screenShake > 0) {
         screenShake -= SHAKE_DECAY;
         if (screenShake < 0) screenShake = 0;
@@ -2142,6 +7662,7 @@ void UpdatePhysics() {
     }
 
     // Verlet integration
+    UpdateEntityIndex();
     for (int i = 0; i < pointCount; i++) {
         if (points[i].isActive == 0) continue;
         if (points[i].isLocked == 1) continue;
@@ -2161,7 +7682,7 @@ void UpdatePhysics() {
             points[i].oldY = points[i].y + velY * BOUNCE;
             points[i].oldX = points[i].x - velX * 0.8f;
 
-            if (points[i].symbol == '@') {
+            if (pointEntity[i] >= 0 && entities[pointEntity[i]].kind == ENTITY_BOMB) {
                 Explode((int)points[i].x, (int)points[i].y);
                 points[i].isActive = 0;
             }
@@ -2172,8 +7693,8 @@ void UpdatePhysics() {
             points[i].oldX = points[i].x + velX * BOUNCE;
         }
 
-        if (points[i].x > WIDTH - 1 - points[i].radius) {
-            points[i].x = WIDTH - 1 - points[i].radius;
+        if (points[i].x > worldWidth - 1 - points[i].radius) {
+            points[i].x = worldWidth - 1 - points[i].radius;
             points[i].oldX = points[i].x + velX * BOUNCE;
         }
 
@@ -2186,130 +7707,1017 @@ void UpdatePhysics() {
     ResolveBoxCollisions();
 
     // Track stick breaks for feedback
-    int sticksBeforeUpdate = 0;
-    for (int i = 0; i < stickCount; i++) {
-        if (sticks[i].active) sticksBeforeUpdate++;
-    }
+    int breaksBefore = stickBreakCount;
 
     // Constraint solving
     for (int iteration = 0; iteration < CONSTRAINT_ITERATIONS; iteration++) {
         for (int s = 0; s < stickCount; s++) {
             if (sticks[s].active == 0) continue;
 
-            int p1 = sticks[s].p1;
-            int p2 = sticks[s].p2;
+            int p1 = sticks[s].p1;
+            int p2 = sticks[s].p2;
+
+            if (points[p1].isActive == 0) continue;
+            if (points[p2].isActive == 0) continue;
+
+            float dx = points[p2].x - points[p1].x;
+            float dy = points[p2].y - points[p1].y;
+            float distance = sqrtf(dx * dx + dy * dy);
+
+            if (distance < 0.001f) continue;
+
+            if (distance > sticks[s].length * STICK_BREAK_FACTOR) {
+                BreakStick(s);
+                SpawnBreakParticles((points[p1].x + points[p2].x) / 2, (points[p1].y + points[p2].y) / 2);
+                continue;
+            }
+
+            float difference = (sticks[s].length - distance) / distance;
+            float offsetX = dx * difference * 0.5f;
+            float offsetY = dy * difference * 0.5f;
+
+            if (points[p1].isLocked == 0) {
+                points[p1].x = points[p1].x - offsetX;
+                points[p1].y = points[p1].y - offsetY;
+            }
+            if (points[p2].isLocked == 0) {
+                points[p2].x = points[p2].x + offsetX;
+                points[p2].y = points[p2].y + offsetY;
+            }
+        }
+
+        ResolveBoxCollisions();
+    }
+
+    // After constraint solving, check for new breaks
+    if (stickBreakCount > breaksBefore) {
+        PlaySoundBreak();
+        gameStats.sticksBreached++;
+        if (screenShake < 2.0f) screenShake += 0.5f;
+    }
+
+    // Point-to-point collision
+    for (int i = 0; i < pointCount; i++) {
+        for (int j = i + 1; j < pointCount; j++) {
+            if (points[i].isActive == 0) continue;
+            if (points[j].isActive == 0) continue;
+
+            float dx = points[i].x - points[j].x;
+            float dy = points[i].y - points[j].y;
+            float distance = sqrtf(dx * dx + dy * dy);
+            float minDistance = points[i].radius + points[j].radius;
+
+            if (distance < minDistance && distance > 0.001f) {
+                float overlap = minDistance - distance;
+                float pushX = (dx / distance) * overlap * 0.5f;
+                float pushY = (dy / distance) * overlap * 0.5f;
+
+                if (points[i].isLocked == 0) {
+                    points[i].x = points[i].x + pushX;
+                    points[i].y = points[i].y + pushY;
+                }
+                if (points[j].isLocked == 0) {
+                    points[j].x = points[j].x - pushX;
+                    points[j].y = points[j].y - pushY;
+                }
+            }
+        }
+    }
+
+    UpdateEntityBounds();
+}
+
+//---------------------------------------------------------------------
+// SCREEN OUTPUT AND SESSION CAPTURE
+//---------------------------------------------------------------------
+
+long long GetTimeNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Single exit point for every composed frame. Screens drawn on the game
+// thread wait for the render thread so frames never interleave.
+void PresentScreen(HANDLE hOut) {
+    if (drawTarget == &mainTarget) WaitFramePipeline();
+
+    // Damage tracking: write only the band of rows that changed
+    int top = HEIGHT, bottom = -1;
+    for (int y = 0; y < HEIGHT; y++) {
+        int row = y * WIDTH;
+        if (memcmp(&drawTarget->chars[row], &presentedTarget.chars[row], WIDTH) == 0 &&
+            memcmp(&drawTarget->colors[row], &presentedTarget.colors[row], WIDTH * sizeof(int)) == 0) continue;
+        if (top == HEIGHT) top = y;
+        bottom = y;
+    }
+    if (bottom < 0) {
+        rowsSkipped += HEIGHT;
+        return;
+    }
+
+    CHAR_INFO buffer[WIDTH * HEIGHT];
+    for (int i = top * WIDTH; i < (bottom + 1) * WIDTH; i++) {
+        buffer[i].Char.UnicodeChar = (WCHAR)drawTarget->chars[i];
+        buffer[i].Attributes = drawTarget->colors[i];
+        presentedTarget.chars[i] = drawTarget->chars[i];
+        presentedTarget.colors[i] = drawTarget->colors[i];
+    }
+    COORD bufferSize = { (short)WIDTH, (short)HEIGHT };
+    COORD bufferCoord = { 0, (short)top };
+    SMALL_RECT writeRegion = { 0, (short)top, (short)(WIDTH - 1), (short)bottom };
+    WriteConsoleOutput(hOut, buffer, bufferSize, bufferCoord, &writeRegion);
+    rowsWritten += bottom - top + 1;
+    rowsSkipped += HEIGHT - (bottom - top + 1);
+
+    if (castRecorder.file) CaptureCastFrame();
+}
+
+void CastWriterThread() {
+    CastRecorder* rec = &castRecorder;
+
+    while (1) {
+        int tail = rec->tail.load(std::memory_order_relaxed);
+        if (tail == rec->head.load(std::memory_order_acquire)) {
+            if (rec->stop.load()) break;
+            std::unique_lock<std::mutex> guard(rec->wakeLock);
+            rec->wake.wait_for(guard, std::chrono::milliseconds(50));
+            continue;
+        }
+
+        int slot = tail % CAST_SLOTS;
+        fwrite(rec->slots[slot], 1, rec->slotSize[slot], rec->file);
+        rec->bytesWritten += rec->slotSize[slot];
+        rec->tail.store(tail + 1, std::memory_order_release);
+    }
+
+    fflush(rec->file);
+}
+
+int StartCastRecording(const char* path) {
+    CastRecorder* rec = &castRecorder;
+    FILE* file;
+    if (fopen_s(&file, path, "wb") != 0 || !file) return 0;
+
+    int headerBytes = fprintf(file,
+        "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld, "
+        "\"title\": \"ASCII Physics Game\", \"env\": {\"TERM\": \"xterm-256color\"}}\n",
+        WIDTH, HEIGHT, (long long)time(NULL));
+
+    // Nothing has been drawn yet, so the first frame diffs every cell
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        rec->prevChars[i] = 0;
+        rec->prevColors[i] = -1;
+    }
+    rec->termColor = -1;
+    rec->head = 0;
+    rec->tail = 0;
+    rec->stop = 0;
+    rec->startNs = GetTimeNs();
+    rec->captureNs = 0;
+    rec->framesCaptured = 0;
+    rec->framesDropped = 0;
+    rec->bytesWritten = headerBytes;
+    rec->file = file;
+    rec->writer = std::thread(CastWriterThread);
+    return 1;
+}
+
+// Encodes the cells that changed since the last queued frame as one
+// asciicast "o" event: cursor moves, SGR colors and the new glyphs.
+void CaptureCastFrame() {
+    CastRecorder* rec = &castRecorder;
+    long long start = GetTimeNs();
+
+    int head = rec->head.load(std::memory_order_relaxed);
+    if (head - rec->tail.load(std::memory_order_acquire) >= CAST_SLOTS) {
+        // Writer is behind; the next frame diffs against the last queued one
+        rec->framesDropped++;
+        return;
+    }
+
+    char* out = rec->slots[head % CAST_SLOTS];
+    int len = sprintf_s(out, CAST_SLOT_BYTES, "[%.6f, \"o\", \"",
+        (start - rec->startNs) / 1000000000.0);
+    int bodyStart = len;
+    int cursor = -1;
+
+    if (rec->framesCaptured == 0) len += sprintf_s(out + len, CAST_SLOT_BYTES - len, "\\u001b[2J");
+
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        char c = drawTarget->chars[i];
+        int color = drawTarget->colors[i] & 0x0F;
+        if (c == rec->prevChars[i] && color == rec->prevColors[i]) continue;
+
+        rec->prevChars[i] = c;
+        rec->prevColors[i] = color;
+
+        if (i != cursor) {
+            len += sprintf_s(out + len, CAST_SLOT_BYTES - len, "\\u001b[%d;%dH", i / WIDTH + 1, i % WIDTH + 1);
+        }
+        if (color != rec->termColor) {
+            len += sprintf_s(out + len, CAST_SLOT_BYTES - len, "\\u001b[%dm", AnsiColor(color));
+            rec->termColor = color;
+        }
+
+        if (c == '"' || c == '\\') out[len++] = '\\';
+        out[len++] = (c >= 32 && c < 127) ? c : ' ';
+
+        // Terminals wrap differently at the right edge; always re-home there
+        cursor = ((i + 1) % WIDTH == 0) ? -1 : i + 1;
+    }
+
+    if (len > bodyStart) {
+        len += sprintf_s(out + len, CAST_SLOT_BYTES - len, "\"]\n");
+        rec->slotSize[head % CAST_SLOTS] = len;
+        rec->head.store(head + 1, std::memory_order_release);
+        rec->wake.notify_one();
+    }
+
+    rec->framesCaptured++;
+    rec->captureNs += GetTimeNs() - start;
+}
+
+void StopCastRecording() {
+    CastRecorder* rec = &castRecorder;
+    if (!rec->file) return;
+
+    rec->stop = 1;
+    rec->wake.notify_one();
+    rec->writer.join();
+    fclose(rec->file);
+    rec->file = NULL;
+
+    double minutes = (GetTimeNs() - rec->startNs) / 60000000000.0;
+    printf("Cast: %d frames, %d dropped, %.1f us/frame capture, %lld bytes (%.0f bytes/min)\n",
+        rec->framesCaptured, rec->framesDropped,
+        rec->framesCaptured ? rec->captureNs / 1000.0 / rec->framesCaptured : 0.0,
+        rec->bytesWritten.load(), minutes > 0 ? rec->bytesWritten.load() / minutes : 0.0);
+}
+
+int StartFrameTrace(const char* path) {
+    FILE* file;
+    if (fopen_s(&file, path, "w") != 0 || !file) return 0;
+    fprintf(file, "frame,frame_ms,work_ms,presses\n");
+    frameTrace.file = file;
+    frameTrace.frames = 0;
+    frameTrace.pressFrames = 0;
+    frameTrace.maxWorkNs = 0;
+    frameTrace.maxPressWorkNs = 0;
+    frameTrace.maxFrameMs = 0;
+    return 1;
+}
+
+void TraceFrame(DWORD frameMs, long long workNs) {
+    FrameTrace* trace = &frameTrace;
+    int presses = 0;
+    for (int i = 0; i < 256; i++) presses += inputManager.keysPressed[i];
+
+    fprintf(trace->file, "%d,%lu,%.3f,%d\n", trace->frames, (unsigned long)frameMs, workNs / 1e6, presses);
+    if (trace->frames > 0 && frameMs > trace->maxFrameMs) trace->maxFrameMs = frameMs;
+    if (workNs > trace->maxWorkNs) trace->maxWorkNs = workNs;
+    if (presses > 0) {
+        trace->pressFrames++;
+        if (workNs > trace->maxPressWorkNs) trace->maxPressWorkNs = workNs;
+    }
+    trace->frames++;
+}
+
+void StopFrameTrace() {
+    FrameTrace* trace = &frameTrace;
+    if (!trace->file) return;
+    fclose(trace->file);
+    trace->file = NULL;
+    printf("Frame trace: %d frames, longest %lu ms apart, work max %.2f ms (%.2f ms over %d frames with key presses)\n",
+        trace->frames, (unsigned long)trace->maxFrameMs, trace->maxWorkNs / 1e6,
+        trace->maxPressWorkNs / 1e6, trace->pressFrames);
+}
+
+//---------------------------------------------------------------------
+// FRAME PACING
+//---------------------------------------------------------------------
+
+void StartFramePacer(FramePacer* pacer, int rate) {
+    pacer->periodNs = 1000000000LL / rate;
+    pacer->sampleCount = 0;
+    pacer->lateFrames = 0;
+    pacer->spinNs = 0;
+    ResetFramePacer(pacer);
+#ifdef _WIN32
+    timeBeginPeriod(1);     // 1 ms sleeps instead of the 15.6 ms default tick
+#endif
+}
+
+void StopFramePacer() {
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+}
+
+// Forgets the grid, e.g. after the loop waited for input
+void ResetFramePacer(FramePacer* pacer) {
+    pacer->deadlineNs = 0;
+    pacer->lastStartNs = 0;
+}
+
+// World steps owed after a frame of frameMs. The world runs at SIM_RATE
+// however fast frames are presented; being within a quarter step of the
+// next one counts as reaching it, so presenting at SIM_RATE takes one step
+// every frame despite clock jitter.
+int TakeSimSteps(DWORD frameMs) {
+    if (simResync) {
+        simResync = 0;
+        simClock = 0;
+        return 1;
+    }
+    simClock += (long long)frameMs * SIM_RATE;
+    int steps = (int)((simClock + SIM_STEP_SLACK) / 1000);
+    if (steps > MAX_FRAME_STEPS) {
+        steps = MAX_FRAME_STEPS;
+        simClock = steps * 1000LL;
+    }
+    simClock -= steps * 1000LL;
+    return steps;
+}
+
+// Called at the top of a frame; returns its start time
+long long BeginPacedFrame(FramePacer* pacer) {
+    long long now = GetTimeNs();
+    if (pacer->lastStartNs) {
+        pacer->intervalUs[pacer->sampleCount % PACE_SAMPLES] = (int)((now - pacer->lastStartNs) / 1000);
+        pacer->sampleCount++;
+    }
+    pacer->lastStartNs = now;
+    return now;
+}
+
+// Waits for the next deadline. A frame that overran starts the next one
+// at once and moves the grid behind it rather than bursting to catch up.
+void WaitNextFrame(FramePacer* pacer) {
+    long long deadline = pacer->deadlineNs ? pacer->deadlineNs : pacer->lastStartNs + pacer->periodNs;
+    long long now = GetTimeNs();
+    if (now >= deadline) {
+        pacer->lateFrames++;
+        pacer->deadlineNs = now + pacer->periodNs;
+        return;
+    }
+
+    if (deadline - now > PACE_SPIN_NS) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now - PACE_SPIN_NS));
+    }
+    long long spinStart = GetTimeNs();
+    while (GetTimeNs() < deadline) std::this_thread::yield();
+    pacer->spinNs += GetTimeNs() - spinStart;
+    pacer->deadlineNs = deadline + pacer->periodNs;
+}
+
+// Frames per second over roughly the last second of frames
+int RecentFrameRate(const FramePacer* pacer) {
+    int count = pacer->sampleCount < PACE_SAMPLES ? pacer->sampleCount : PACE_SAMPLES;
+    long long totalUs = 0;
+    int used = 0;
+    for (int n = 1; n <= count && totalUs < 1000000; n++) {
+        totalUs += pacer->intervalUs[(pacer->sampleCount - n) % PACE_SAMPLES];
+        used++;
+    }
+    return totalUs > 0 ? (int)(used * 1000000LL / totalUs) : 0;
+}
+
+// Interval percentiles and jitter (distance from the period) over the
+// latest samples
+void FormatFrameJitter(const FramePacer* pacer, char* out, int size) {
+    static int sorted[PACE_SAMPLES];
+    static int jitter[PACE_SAMPLES];
+    int count = pacer->sampleCount < PACE_SAMPLES ? pacer->sampleCount : PACE_SAMPLES;
+    if (count == 0) {
+        sprintf_s(out, size, "no frames");
+        return;
+    }
+
+    int periodUs = (int)(pacer->periodNs / 1000);
+    for (int i = 0; i < count; i++) {
+        sorted[i] = pacer->intervalUs[i];
+        jitter[i] = abs(pacer->intervalUs[i] - periodUs);
+    }
+    qsort(sorted, count, sizeof(int), CompareInts);
+    qsort(jitter, count, sizeof(int), CompareInts);
+    sprintf_s(out, size, "%.1f Hz, interval p50 %.2f p95 %.2f p99 %.2f max %.2f ms, jitter p99 %.2f ms, %d late",
+        1e9 / pacer->periodNs, sorted[count / 2] / 1000.0, sorted[count * 95 / 100] / 1000.0,
+        sorted[count * 99 / 100] / 1000.0, sorted[count - 1] / 1000.0,
+        jitter[count * 99 / 100] / 1000.0, pacer->lateFrames);
+}
+
+// Busy work of 0-4 ms, like a frame that sometimes simulates more
+void PacingWork(unsigned int* state) {
+    long long until = GetTimeNs() + (SolverRand(state) % 4000) * 1000LL;
+    while (GetTimeNs() < until) {}
+}
+
+// The old limiter: GetTickCount and Sleep(frameTime - elapsed)
+long long LegacyLimiterPass(int frames, int rate, FramePacer* stats) {
+    unsigned int state = 12345;
+    DWORD frameTime = 1000 / rate;
+    StartFramePacer(stats, rate);
+    long long start = GetTimeNs();
+    for (int f = 0; f < frames; f++) {
+        BeginPacedFrame(stats);
+        DWORD startTime = GetTickCount();
+        PacingWork(&state);
+        DWORD elapsed = GetTickCount() - startTime;
+        if (elapsed < frameTime) Sleep(frameTime - elapsed);
+    }
+    StopFramePacer();
+    return GetTimeNs() - start;
+}
+
+int RunPacingBenchmark(int frames, int rate) {
+    static FramePacer legacy;
+    static FramePacer paced;
+    char report[200];
+
+    long long legacyNs = LegacyLimiterPass(frames, rate, &legacy);
+
+    unsigned int state = 12345;
+    StartFramePacer(&paced, rate);
+    long long start = GetTimeNs();
+    for (int f = 0; f < frames; f++) {
+        BeginPacedFrame(&paced);
+        PacingWork(&state);
+        WaitNextFrame(&paced);
+    }
+    long long pacedNs = GetTimeNs() - start;
+    StopFramePacer();
+
+    printf("Pacing: %d frames at %d Hz with 0-4 ms of work each\n", frames, rate);
+    FormatFrameJitter(&legacy, report, sizeof(report));
+    printf("  tick+Sleep: %5.1f frames/s, %s\n", frames * 1e9 / legacyNs, report);
+    FormatFrameJitter(&paced, report, sizeof(report));
+    printf("  pacer:      %5.1f frames/s, %s\n", frames * 1e9 / pacedNs, report);
+    printf("  pacer yielded %.2f ms/frame\n", paced.spinNs / 1e6 / frames);
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// TIME HISTOGRAMS
+//---------------------------------------------------------------------
+
+int TimeBucket(int us) {
+    if (us < 0) us = 0;
+    if (us < (1 << TIME_SUB_BITS)) return us;
+    int top = 31;
+    while (!(us & (1 << top))) top--;
+    int shift = top - TIME_SUB_BITS;
+    int bucket = ((shift + 1) << TIME_SUB_BITS) + (us >> shift) - (1 << TIME_SUB_BITS);
+    return bucket < TIME_BUCKETS ? bucket : TIME_BUCKETS - 1;
+}
+
+// Smallest value that lands in a bucket
+int TimeBucketLow(int bucket) {
+    int subCount = 1 << TIME_SUB_BITS;
+    if (bucket < subCount) return bucket;
+    int shift = (bucket >> TIME_SUB_BITS) - 1;
+    return (subCount + (bucket & (subCount - 1))) << shift;
+}
+
+void RecordTime(TimeHistogram* hist, long long ns) {
+    int us = (int)(ns / 1000);
+    int bucket = TimeBucket(us);
+
+    long long sample = hist->sampleCount.fetch_add(1, std::memory_order_relaxed);
+    int old = hist->window[sample % TIME_WINDOW].exchange(us, std::memory_order_relaxed);
+    if (sample >= TIME_WINDOW) hist->windowCounts[TimeBucket(old)].fetch_sub(1, std::memory_order_relaxed);
+    hist->windowCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+    hist->sessionCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+    int seenMax = hist->sessionMaxUs.load(std::memory_order_relaxed);
+    while (us > seenMax && !hist->sessionMaxUs.compare_exchange_weak(seenMax, us, std::memory_order_relaxed)) {}
+}
+
+// Copies counts that other threads may still be adding to
+long long LoadTimeCounts(const std::atomic<long long>* counts, long long* out) {
+    long long total = 0;
+    for (int b = 0; b < TIME_BUCKETS; b++) {
+        out[b] = counts[b].load(std::memory_order_relaxed);
+        if (out[b] < 0) out[b] = 0;
+        total += out[b];
+    }
+    return total;
+}
+
+// Middle of the bucket holding the given percentile, capped at maxUs
+int BucketPercentile(const long long* counts, long long total, int percent, int maxUs) {
+    long long rank = (total * percent + 99) / 100;
+    if (rank < 1) rank = 1;
+    long long seen = 0;
+    for (int b = 0; b < TIME_BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= rank) {
+            int low = TimeBucketLow(b);
+            int high = b + 1 < TIME_BUCKETS ? TimeBucketLow(b + 1) : low + 1;
+            int mid = (low + high - 1) / 2;
+            return mid < maxUs ? mid : maxUs;
+        }
+    }
+    return 0;
+}
+
+// Percentiles over the window; the maximum is exact
+void TimePercentiles(TimeHistogram* hist, int* p50, int* p95, int* p99, int* maxUs) {
+    long long counts[TIME_BUCKETS];
+    long long total = LoadTimeCounts(hist->windowCounts, counts);
+    long long taken = hist->sampleCount.load(std::memory_order_relaxed);
+    int filled = taken < TIME_WINDOW ? (int)taken : TIME_WINDOW;
+    *maxUs = 0;
+    for (int i = 0; i < filled; i++) {
+        int us = hist->window[i].load(std::memory_order_relaxed);
+        if (us > *maxUs) *maxUs = us;
+    }
+    *p50 = BucketPercentile(counts, total, 50, *maxUs);
+    *p95 = BucketPercentile(counts, total, 95, *maxUs);
+    *p99 = BucketPercentile(counts, total, 99, *maxUs);
+}
+
+void FormatTimePercentiles(TimeHistogram* hist, char* out, int size) {
+    int p50, p95, p99, maxUs;
+    TimePercentiles(hist, &p50, &p95, &p99, &maxUs);
+    sprintf_s(out, size, "%.2f/%.2f/%.2f/%.2fms", p50 / 1000.0, p95 / 1000.0, p99 / 1000.0, maxUs / 1000.0);
+}
+
+// Session histograms as text: a summary line per histogram, then one row
+// per non-empty bucket with its range in us
+int WriteTimeHistograms(const char* path) {
+    FILE* file = NULL;
+    if (fopen_s(&file, path, "w") != 0 || !file) return 0;
+
+    TimeHistogram* hists[3] = { &frameTimes, &simTimes, &renderTimes };
+    for (int h = 0; h < 3; h++) {
+        TimeHistogram* hist = hists[h];
+        long long counts[TIME_BUCKETS];
+        long long total = LoadTimeCounts(hist->sessionCounts, counts);
+        int maxUs = hist->sessionMaxUs.load(std::memory_order_relaxed);
+        fprintf(file, "# %s: %lld samples, p50 %d p95 %d p99 %d max %d us\n", hist->name, total,
+            BucketPercentile(counts, total, 50, maxUs), BucketPercentile(counts, total, 95, maxUs),
+            BucketPercentile(counts, total, 99, maxUs), maxUs);
+        for (int b = 0; b < TIME_BUCKETS; b++) {
+            if (counts[b] == 0) continue;
+            int high = b + 1 < TIME_BUCKETS ? TimeBucketLow(b + 1) - 1 : TimeBucketLow(b);
+            fprintf(file, "%s %d %d %lld\n", hist->name, TimeBucketLow(b), high, counts[b]);
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+//---------------------------------------------------------------------
+// PERFORMANCE COUNTERS
+//---------------------------------------------------------------------
+
+thread_local PerfGroup perfGroup;
+
+#ifdef __linux__
+int OpenPerfEvent(unsigned int type, unsigned long long config, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+// Opens the calling thread's group on first use
+void OpenPerfCounters() {
+    PerfGroup* group = &perfGroup;
+    if (group->state != 0) return;
+    group->state = -1;
+    group->members = 0;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        group->fds[e] = -1;
+        group->slot[e] = -1;
+    }
+
+#ifdef __linux__
+    const unsigned long long l1dReadMiss = PERF_COUNT_HW_CACHE_L1D |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const unsigned int types[PERF_EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+    const unsigned long long configs[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        l1dReadMiss, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+    int leader = OpenPerfEvent(types[PERF_CYCLES], configs[PERF_CYCLES], -1);
+    if (leader < 0) {
+        if (perfOutcome.load() == PERF_OFF) perfCyclesError.store(errno);
+        PublishPerfOutcome(PERF_NO_CYCLES);
+        return;
+    }
+    group->fds[PERF_CYCLES] = leader;
+    group->slot[PERF_CYCLES] = group->members++;
+    for (int e = 1; e < PERF_EVENTS; e++) {
+        int fd = OpenPerfEvent(types[e], configs[e], leader);
+        if (fd < 0) {
+            perfEventsMissing[e].store(1, std::memory_order_relaxed);
+            continue;
+        }
+        group->fds[e] = fd;
+        group->slot[e] = group->members++;
+    }
+    group->state = 1;
+    perfGroupsOpen++;
+    PublishPerfOutcome(PERF_ON);
+#else
+    PublishPerfOutcome(PERF_NOT_LINUX);
+#endif
+}
+
+// Worker threads open their groups concurrently; only the first result sticks
+void PublishPerfOutcome(int outcome) {
+    int expected = PERF_OFF;
+    perfOutcome.compare_exchange_strong(expected, outcome);
+}
+
+void FormatPerfStatus(char* out, int size) {
+    int outcome = perfOutcome.load();
+    if (outcome == PERF_ON) sprintf_s(out, size, "on");
+    else if (outcome == PERF_NO_CYCLES) sprintf_s(out, size, "unavailable: cycles: %s", strerror(perfCyclesError.load()));
+    else if (outcome == PERF_NOT_LINUX) sprintf_s(out, size, "unavailable: Linux only");
+    else sprintf_s(out, size, "off");
+}
+
+// Called by threads that ran phases before they exit
+void ClosePerfCounters() {
+    PerfGroup* group = &perfGroup;
+    if (group->state == 1) {
+        for (int e = PERF_EVENTS - 1; e >= 0; e--) {
+            if (group->fds[e] >= 0) close(group->fds[e]);
+        }
+        perfGroupsOpen--;
+    }
+    group->state = 0;
+}
+
+void BeginPhaseCounters(PerfSample* sample) {
+    sample->valid = 0;
+    if (!perfCountersEnabled) return;
+    OpenPerfCounters();
+    PerfGroup* group = &perfGroup;
+    if (group->state != 1) return;
+
+#ifdef __linux__
+    // PERF_FORMAT_GROUP: the member count, then one value per member
+    long long raw[PERF_EVENTS + 1];
+    if (read(group->fds[PERF_CYCLES], raw, sizeof(raw)) < (ssize_t)((group->members + 1) * sizeof(long long))) return;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        sample->values[e] = group->slot[e] >= 0 ? raw[1 + group->slot[e]] : 0;
+    }
+    sample->valid = 1;
+#endif
+}
+
+void EndPhaseCounters(int phase, const PerfSample* start, int points) {
+    if (!start->valid) return;
+    PerfSample end;
+    BeginPhaseCounters(&end);
+    if (!end.valid) return;
+
+    PhaseCounters* counters = &phaseCounters[phase];
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        counters->values[e].fetch_add(end.values[e] - start->values[e], std::memory_order_relaxed);
+    }
+    counters->runs.fetch_add(1, std::memory_order_relaxed);
+    counters->points.fetch_add(points, std::memory_order_relaxed);
+}
+
+// IPC and misses per world point since the start
+void FormatPhaseCounters(int phase, char* out, int size) {
+    PhaseCounters* counters = &phaseCounters[phase];
+    long long cycles = counters->values[PERF_CYCLES].load();
+    long long points = counters->points.load();
+    if (counters->runs.load() == 0 || cycles == 0) {
+        sprintf_s(out, size, "%s: no samples", counters->name);
+        return;
+    }
+    static const char* labels[PERF_EVENTS] = { "", "", "L1D", "LLC", "branch" };
+    int len;
+    if (perfEventsMissing[PERF_INSTRUCTIONS]) len = sprintf_s(out, size, "%s: IPC n/a, misses/point", counters->name);
+    else len = sprintf_s(out, size, "%s: IPC %.2f, misses/point", counters->name,
+        (double)counters->values[PERF_INSTRUCTIONS].load() / cycles);
+    for (int e = PERF_L1D_MISSES; e < PERF_EVENTS && len < size; e++) {
+        if (perfEventsMissing[e] || points == 0) len += sprintf_s(out + len, size - len, " %s n/a", labels[e]);
+        else len += sprintf_s(out + len, size - len, " %s %.3f", labels[e], (double)counters->values[e].load() / points);
+    }
+}
+
+// One phase as a JSON object; refused events are null
+void WritePhaseJson(FILE* file, int phase, int frames) {
+    static const char* names[PERF_EVENTS] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+    PhaseCounters* counters = &phaseCounters[phase];
+    long long cycles = counters->values[PERF_CYCLES].load();
+    long long points = counters->points.load();
+
+    fprintf(file, "    \"%s\": {\"runs\": %lld", counters->name, counters->runs.load());
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (perfEventsMissing[e] || cycles == 0) fprintf(file, ", \"%s_per_frame\": null", names[e]);
+        else fprintf(file, ", \"%s_per_frame\": %.1f", names[e], (double)counters->values[e].load() / frames);
+    }
+    if (cycles == 0 || perfEventsMissing[PERF_INSTRUCTIONS]) fprintf(file, ", \"ipc\": null");
+    else fprintf(file, ", \"ipc\": %.3f", (double)counters->values[PERF_INSTRUCTIONS].load() / cycles);
+    for (int e = PERF_L1D_MISSES; e < PERF_EVENTS; e++) {
+        if (perfEventsMissing[e] || cycles == 0 || points == 0) fprintf(file, ", \"%s_per_point\": null", names[e]);
+        else fprintf(file, ", \"%s_per_point\": %.4f", names[e], (double)counters->values[e].load() / points);
+    }
+    fprintf(file, "}");
+}
+
+// Steps and rasterizes a busy scene with the counters on and reports
+// each phase; the JSON carries the same numbers for comparing hosts
+int RunCounterBenchmark(int frames, const char* jsonPath) {
+    perfCountersEnabled = 1;
+    headlessMode = 1;
+    BuildPipelineScene(24);
+
+    long long simNs = 0;
+    long long renderNs = 0;
+    for (int f = 0; f < frames; f++) {
+        if (f % 20 == 0) SpawnBomb(6 + (f * 7) % (WIDTH - 12), 3);
+        long long start = GetTimeNs();
+        UpdatePhysics();
+        long long mid = GetTimeNs();
+
+        PerfSample sample;
+        BeginPhaseCounters(&sample);
+        ClearDrawTarget(drawTarget, ' ');
+        WorldView view = CurrentWorldView();
+        RasterizeWorld(&view, 0, 0, 0, 0, f * 0.033f);
+        EndPhaseCounters(PHASE_RENDER, &sample, view.pointCount);
+        simNs += mid - start;
+        renderNs += GetTimeNs() - mid;
+    }
+
+    char status[120];
+    FormatPerfStatus(status, sizeof(status));
+    printf("Counters: %d frames, %d points, %s\n", frames, pointCount, status);
+    printf("  step %.1f us/frame, rasterize %.1f us/frame\n", simNs / 1e3 / frames, renderNs / 1e3 / frames);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        char line[160];
+        FormatPhaseCounters(p, line, sizeof(line));
+        printf("  %s\n", line);
+    }
+
+    if (jsonPath) {
+        FILE* file = NULL;
+        if (fopen_s(&file, jsonPath, "w") != 0 || !file) {
+            printf("Cannot write %s\n", jsonPath);
+            return 1;
+        }
+        fprintf(file, "{\n  \"frames\": %d,\n  \"points\": %d,\n  \"counters\": \"%s\",\n", frames, pointCount, status);
+        fprintf(file, "  \"step_us_per_frame\": %.2f,\n  \"rasterize_us_per_frame\": %.2f,\n  \"phases\": {\n",
+            simNs / 1e3 / frames, renderNs / 1e3 / frames);
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            WritePhaseJson(file, p, frames);
+            fprintf(file, p + 1 < PHASE_COUNT ? ",\n" : "\n");
+        }
+        fprintf(file, "  }\n}\n");
+        fclose(file);
+    }
+    ClosePerfCounters();
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// METRICS
+//---------------------------------------------------------------------
+
+void CountMetric(int metric, long long n) {
+    metrics[metric].value.fetch_add(n, std::memory_order_relaxed);
+}
 
-            if (points[p1].isActive == 0) continue;
-            if (points[p2].isActive == 0) continue;
+void SetGauge(int metric, long long value) {
+    metrics[metric].value.store(value, std::memory_order_relaxed);
+}
 
-            float dx = points[p2].x - points[p1].x;
-            float dy = points[p2].y - points[p1].y;
-            float distance = sqrtf(dx * dx + dy * dy);
+void ObserveMetric(int metric, long long ns) {
+    int b = 0;
+    while (b < METRIC_BUCKETS - 1 && ns > metricBoundsNs[b]) b++;
+    metrics[metric].buckets[b].fetch_add(1, std::memory_order_relaxed);
+    metrics[metric].sumNs.fetch_add(ns, std::memory_order_relaxed);
+}
 
-            if (distance < 0.001f) continue;
+// World gauges, set by the game thread once a frame
+void UpdateWorldGauges() {
+    int livePoints = 0;
+    int liveSticks = 0;
+    int liveBoxes = 0;
+    for (int i = 0; i < pointCount; i++) livePoints += points[i].isActive != 0;
+    for (int i = 0; i < stickCount; i++) liveSticks += sticks[i].active != 0;
+    for (int i = 0; i < boxCount; i++) liveBoxes += boxes[i].isActive != 0;
+
+    int sleeping = 0;
+    for (int n = 0; n < entityCount; n++) {
+        const Entity* entity = &entities[n];
+        if (entity->pointCount == 0) continue;
+        int resting = 1;
+        for (int p = entity->firstPoint; p < entity->firstPoint + entity->pointCount && resting; p++) {
+            if (fabsf(points[p].x - points[p].oldX) > REST_SPEED || fabsf(points[p].y - points[p].oldY) > REST_SPEED) resting = 0;
+        }
+        sleeping += resting;
+    }
 
-            if (distance > sticks[s].length * STICK_BREAK_FACTOR) {
-                sticks[s].active = 0;
-                SpawnBreakParticles((points[p1].x + points[p2].x) / 2, (points[p1].y + points[p2].y) / 2);
-                continue;
-            }
+    SetGauge(METRIC_LIVE_POINTS, livePoints);
+    SetGauge(METRIC_LIVE_STICKS, liveSticks);
+    SetGauge(METRIC_LIVE_BOXES, liveBoxes);
+    SetGauge(METRIC_SLEEPING_ISLANDS, sleeping);
+}
 
-            float difference = (sticks[s].length - distance) / distance;
-            float offsetX = dx * difference * 0.5f;
-            float offsetY = dy * difference * 0.5f;
+// Prometheus text exposition format 0.0.4; returns the length
+int FormatMetrics(char* out, int size) {
+    static const char* types[3] = { "counter", "gauge", "histogram" };
+    int len = 0;
+    for (int m = 0; m < METRIC_COUNT && len < size; m++) {
+        Metric* metric = &metrics[m];
+        len += sprintf_s(out + len, size - len, "# HELP %s %s\n# TYPE %s %s\n",
+            metric->name, metric->help, metric->name, types[metric->type]);
+        if (metric->type != METRIC_HISTOGRAM) {
+            if (len < size) len += sprintf_s(out + len, size - len, "%s %lld\n", metric->name, metric->value.load());
+            continue;
+        }
 
-            if (points[p1].isLocked == 0) {
-                points[p1].x = points[p1].x - offsetX;
-                points[p1].y = points[p1].y - offsetY;
+        long long total = 0;
+        for (int b = 0; b < METRIC_BUCKETS && len < size; b++) {
+            total += metric->buckets[b].load(std::memory_order_relaxed);
+            if (b < METRIC_BUCKETS - 1) {
+                len += sprintf_s(out + len, size - len, "%s_bucket{le=\"%g\"} %lld\n", metric->name, metricBoundsNs[b] / 1e9, total);
             }
-            if (points[p2].isLocked == 0) {
-                points[p2].x = points[p2].x + offsetX;
-                points[p2].y = points[p2].y + offsetY;
+            else {
+                len += sprintf_s(out + len, size - len, "%s_bucket{le=\"+Inf\"} %lld\n", metric->name, total);
             }
         }
-
-        ResolveBoxCollisions();
+        if (len < size) {
+            len += sprintf_s(out + len, size - len, "%s_sum %.6f\n%s_count %lld\n",
+                metric->name, metric->sumNs.load() / 1e9, metric->name, total);
+        }
     }
+    return len < size ? len : size - 1;
+}
 
-    // After constraint solving, check for new breaks
-    int sticksAfterUpdate = 0;
-    for (int i = 0; i < stickCount; i++) {
-        if (sticks[i].active) sticksAfterUpdate++;
-    }
+// Writes beside the target and renames over it
+int WriteMetricsFile(const char* path, const char* text, int len) {
+    char temp[270];
+    sprintf_s(temp, sizeof(temp), "%s.tmp", path);
+    FILE* file = NULL;
+    if (fopen_s(&file, temp, "w") != 0 || !file) return 0;
+    int ok = (int)fwrite(text, 1, len, file) == len;
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) return 0;
+#ifdef _WIN32
+    return MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(temp, path) == 0;
+#endif
+}
 
-    if (sticksAfterUpdate < sticksBeforeUpdate) {
-        PlaySoundBreak();
-        gameStats.sticksBreached++;
-        if (screenShake < 2.0f) screenShake += 0.5f;
-    }
+// Answers every client that connects within the timeout with a fresh
+// exposition, then closes it
+void ServeMetricsClients(int timeoutMs) {
+#ifndef _WIN32
+    static char text[METRICS_TEXT_SIZE];
+    MetricsExporter* exporter = &metricsExporter;
+    struct pollfd listener = { exporter->socketFd, POLLIN, 0 };
+    if (poll(&listener, 1, timeoutMs) <= 0) return;
+
+    int client = accept(exporter->socketFd, NULL, NULL);
+    if (client < 0) return;
+    int len = FormatMetrics(text, sizeof(text));
+    for (int sent = 0; sent < len;) {
+        ssize_t n = send(client, text + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += (int)n;
+    }
+    close(client);
+    exporter->exports++;
+#endif
+}
 
-    // Point-to-point collision
-    for (int i = 0; i < pointCount; i++) {
-        for (int j = i + 1; j < pointCount; j++) {
-            if (points[i].isActive == 0) continue;
-            if (points[j].isActive == 0) continue;
+void MetricsThread() {
+    static char text[METRICS_TEXT_SIZE];
+    MetricsExporter* exporter = &metricsExporter;
+    std::unique_lock<std::mutex> guard(exporter->lock);
+    while (!exporter->stop) {
+        if (exporter->socketFd >= 0) {
+            // Short polls so a stop request is seen promptly
+            guard.unlock();
+            ServeMetricsClients(100);
+            guard.lock();
+            continue;
+        }
 
-            float dx = points[i].x - points[j].x;
-            float dy = points[i].y - points[j].y;
-            float distance = sqrtf(dx * dx + dy * dy);
-            float minDistance = points[i].radius + points[j].radius;
+        guard.unlock();
+        int len = FormatMetrics(text, sizeof(text));
+        if (WriteMetricsFile(exporter->path, text, len)) exporter->exports++;
+        guard.lock();
+        exporter->wake.wait_for(guard, std::chrono::milliseconds(exporter->intervalMs));
+    }
+}
 
-            if (distance < minDistance && distance > 0.001f) {
-                float overlap = minDistance - distance;
-                float pushX = (dx / distance) * overlap * 0.5f;
-                float pushY = (dy / distance) * overlap * 0.5f;
+// spec is a file path or unix:PATH
+int StartMetricsExporter(const char* spec, int intervalMs) {
+    MetricsExporter* exporter = &metricsExporter;
+    exporter->stop = 0;
+    exporter->socketFd = -1;
+    exporter->intervalMs = intervalMs;
+    exporter->exports = 0;
+    exporter->path = spec;
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+#ifdef _WIN32
+        return 0;
+#else
+        exporter->path = spec + 5;
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(exporter->path) >= sizeof(addr.sun_path)) return 0;
+        strcpy(addr.sun_path, exporter->path);
+
+        // Only a stale socket from an earlier run is replaced, never another file
+        struct stat st;
+        if (lstat(exporter->path, &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) return 0;
+            unlink(exporter->path);
+        }
 
-                if (points[i].isLocked == 0) {
-                    points[i].x = points[i].x + pushX;
-                    points[i].y = points[i].y + pushY;
-                }
-                if (points[j].isLocked == 0) {
-                    points[j].x = points[j].x - pushX;
-                    points[j].y = points[j].y - pushY;
-                }
-            }
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return 0;
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+            close(fd);
+            return 0;
         }
+        exporter->socketFd = fd;
+#endif
+    }
+
+    exporter->running = 1;
+    exporter->thread = std::thread(MetricsThread);
+    return 1;
+}
+
+// A file export gets one last write with the final values
+void StopMetricsExporter() {
+    MetricsExporter* exporter = &metricsExporter;
+    if (!exporter->running) return;
+    {
+        std::lock_guard<std::mutex> guard(exporter->lock);
+        exporter->stop = 1;
+    }
+    exporter->wake.notify_all();
+    exporter->thread.join();
+    exporter->running = 0;
+
+    if (exporter->socketFd >= 0) {
+        close(exporter->socketFd);
+        unlink(exporter->path);
+        exporter->socketFd = -1;
+        return;
     }
+    static char text[METRICS_TEXT_SIZE];
+    int len = FormatMetrics(text, sizeof(text));
+    if (WriteMetricsFile(exporter->path, text, len)) exporter->exports++;
 }
 
 //---------------------------------------------------------------------
 // SCREEN DRAWING
 //---------------------------------------------------------------------
-
-void DrawScreen(HANDLE hOut) {
-    // Clear screen buffers
+void ClearDrawTarget(DrawTarget* target, char fill) {
     for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        screenBuf[i] = ' ';
-        colorBuf[i] = COLOR_WHITE;
-    }
-
-    // Apply screen shake
-    int shakeX = 0, shakeY = 0;
-    if (screenShake > 0) {
-        shakeX = (rand() % 3 - 1) * (int)screenShake;
-        shakeY = (rand() % 3 - 1) * (int)screenShake;
+        target->chars[i] = fill;
+        target->colors[i] = COLOR_WHITE;
     }
+}
 
+// The world layer of a frame, from live arrays or a frame snapshot
+void RasterizeWorld(const WorldView* view, int viewX, int shakeY, int targetX, int showTargets, float time) {
     // Draw particles
-    for (int i = 0; i < MAX_PARTICLES; i++) {
+    const Particle* particles = view->particles;
+    for (int i = 0; i < view->particleCount; i++) {
         if (particles[i].active) {
-            PutChar((int)particles[i].x + shakeX, (int)particles[i].y + shakeY,
+            PutChar((int)particles[i].x + viewX, (int)particles[i].y + shakeY,
                 particles[i].symbol, particles[i].color);
         }
     }
 
     // Draw targets in mission mode
-    if (currentMode == 2) {
-        DrawAnimatedTargets();
+    if (showTargets) {
+        DrawAnimatedTargets(view->targets, view->targetCount, targetX, time);
     }
 
     // Draw boxes
-    for (int i = 0; i < boxCount; i++) {
+    const Box* boxes = view->boxes;
+    for (int i = 0; i < view->boxCount; i++) {
         if (boxes[i].isActive) {
             int halfW = (int)(boxes[i].width / 2.0f);
             int halfH = (int)(boxes[i].height / 2.0f);
-            int left = (int)boxes[i].x - halfW + shakeX;
-            int right = (int)boxes[i].x + halfW + shakeX;
+            int left = (int)boxes[i].x - halfW + viewX;
+            int right = (int)boxes[i].x + halfW + viewX;
             int top = (int)boxes[i].y - halfH + shakeY;
             int bottom = (int)boxes[i].y + halfH + shakeY;
             int col = (boxes[i].isWall) ? COLOR_GRAY : COLOR_BRIGHT_BLUE;
@@ -2328,15 +8736,17 @@ void DrawScreen(HANDLE hOut) {
     }
 
     // Draw sticks
-    for (int i = 0; i < stickCount; i++) {
+    const Point* points = view->points;
+    const Stick* sticks = view->sticks;
+    for (int i = 0; i < view->stickCount; i++) {
         if (sticks[i].active == 0) continue;
         if (points[sticks[i].p1].isActive == 0) continue;
         if (points[sticks[i].p2].isActive == 0) continue;
 
         DrawLine(
-            (int)(points[sticks[i].p1].x + 0.5f) + shakeX,
+            (int)(points[sticks[i].p1].x + 0.5f) + viewX,
             (int)(points[sticks[i].p1].y + 0.5f) + shakeY,
-            (int)(points[sticks[i].p2].x + 0.5f) + shakeX,
+            (int)(points[sticks[i].p2].x + 0.5f) + viewX,
             (int)(points[sticks[i].p2].y + 0.5f) + shakeY,
             '-',
             COLOR_WHITE
@@ -2344,12 +8754,14 @@ void DrawScreen(HANDLE hOut) {
     }
 
     // Draw points with effects
-    for (int i = 0; i < pointCount; i++) {
+    for (int i = 0; i < view->pointCount; i++) {
         if (points[i].isActive == 0) continue;
-        DrawPointWithEffects(&points[i], shakeX, shakeY);
+        DrawPointWithEffects(&points[i], viewX, shakeY);
     }
+}
 
-    // Draw UI elements
+// Status, tool and mode UI; always drawn on the game thread
+void DrawFrameUI() {
     DrawToolSelection();
     DrawStatusBar();
     DrawDebugInfo();
@@ -2366,7 +8778,7 @@ void DrawScreen(HANDLE hOut) {
         }
 
         if (ropeStartX >= 0) {
-            DrawLine(ropeStartX, ropeStartY, curX, curY, ':', COLOR_BRIGHT_YELLOW);
+            DrawLine(ropeStartX - cameraX, ropeStartY, curX, curY, ':', COLOR_BRIGHT_YELLOW);
         }
     }
     else if (currentMode == 2) {
@@ -2390,18 +8802,233 @@ void DrawScreen(HANDLE hOut) {
         // Shop mode
         DrawShop();
     }
+}
 
-    // Output to console
-    CHAR_INFO buffer[WIDTH * HEIGHT];
+void RenderFrame(const FrameSnapshot* frame, HANDLE hOut) {
+    ClearDrawTarget(drawTarget, ' ');
+    RasterizeWorld(&frame->view, frame->viewX, frame->shakeY, frame->targetX, frame->showTargets, frame->time);
+
+    const DrawTarget* overlay = &frame->overlay;
     for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        buffer[i].Char.UnicodeChar = (WCHAR)screenBuf[i];
-        buffer[i].Attributes = colorBuf[i];
+        if (overlay->chars[i] == 0) continue;
+        drawTarget->chars[i] = overlay->chars[i];
+        drawTarget->colors[i] = overlay->colors[i];
     }
 
-    COORD bufferSize = { (short)WIDTH, (short)HEIGHT };
-    COORD bufferCoord = { 0, 0 };
-    SMALL_RECT writeRegion = { 0, 0, (short)(WIDTH - 1), (short)(HEIGHT - 1) };
-    WriteConsoleOutput(hOut, buffer, bufferSize, bufferCoord, &writeRegion);
+    PresentScreen(hOut);
+}
+
+void RenderThread() {
+    FramePipeline* pipe = &framePipeline;
+    drawTarget = &renderTarget;
+
+    std::unique_lock<std::mutex> guard(pipe->lock);
+    while (1) {
+        while (pipe->queued < 0 && !pipe->stop) pipe->changed.wait(guard);
+        if (pipe->queued < 0) break;
+
+        int slot = pipe->queued;
+        pipe->rendering = slot;
+        pipe->queued = -1;
+        pipe->changed.notify_all();
+        guard.unlock();
+
+        PerfSample sample;
+        BeginPhaseCounters(&sample);
+        long long start = GetTimeNs();
+        RenderFrame(&pipe->slots[slot], pipe->out);
+        long long spent = GetTimeNs() - start;
+        EndPhaseCounters(PHASE_RENDER, &sample, pipe->slots[slot].view.pointCount);
+        RecordTime(&renderTimes, spent);
+        ObserveMetric(METRIC_RENDER_SECONDS, spent);
+
+        guard.lock();
+        pipe->renderNs += spent;
+        pipe->framesPresented++;
+        pipe->rendering = -1;
+        pipe->changed.notify_all();
+    }
+    guard.unlock();
+    ClosePerfCounters();
+}
+
+void StartFramePipeline(HANDLE hOut) {
+    FramePipeline* pipe = &framePipeline;
+    pipe->slots = (FrameSnapshot*)malloc(FRAME_SLOTS * sizeof(FrameSnapshot));
+    if (!pipe->slots) return;
+    pipe->out = hOut;
+    pipe->queued = -1;
+    pipe->rendering = -1;
+    pipe->stop = 0;
+    pipe->framesPresented = 0;
+    pipe->renderNs = 0;
+    pipe->waitNs = 0;
+    pipe->renderer = std::thread(RenderThread);
+}
+
+// Returns once every queued frame is on screen
+void WaitFramePipeline() {
+    FramePipeline* pipe = &framePipeline;
+    if (!pipe->slots) return;
+    std::unique_lock<std::mutex> guard(pipe->lock);
+    while (pipe->queued >= 0 || pipe->rendering >= 0) pipe->changed.wait(guard);
+}
+
+void StopFramePipeline() {
+    FramePipeline* pipe = &framePipeline;
+    if (!pipe->slots) return;
+    {
+        std::lock_guard<std::mutex> guard(pipe->lock);
+        pipe->stop = 1;
+    }
+    pipe->changed.notify_all();
+    pipe->renderer.join();
+    free(pipe->slots);
+    pipe->slots = NULL;
+}
+
+// Copies the world into a free slot, waiting while the previous frame is
+// still queued; this wait is what bounds the pipeline to one frame.
+FrameSnapshot* BeginFrameSnapshot() {
+    FramePipeline* pipe = &framePipeline;
+    long long start = GetTimeNs();
+    std::unique_lock<std::mutex> guard(pipe->lock);
+    while (pipe->queued >= 0) pipe->changed.wait(guard);
+    FrameSnapshot* frame = &pipe->slots[pipe->rendering == 0 ? 1 : 0];
+    guard.unlock();
+    pipe->waitNs += GetTimeNs() - start;
+
+    memcpy(frame->points, points, pointCount * sizeof(Point));
+    memcpy(frame->sticks, sticks, stickCount * sizeof(Stick));
+    memcpy(frame->boxes, boxes, boxCount * sizeof(Box));
+    memcpy(frame->targets, targets, targetCount * sizeof(Target));
+    memcpy(frame->particles, particles, sizeof(particles));
+
+    WorldView view = CurrentWorldView();
+    view.points = frame->points;
+    view.sticks = frame->sticks;
+    view.boxes = frame->boxes;
+    view.targets = frame->targets;
+    view.particles = frame->particles;
+    view.entities = NULL;
+    view.entityCount = 0;
+    frame->view = view;
+    return frame;
+}
+
+void SubmitFrame(FrameSnapshot* frame) {
+    FramePipeline* pipe = &framePipeline;
+    {
+        std::lock_guard<std::mutex> guard(pipe->lock);
+        pipe->queued = (int)(frame - pipe->slots);
+    }
+    pipe->changed.notify_all();
+}
+
+void DrawScreen(HANDLE hOut) {
+    // Apply screen shake
+    int shakeX = 0, shakeY = 0;
+    if (screenShake > 0) {
+        shakeX = (rand() % 3 - 1) * (int)screenShake;
+        shakeY = (rand() % 3 - 1) * (int)screenShake;
+    }
+
+    // World space is drawn relative to the camera
+    int viewX = shakeX - cameraX;
+
+    if (!framePipeline.slots) {
+        PerfSample sample;
+        BeginPhaseCounters(&sample);
+        long long start = GetTimeNs();
+        ClearDrawTarget(drawTarget, ' ');
+        WorldView view = CurrentWorldView();
+        RasterizeWorld(&view, viewX, shakeY, -cameraX, currentMode == 2, gameTime);
+        DrawFrameUI();
+        PresentScreen(hOut);
+        long long spent = GetTimeNs() - start;
+        RecordTime(&renderTimes, spent);
+        ObserveMetric(METRIC_RENDER_SECONDS, spent);
+        EndPhaseCounters(PHASE_RENDER, &sample, pointCount);
+        return;
+    }
+
+    FrameSnapshot* frame = BeginFrameSnapshot();
+    frame->viewX = viewX;
+    frame->shakeY = shakeY;
+    frame->targetX = -cameraX;
+    frame->showTargets = (currentMode == 2);
+    frame->time = gameTime;
+
+    drawTarget = &frame->overlay;
+    ClearDrawTarget(drawTarget, 0);
+    DrawFrameUI();
+    drawTarget = &mainTarget;
+
+    SubmitFrame(frame);
+}
+
+// Builds the same scene for every pass: enough ragdolls that a step
+// costs about as much as drawing and presenting a frame.
+void BuildPipelineScene(int ragdolls) {
+    ClearWorld();
+    for (int i = 0; i < MAX_PARTICLES; i++) particles[i].active = 0;
+    simRandState = 1;
+    for (int r = 0; r < ragdolls; r++) SpawnRagdoll(8 + (r * 13) % (WIDTH - 16), 4 + (r % 4) * 3);
+    SpawnPlatform(WIDTH / 2, HEIGHT - 8, 40);
+}
+
+// Game-thread time per frame for FRAMES steps, drawing each one
+long long TimePipelinePass(HANDLE hOut, int ragdolls, int frames, int pipelined, long long* simNs) {
+    BuildPipelineScene(ragdolls);
+    if (pipelined) StartFramePipeline(hOut);
+    long long sim = 0;
+    long long start = GetTimeNs();
+    for (int f = 0; f < frames; f++) {
+        long long stepStart = GetTimeNs();
+        if (f % 20 == 0) SpawnBomb(6 + (f * 7) % (WIDTH - 12), 3);
+        UpdatePhysics();
+        sim += GetTimeNs() - stepStart;
+        DrawScreen(hOut);
+    }
+    if (pipelined) StopFramePipeline();
+    else WaitFramePipeline();
+    if (simNs) *simNs = sim;
+    return GetTimeNs() - start;
+}
+
+int RunPipelineBenchmark(int frames) {
+    HANDLE hOut = CreateConsoleScreenBuffer(GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
+    SetConsoleActiveScreenBuffer(hOut);
+    currentMode = 1;
+    isSimulating = 1;
+
+    // Grow the scene until simulating catches up with rendering
+    int ragdolls = 1;
+    long long simNs = 0, frameNs = 0;
+    while (1) {
+        frameNs = TimePipelinePass(hOut, ragdolls, 30, 0, &simNs);
+        if (simNs * 2 >= frameNs || pointCount * 2 > MAX_POINTS) break;
+        ragdolls = ragdolls * 3 / 2 + 1;
+    }
+
+    long long serialSim = 0, pipeSim = 0;
+    long long serialNs = TimePipelinePass(hOut, ragdolls, frames, 0, &serialSim);
+    long long pipeNs = TimePipelinePass(hOut, ragdolls, frames, 1, &pipeSim);
+    long long renderNs = framePipeline.renderNs.load();
+    long long waitNs = framePipeline.waitNs;
+
+    SetConsoleActiveScreenBuffer(GetStdHandle(STD_OUTPUT_HANDLE));
+    double serialFrame = serialNs / 1e3 / frames;
+    double pipeFrame = pipeNs / 1e3 / frames;
+    printf("Pipeline: %d frames, %d ragdolls, %d points, %u cores\n", frames, ragdolls, pointCount,
+        std::thread::hardware_concurrency());
+    printf("  simulate:    %8.1f us/frame\n", pipeSim / 1e3 / frames);
+    printf("  render:      %8.1f us/frame (rasterize + present)\n", renderNs / 1e3 / frames);
+    printf("  serial:      %8.1f us/frame, %6.1f frames/s\n", serialFrame, 1e6 / serialFrame);
+    printf("  pipelined:   %8.1f us/frame, %6.1f frames/s (%.1f us/frame waiting on the renderer)\n",
+        pipeFrame, 1e6 / pipeFrame, waitNs / 1e3 / frames);
+    if (std::thread::hardware_concurrency() <= 1) printf("  one core: the game draws serially\n");
+    return 0;
 }
 
 //---------------------------------------------------------------------
@@ -2410,8 +9037,8 @@ void DrawScreen(HANDLE hOut) {
 
 void ShowMainMenu(HANDLE hOut) {
     for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        screenBuf[i] = ' ';
-        colorBuf[i] = COLOR_WHITE;
+        drawTarget->chars[i] = ' ';
+        drawTarget->colors[i] = COLOR_WHITE;
     }
 
     // Draw title
@@ -2517,21 +9144,13 @@ void ShowMainMenu(HANDLE hOut) {
     for (int i = 0; i < ctrlLen; i++) PutChar(ctrlX + i, HEIGHT - 3, controls[i], COLOR_GRAY);
 
     // Output to console
-    CHAR_INFO buffer[WIDTH * HEIGHT];
-    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        buffer[i].Char.UnicodeChar = (WCHAR)screenBuf[i];
-        buffer[i].Attributes = colorBuf[i];
-    }
-    COORD bufferSize = { (short)WIDTH, (short)HEIGHT };
-    COORD bufferCoord = { 0, 0 };
-    SMALL_RECT writeRegion = { 0, 0, (short)(WIDTH - 1), (short)(HEIGHT - 1) };
-    WriteConsoleOutput(hOut, buffer, bufferSize, bufferCoord, &writeRegion);
+    PresentScreen(hOut);
 }
 
 void ShowMissionComplete(HANDLE hOut) {
     for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        screenBuf[i] = ' ';
-        colorBuf[i] = COLOR_WHITE;
+        drawTarget->chars[i] = ' ';
+        drawTarget->colors[i] = COLOR_WHITE;
     }
 
     char msg1[] = "=== MISSION COMPLETE! ===";
@@ -2539,7 +9158,7 @@ void ShowMissionComplete(HANDLE hOut) {
     sprintf_s(msg2, 100, "Mission %d cleared in %.1f seconds!", currentMission, missionTimer);
 
     // Calculate reward
-    int baseReward = currentMission * 50;
+    int baseReward = missionDefs[currentMission - 1].info.reward;
     int timeBonus = (int)((missionTimeLimit - missionTimer) * 2);
     int totalReward = baseReward + timeBonus;
 
@@ -2572,21 +9191,13 @@ void ShowMissionComplete(HANDLE hOut) {
     int len5 = (int)strlen(msg5);
     for (int i = 0; i < len5; i++) PutChar((WIDTH - len5) / 2 + i, y + 6, msg5[i], COLOR_WHITE);
 
-    CHAR_INFO buffer[WIDTH * HEIGHT];
-    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        buffer[i].Char.UnicodeChar = (WCHAR)screenBuf[i];
-        buffer[i].Attributes = colorBuf[i];
-    }
-    COORD bufferSize = { (short)WIDTH, (short)HEIGHT };
-    COORD bufferCoord = { 0, 0 };
-    SMALL_RECT writeRegion = { 0, 0, (short)(WIDTH - 1), (short)(HEIGHT - 1) };
-    WriteConsoleOutput(hOut, buffer, bufferSize, bufferCoord, &writeRegion);
+    PresentScreen(hOut);
 }
 
 void ShowMissionFailed(HANDLE hOut) {
     for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        screenBuf[i] = ' ';
-        colorBuf[i] = COLOR_WHITE;
+        drawTarget->chars[i] = ' ';
+        drawTarget->colors[i] = COLOR_WHITE;
     }
 
     char msg1[] = "=== MISSION FAILED! ===";
@@ -2611,57 +9222,256 @@ void ShowMissionFailed(HANDLE hOut) {
     int len4 = (int)strlen(msg4);
     for (int i = 0; i < len4; i++) PutChar((WIDTH - len4) / 2 + i, y + 5, msg4[i], COLOR_WHITE);
 
-    CHAR_INFO buffer[WIDTH * HEIGHT];
-    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        buffer[i].Char.UnicodeChar = (WCHAR)screenBuf[i];
-        buffer[i].Attributes = colorBuf[i];
-    }
-    COORD bufferSize = { (short)WIDTH, (short)HEIGHT };
-    COORD bufferCoord = { 0, 0 };
-    SMALL_RECT writeRegion = { 0, 0, (short)(WIDTH - 1), (short)(HEIGHT - 1) };
-    WriteConsoleOutput(hOut, buffer, bufferSize, bufferCoord, &writeRegion);
+    PresentScreen(hOut);
 }
 
 //---------------------------------------------------------------------
 // UTILITY FUNCTIONS
 //---------------------------------------------------------------------
 
+// Points move every step and a rebuild costs over ten linear scans, so
+// the first pick against a world state scans; the index is only built
+// once a second pick lands on the same state
 int FindNearestPoint(int x, int y, float maxDist) {
-    int bestPoint = -1;
-    float bestDistance = maxDist;
-
-    for (int i = 0; i < pointCount; i++) {
-        if (points[i].isActive == 0) continue;
-
-        float distance = GetDistance(points[i].x, points[i].y, (float)x, (float)y);
-
-        if (distance < bestDistance) {
-            bestDistance = distance;
-            bestPoint = i;
-        }
-    }
+    if (!PickIndexCurrent() && (pickScanRevision != worldRevision || pickScanPositionRevision != positionRevision ||
+        pickScanPointCount != pointCount)) {
+        pickScanRevision = worldRevision;
+        pickScanPositionRevision = positionRevision;
+        pickScanPointCount = pointCount;
+        return ScanNearestPoint(points, pointCount, (float)x, (float)y, maxDist);
+    }
+    UpdatePickIndex();
+    return PickNearest(&pickIndex, (float)x, (float)y, maxDist, PICK_ANY);
+}
 
-    return bestPoint;
+// Every early return in startup goes through here. Each Stop function does
+// nothing for a service that never started, and a thread still joinable
+// at exit would abort the process.
+void StopStartupServices() {
+    StopMetricsExporter();
+    StopSoundEngine();
+    StopCastRecording();
+    StopFrameTrace();
 }
 
 //---------------------------------------------------------------------
 // MAIN FUNCTION
 //---------------------------------------------------------------------
 
-int main() {
+int main(int argc, char* argv[]) {
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* castPath = NULL;
+    const char* tracePath = NULL;
+    const char* histogramPath = NULL;
+    const char* metricsSpec = NULL;
+    int metricsIntervalMs = 1000;
+    const char* dictPath = NULL;
+#ifdef _WIN32
+    const char* soundSpec = "waveout";
+#else
+    const char* soundSpec = "null";
+#endif
+    int soundSpecGiven = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) recordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replayPath = argv[++i];
+        else if (strcmp(argv[i], "--headless") == 0) headlessMode = 1;
+        else if (strcmp(argv[i], "--cast") == 0 && i + 1 < argc) castPath = argv[++i];
+        else if (strcmp(argv[i], "--frame-trace") == 0 && i + 1 < argc) tracePath = argv[++i];
+        else if (strcmp(argv[i], "--time-histogram") == 0 && i + 1 < argc) histogramPath = argv[++i];
+        else if (strcmp(argv[i], "--perf-counters") == 0) perfCountersEnabled = 1;
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) metricsSpec = argv[++i];
+        else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+            metricsIntervalMs = atoi(argv[++i]);
+            if (metricsIntervalMs < 10) metricsIntervalMs = 10;
+        }
+        else if (strcmp(argv[i], "--bench-counters") == 0) {
+            int frames = 300;
+            const char* jsonPath = NULL;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) frames = atoi(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-') jsonPath = argv[++i];
+            return RunCounterBenchmark(frames > 0 ? frames : 1, jsonPath);
+        }
+        else if (strcmp(argv[i], "--sound-sink") == 0 && i + 1 < argc) {
+            soundSpec = argv[++i];
+            soundSpecGiven = 1;
+        }
+        else if (strcmp(argv[i], "--bench-missions") == 0) return RunMissionBenchmark();
+        else if (strcmp(argv[i], "--bench-pickups") == 0) {
+            int coinTotal = 2000;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) coinTotal = atoi(argv[++i]);
+            return RunPickupBenchmark(coinTotal > 0 ? coinTotal : 1);
+        }
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) streamPath = argv[++i];
+        else if (strcmp(argv[i], "--make-stream") == 0 && i + 1 < argc) {
+            const char* path = argv[++i];
+            int chunkTotal = 100;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) chunkTotal = atoi(argv[++i]);
+            if (!BuildStreamLevel(path, chunkTotal)) {
+                printf("Cannot write %s (1-%d chunks)\n", path, MAX_CHUNKS);
+                return 2;
+            }
+            return 0;
+        }
+        else if (strcmp(argv[i], "--bench-stream") == 0) {
+            int chunkTotal = 1000;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) chunkTotal = atoi(argv[++i]);
+            return RunStreamBenchmark(chunkTotal > 0 && chunkTotal <= MAX_CHUNKS ? chunkTotal : 1000);
+        }
+        else if (strcmp(argv[i], "--verify-missions") == 0) return VerifyMissions();
+        else if (strcmp(argv[i], "--bench-snapshot") == 0) {
+            int pointTotal = 100000;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) pointTotal = atoi(argv[++i]);
+            return RunSnapshotBenchmark(pointTotal > 0 ? pointTotal : 1);
+        }
+        else if (strcmp(argv[i], "--solve") == 0) {
+            int candidates = 2000;
+            const char* path = "solution.rgr";
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) candidates = atoi(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-') path = argv[++i];
+            return RunSolver(argv[0], candidates > 0 ? candidates : 1, path);
+        }
+        else if (strcmp(argv[i], "--dict") == 0 && i + 1 < argc) dictPath = argv[++i];
+        else if (strcmp(argv[i], "--word-length") == 0 && i + 2 < argc) {
+            dictMinLength = atoi(argv[++i]);
+            dictMaxLength = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--difficulty") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            dictDifficulty = strcmp(name, "easy") == 0 ? DICT_EASY : strcmp(name, "medium") == 0 ? DICT_MEDIUM :
+                strcmp(name, "hard") == 0 ? DICT_HARD : -1;
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) jobThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bench-jobs") == 0) {
+            int frames = 600;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) frames = atoi(argv[++i]);
+            return RunJobBenchmark(frames > 0 ? frames : 1);
+        }
+        else if (strcmp(argv[i], "--no-pipeline") == 0) pipelineEnabled = 0;
+        else if (strcmp(argv[i], "--stats") == 0) sessionStats = 1;
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            frameRate = atoi(argv[++i]);
+            if (frameRate < 1 || frameRate > 1000) frameRate = 30;
+        }
+        else if (strcmp(argv[i], "--bench-pacing") == 0) {
+            int frames = 300;
+            int rate = 60;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) frames = atoi(argv[++i]);
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) rate = atoi(argv[++i]);
+            return RunPacingBenchmark(frames > 0 ? frames : 1, rate > 0 && rate <= 1000 ? rate : 60);
+        }
+        else if (strcmp(argv[i], "--bench-input") == 0) {
+            int taps = 200;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) taps = atoi(argv[++i]);
+            return RunInputBenchmark(taps > 0 ? taps : 1);
+        }
+        else if (strcmp(argv[i], "--bench-pipeline") == 0) {
+            int frames = 300;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) frames = atoi(argv[++i]);
+            return RunPipelineBenchmark(frames > 0 ? frames : 1);
+        }
+        else if (strcmp(argv[i], "--bench-pick") == 0) {
+            int pointTotal = 50000;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) pointTotal = atoi(argv[++i]);
+            return RunPickBenchmark(pointTotal > 0 ? pointTotal : 1);
+        }
+        else if (strcmp(argv[i], "--bench-dict") == 0) {
+            int wordTotal = 500000;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) wordTotal = atoi(argv[++i]);
+            return RunDictionaryBenchmark(wordTotal > 0 ? wordTotal : 1);
+        }
+        else if (strcmp(argv[i], "--balance") == 0) {
+            int runs = 1000;
+            const char* path = "balance.csv";
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) runs = atoi(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-') path = argv[++i];
+            return RunBalance(argv[0], runs > 0 ? runs : 1, path);
+        }
+        else if (strcmp(argv[i], "--balance-worker") == 0 && i + 3 < argc) {
+            return RunBalanceWorker(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+        }
+        else if (strcmp(argv[i], "--solve-worker") == 0 && i + 7 < argc) {
+            SolverStart start = { atoi(argv[i + 4]), atoi(argv[i + 5]), atoi(argv[i + 6]),
+                (unsigned int)strtoul(argv[i + 7], NULL, 10), 0.0f };
+            return RunSolveWorker(atoi(argv[i + 1]), (unsigned int)strtoul(argv[i + 2], NULL, 10), atoi(argv[i + 3]), &start);
+        }
+        else {
+            printf("Usage: %s [--record FILE] [--replay FILE [--headless]] [--cast FILE] [--frame-trace CSV]\n"
+                "       [--sound-sink null|wav:FILE|waveout] [--bench-snapshot [POINTS]]\n"
+                "       [--bench-missions] [--verify-missions] [--bench-pickups [COINS]]\n"
+                "       [--stream LEVEL] [--make-stream LEVEL [CHUNKS]] [--bench-stream [CHUNKS]]\n"
+                "       [--solve [CANDIDATES] [REPLAY]] [--balance [RUNS] [CSV]]\n"
+                "       [--dict FILE [--word-length MIN MAX] [--difficulty easy|medium|hard]] [--bench-dict [WORDS]]\n"
+                "       [--bench-pick [POINTS]] [--jobs THREADS] [--bench-jobs [FRAMES]]\n"
+                "       [--no-pipeline] [--bench-pipeline [FRAMES]] [--bench-input [TAPS]]\n"
+                "       [--fps RATE] [--bench-pacing [FRAMES] [RATE]] [--time-histogram FILE] [--stats]\n"
+                "       [--perf-counters] [--bench-counters [FRAMES] [JSON]]\n"
+                "       [--metrics FILE|unix:PATH [--metrics-interval MS]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (headlessMode && !replayPath) {
+        printf("--headless requires --replay\n");
+        return 2;
+    }
+    if (headlessMode && castPath) {
+        printf("--cast needs a screen; it cannot be combined with --headless\n");
+        return 2;
+    }
+    if (!LoadMissions()) return 2;
+    if (dictPath) {
+        if (!LoadDictionary(dictPath)) {
+            printf("Cannot load dictionary %s\n", dictPath);
+            return 2;
+        }
+        if (CountDictWords(dictMinLength, dictMaxLength, dictDifficulty) == 0) {
+            printf("No words in %s match the length and difficulty filters\n", dictPath);
+            return 2;
+        }
+    }
+    if (tracePath && !StartFrameTrace(tracePath)) {
+        printf("Cannot create frame trace %s\n", tracePath);
+        StopStartupServices();
+        return 2;
+    }
+    if (castPath && !StartCastRecording(castPath)) {
+        printf("Cannot create cast file %s\n", castPath);
+        StopStartupServices();
+        return 2;
+    }
+    if (!headlessMode && !StartSoundEngine(soundSpec)) {
+        if (soundSpecGiven) {
+            printf("Cannot open sound sink %s\n", soundSpec);
+            StopStartupServices();
+            return 2;
+        }
+        StartSoundEngine("null");
+    }
+    if (metricsSpec && !StartMetricsExporter(metricsSpec, metricsIntervalMs)) {
+        printf("Cannot export metrics to %s\n", metricsSpec);
+        StopStartupServices();
+        return 2;
+    }
+
     // Console setup
-    SetConsoleCP(437);
-    SetConsoleOutputCP(437);
+    HANDLE hOut = NULL;
+    if (!headlessMode) {
+        SetConsoleCP(437);
+        SetConsoleOutputCP(437);
 
-    HANDLE hOut = CreateConsoleScreenBuffer(GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
-    SetConsoleActiveScreenBuffer(hOut);
+        hOut = CreateConsoleScreenBuffer(GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
+        SetConsoleActiveScreenBuffer(hOut);
 
-    CONSOLE_CURSOR_INFO cursorInfo;
-    cursorInfo.dwSize = 1;
-    cursorInfo.bVisible = 0;
-    SetConsoleCursorInfo(hOut, &cursorInfo);
+        CONSOLE_CURSOR_INFO cursorInfo;
+        cursorInfo.dwSize = 1;
+        cursorInfo.bVisible = 0;
+        SetConsoleCursorInfo(hOut, &cursorInfo);
 
-    system("title ASCII Physics Game");
+        SetConsoleTitleA("ASCII Physics Game");
+    }
 
     // Initialize systems
     InitInputManager();
@@ -2677,28 +9487,73 @@ int main() {
     gameStats.missionsCompleted = 0;
     gameStats.coins = 100;  // Starting coins
 
-    // Load saved game
-    LoadGame();
+    // Load saved game (a replay brings its own profile)
+    if (replayPath) {
+        if (!StartReplay(replayPath)) {
+            if (!headlessMode) SetConsoleActiveScreenBuffer(GetStdHandle(STD_OUTPUT_HANDLE));
+            printf("Cannot read replay file %s\n", replayPath);
+            StopStartupServices();
+            return 2;
+        }
+    }
+    else {
+        LoadGame();
+        if (recordPath && !StartRecording(recordPath)) {
+            SetConsoleActiveScreenBuffer(GetStdHandle(STD_OUTPUT_HANDLE));
+            printf("Cannot create recording file %s\n", recordPath);
+            StopStartupServices();
+            return 2;
+        }
+        StartSaveService();
+    }
+
+    StartJobSystem(jobThreads >= 0 ? jobThreads : (int)std::thread::hardware_concurrency() - 1);
+    // With no spare core the render thread only adds a world copy and a
+    // handoff per frame, so the game thread draws
+    if (!headlessMode && pipelineEnabled && std::thread::hardware_concurrency() > 1) StartFramePipeline(hOut);
+    if (!replayPath) StartInputThread(0);
 
     // Game loop variables
-    int frameTime = 33;
-    DWORD lastTime = GetTickCount();
+    DWORD sessionStart = GetTickCount();
+    StartFramePacer(&framePacer, frameRate);
+    long long lastFrameNs = GetTimeNs();
+    long long frameNsCarry = 0;     // sub-millisecond remainder of frame times
+    DWORD unsteppedMs = 0;          // frame time since the last world step
     srand(time(NULL));
+    SeedRandom();
 
     int showMissionStart = 0;
+    long long idleNs = 0;
+    int loopFrames = 0;
+    double cpuStart = ProcessCpuSeconds();
 
     // Main game loop
     while (1) {
-        DWORD startTime = GetTickCount();
-        float deltaTime = (startTime - lastTime) / 1000.0f;
-        lastTime = startTime;
+        long long frameStartNs = BeginPacedFrame(&framePacer);
+        loopFrames++;
+        frameNsCarry += frameStartNs - lastFrameNs;
+        lastFrameNs = frameStartNs;
+        DWORD frameMs = (DWORD)(frameNsCarry / 1000000);
+        frameNsCarry -= frameMs * 1000000LL;
+        if (frameMs > MAX_FRAME_MS) frameMs = MAX_FRAME_MS;
+
+        // Replays substitute the recorded frame time, step count and input
+        int steps = TakeSimSteps(frameMs);
+        if (!BeginInputFrame(&frameMs, &steps)) break;
+        float deltaTime = frameMs / 1000.0f;
+        simSteps = steps;
+
+        // Mission checks share the time since the last step between steps
+        unsteppedMs += frameMs;
+        float stepTime = steps > 0 ? unsteppedMs / 1000.0f / steps : 0.0f;
+        if (steps > 0) unsteppedMs = 0;
 
         // Update game time and stats
         gameTime += deltaTime;
         gameStats.totalPlayTime += deltaTime;
 
         // Update input manager
-        UpdateInputManager();
+        UpdateInputManager(frameMs);
 
         // Global hotkeys - disabled in active Hangman gameplay
         if (currentMode != 3 || hangmanGameOver) {
@@ -2731,35 +9586,34 @@ int main() {
             }
             else {
                 currentMode = 0;
-                Sleep(200);
             }
         }
 
         // Mode-specific handling
         if (currentMode == 0) {
             // Main Menu
-            ShowMainMenu(hOut);
+            if (!headlessMode) ShowMainMenu(hOut);
 
-            if (IsKeyPressed(VK_UP)) {
+            if (IsKeyRepeated(VK_UP)) {
                 menuSelection--;
                 if (menuSelection < 0) menuSelection = 4;
                 PlaySoundClick();
-                Sleep(100);
             }
-            if (IsKeyPressed(VK_DOWN)) {
+            if (IsKeyRepeated(VK_DOWN)) {
                 menuSelection++;
                 if (menuSelection > 4) menuSelection = 0;
                 PlaySoundClick();
-                Sleep(100);
             }
 
             if (IsKeyPressed(VK_RETURN)) {
                 if (menuSelection == 0) {
                     // Sandbox Mode
                     currentMode = 1;
-                    ClearWorld();
-                    SpawnRagdoll(WIDTH / 2, 10);
-                    isSimulating = 0;
+                    if (!streamPath || !StartStreamSandbox()) {
+                        ClearWorld();
+                        SpawnRagdoll(WIDTH / 2, 10);
+                        isSimulating = 0;
+                    }
                     PlaySoundClick();
                 }
                 else if (menuSelection == 1) {
@@ -2784,16 +9638,15 @@ int main() {
                 }
                 else if (menuSelection == 4) {
                     // Exit Game
-                    SaveGame();  // Save before exiting
+                    MarkProfileDirty();  // Flushed by StopSaveService
                     break;
                 }
-                Sleep(200);
             }
         }
         else if (currentMode == 2) {
             // Mission Mode
             if (showMissionStart) {
-                DrawMissionStartScreen(hOut, currentMission);
+                if (!headlessMode) DrawMissionStartScreen(hOut, currentMission);
                 if (IsKeyPressed(VK_RETURN)) {
                     showMissionStart = 0;
                     InitMission(currentMission);
@@ -2801,7 +9654,7 @@ int main() {
                 }
             }
             else if (missionComplete == 1) {
-                ShowMissionComplete(hOut);
+                if (!headlessMode) ShowMissionComplete(hOut);
 
                 if (IsKeyPressed(VK_RETURN)) {
                     currentMission++;
@@ -2813,72 +9666,25 @@ int main() {
                         showMissionStart = 1;
                     }
                     PlaySoundClick();
-                    Sleep(200);
                 }
             }
             else if (missionFailed == 1) {
-                ShowMissionFailed(hOut);
+                if (!headlessMode) ShowMissionFailed(hOut);
 
                 if (IsKeyPressed('R')) {
                     showMissionStart = 1;
                     PlaySoundClick();
-                    Sleep(200);
                 }
             }
             else {
                 // Active mission gameplay
-                if (IsKeyPressed(VK_SPACE)) {
-                    isSimulating = (isSimulating == 1) ? 0 : 1;
-                    PlaySoundClick();
-                    Sleep(100);
-                }
-
                 if (IsKeyPressed('R')) {
                     showMissionStart = 1;
                     PlaySoundClick();
-                    Sleep(100);
-                }
-
-                if (IsKeyPressed('D')) {
-                    dragMode = (dragMode == 1) ? 0 : 1;
-                    dragPoint = -1;
-                    PlaySoundDrag();
-                    Sleep(100);
-                }
-
-                UpdateCursor();
-
-                if (IsKeyPressed(VK_RETURN) && dragMode == 1) {
-                    int nearPoint = FindNearestPoint(curX, curY, 5.0f);
-                    if (nearPoint >= 0) {
-                        if (points[nearPoint].isLocked == 1) {
-                            points[nearPoint].isLocked = 0;
-                            dragPoint = -1;
-                        }
-                        else {
-                            points[nearPoint].isLocked = 1;
-                            dragPoint = nearPoint;
-                        }
-                        PlaySoundClick();
-                    }
-                    Sleep(100);
-                }
-
-                if (dragPoint >= 0 && points[dragPoint].isLocked == 1) {
-                    float targetX = (float)curX;
-                    float targetY = (float)curY;
-                    points[dragPoint].x = points[dragPoint].x + (targetX - points[dragPoint].x) * DRAG_SMOOTHNESS;
-                    points[dragPoint].y = points[dragPoint].y + (targetY - points[dragPoint].y) * DRAG_SMOOTHNESS;
-                    points[dragPoint].oldX = points[dragPoint].x;
-                    points[dragPoint].oldY = points[dragPoint].y;
-                }
-
-                if (isSimulating == 1) {
-                    UpdatePhysics();
-                    UpdateMissionWithStats(deltaTime);
                 }
+                UpdateActiveMission(stepTime);
 
-                DrawScreen(hOut);
+                if (!headlessMode) DrawScreen(hOut);
             }
         }
         else if (currentMode == 3) {
@@ -2888,13 +9694,11 @@ int main() {
                 for (int key = 'A'; key <= 'Z'; key++) {
                     if (IsKeyPressed(key)) {
                         ProcessHangmanGuess((char)key);
-                        Sleep(100);
                     }
                 }
                 for (int key = 'a'; key <= 'z'; key++) {
                     if (IsKeyPressed(key)) {
                         ProcessHangmanGuess((char)key);
-                        Sleep(100);
                     }
                 }
 
@@ -2902,7 +9706,6 @@ int main() {
                 if (IsKeyPressed(VK_SPACE)) {
                     isSimulating = (isSimulating == 1) ? 0 : 1;
                     PlaySoundClick();
-                    Sleep(100);
                 }
             }
             else {
@@ -2910,54 +9713,70 @@ int main() {
                 if (IsKeyPressed('R')) {
                     InitHangmanMode();
                     PlaySoundClick();
-                    Sleep(200);
                 }
             }
 
-            if (isSimulating == 1) {
-                UpdatePhysics();
+            for (int s = 0; s < simSteps; s++) {
+                if (isSimulating == 1) UpdatePhysics();
+
+                // Victory fountain (kept out of the draw path so replays match)
+                if (hangmanGameOver && hangmanWon) SpawnSuccessParticles(WIDTH / 2, HEIGHT / 2 - 5);
             }
 
-            DrawScreen(hOut);
+            if (!headlessMode) DrawScreen(hOut);
         }
         else if (currentMode == 4) {
             // Shop Mode
             HandleShopInput();
-            DrawScreen(hOut);
+            if (!headlessMode) DrawScreen(hOut);
         }
         else {
             // Sandbox Mode (currentMode == 1)
             if (IsKeyPressed(VK_SPACE)) {
                 isSimulating = (isSimulating == 1) ? 0 : 1;
                 PlaySoundClick();
-                Sleep(100);
             }
 
             if (IsKeyPressed('R')) {
-                ClearWorld();
+                if (levelStream.active) StartStreamSandbox();
+                else ResetSandbox();
                 PlaySoundClick();
-                Sleep(100);
             }
 
             if (IsKeyPressed('D')) {
                 dragMode = (dragMode == 1) ? 0 : 1;
                 dragPoint = -1;
                 PlaySoundDrag();
-                Sleep(100);
             }
 
             if (IsKeyPressed('U')) {
                 Undo();
                 PlaySoundClick();
-                Sleep(100);
+            }
+
+            if (IsKeyPressed('Y')) {
+                Redo();
+                PlaySoundClick();
+            }
+
+            // Snapshots cover the whole world, not a streamed window
+            if (IsKeyPressed(VK_F5)) {
+                WorldView view = CurrentWorldView();
+                if (!levelStream.active && SaveSnapshot(SNAPSHOT_FILE, &view)) PlaySoundClick();
+                else PlaySoundFailure();
+            }
+
+            if (IsKeyPressed(VK_F9)) {
+                if (!levelStream.active && LoadSnapshot(SNAPSHOT_FILE)) PlaySoundClick();
+                else PlaySoundFailure();
             }
 
             // Tool selection
-            if (IsKeyPressed('1')) { currentTool = 1; PlaySoundClick(); Sleep(100); }
-            if (IsKeyPressed('2')) { currentTool = 2; PlaySoundClick(); Sleep(100); }
-            if (IsKeyPressed('3')) { currentTool = 3; PlaySoundClick(); Sleep(100); }
-            if (IsKeyPressed('4')) { currentTool = 4; PlaySoundClick(); Sleep(100); }
-            if (IsKeyPressed('5')) { currentTool = 5; PlaySoundClick(); Sleep(100); }
+            if (IsKeyPressed('1')) { currentTool = 1; PlaySoundClick(); }
+            if (IsKeyPressed('2')) { currentTool = 2; PlaySoundClick(); }
+            if (IsKeyPressed('3')) { currentTool = 3; PlaySoundClick(); }
+            if (IsKeyPressed('4')) { currentTool = 4; PlaySoundClick(); }
+            if (IsKeyPressed('5')) { currentTool = 5; PlaySoundClick(); }
 
             UpdateCursor();
 
@@ -2966,26 +9785,26 @@ int main() {
                     if (currentTool == 4) {
                         // Rope mode
                         if (ropeStartX < 0) {
-                            ropeStartX = curX;
+                            ropeStartX = curX + cameraX;
                             ropeStartY = curY;
                             PlaySoundClick();
                         }
                         else {
-                            SpawnRope(ropeStartX, ropeStartY, curX, curY);
+                            SpawnRope(ropeStartX, ropeStartY, curX + cameraX, curY);
                             ropeStartX = -1;
                             ropeStartY = -1;
                         }
                     }
                     else {
                         // Other tools
-                        if (currentTool == 1) SpawnRagdoll(curX, curY);
-                        else if (currentTool == 2) SpawnMovableBox(curX, curY);
-                        else if (currentTool == 3) SpawnBomb(curX, curY);
-                        else if (currentTool == 5) SpawnPlatform(curX, curY, 15);
+                        if (currentTool == 1) SpawnRagdoll(curX + cameraX, curY);
+                        else if (currentTool == 2) SpawnMovableBox(curX + cameraX, curY);
+                        else if (currentTool == 3) SpawnBomb(curX + cameraX, curY);
+                        else if (currentTool == 5) SpawnPlatform(curX + cameraX, curY, 15);
                     }
                 }
                 else if (dragMode == 1) {
-                    int nearPoint = FindNearestPoint(curX, curY, 5.0f);
+                    int nearPoint = FindNearestPoint(curX + cameraX, curY, 5.0f);
                     if (nearPoint >= 0) {
                         if (points[nearPoint].isLocked == 1) {
                             points[nearPoint].isLocked = 0;
@@ -2998,33 +9817,91 @@ int main() {
                         PlaySoundClick();
                     }
                 }
-                Sleep(100);
             }
 
             if (dragPoint >= 0 && points[dragPoint].isLocked == 1) {
-                float targetX = (float)curX;
+                float targetX = (float)(curX + cameraX);
                 float targetY = (float)curY;
                 points[dragPoint].x = points[dragPoint].x + (targetX - points[dragPoint].x) * DRAG_SMOOTHNESS;
                 points[dragPoint].y = points[dragPoint].y + (targetY - points[dragPoint].y) * DRAG_SMOOTHNESS;
                 points[dragPoint].oldX = points[dragPoint].x;
                 points[dragPoint].oldY = points[dragPoint].y;
+                positionRevision++;
             }
 
+            UpdateStreaming();
             if (isSimulating == 1) {
-                UpdatePhysics();
+                for (int s = 0; s < simSteps; s++) UpdatePhysics();
             }
 
-            DrawScreen(hOut);
+            if (!headlessMode) DrawScreen(hOut);
         }
 
-        // Frame rate control
-        DWORD elapsed = GetTickCount() - startTime;
-        if (elapsed < frameTime) {
-            Sleep(frameTime - elapsed);
+        if (metricsExporter.running) UpdateWorldGauges();
+        long long workNs = GetTimeNs() - frameStartNs;
+        RecordTime(&frameTimes, workNs);
+        ObserveMetric(METRIC_FRAME_SECONDS, workNs);
+        if (frameTrace.file) TraceFrame(frameMs, workNs);
+
+        // Frame rate control. When nothing on screen can change without a
+        // key, wait for one instead of drawing the same frame again.
+        int idleWait = inputQueue.running ? IdleWaitMs(showMissionStart) : 0;
+        if (idleWait != 0 && !headlessMode) {
+            long long waitStart = GetTimeNs();
+            WaitForInput(idleWait);
+            idleNs += GetTimeNs() - waitStart;
+            ResetFramePacer(&framePacer);
+            simResync = 1;
+        }
+        else if (!headlessMode) {
+            WaitNextFrame(&framePacer);
         }
     }
 
-    SaveGame();
-    SetConsoleActiveScreenBuffer(GetStdHandle(STD_OUTPUT_HANDLE));
-    return 0;
+    MarkProfileDirty();
+    StopSaveService();
+    StopStreaming();
+    StopFramePipeline();
+    StopInputThread();
+    StopFramePacer();
+    StopMetricsExporter();
+    if (!headlessMode) SetConsoleActiveScreenBuffer(GetStdHandle(STD_OUTPUT_HANDLE));
+    StopCastRecording();
+    StopFrameTrace();
+    if (histogramPath && !WriteTimeHistograms(histogramPath)) {
+        printf("Cannot write time histogram %s\n", histogramPath);
+    }
+    if (sessionStats && !replayPath) {
+        double seconds = (GetTickCount() - sessionStart) / 1000.0;
+        double cpu = ProcessCpuSeconds() - cpuStart;
+        printf("Session: %.1f s, %d frames, %.1f s waiting for input, CPU %.2f s (%.1f%%), %d of %d rows redrawn\n",
+            seconds, loopFrames, idleNs / 1e9, cpu, seconds > 0 ? 100.0 * cpu / seconds : 0.0,
+            rowsWritten, rowsWritten + rowsSkipped);
+    }
+    if (sessionStats && !replayPath && !headlessMode) {
+        char pacingReport[200];
+        FormatFrameJitter(&framePacer, pacingReport, sizeof(pacingReport));
+        printf("Pacing: %s\n", pacingReport);
+    }
+    if (sessionStats && inputQueue.latencyCount > 0) {
+        char inputReport[160];
+        FormatInputLatency(inputReport, sizeof(inputReport));
+        printf("Input: %s\n", inputReport);
+    }
+    StopSoundEngine();
+    char jobReport[160];
+    FormatJobUtilization(jobReport, sizeof(jobReport));
+    StopJobSystem();
+
+    int replayFrames = inputLog.frameCount;
+    int replaying = (inputLog.mode == INPUT_LOG_REPLAY);
+    int mismatch = FinishInputLog();
+    if (replaying) {
+        printf("Jobs: %s\n", jobReport);
+        float seconds = (GetTickCount() - sessionStart) / 1000.0f;
+        printf("Replay: %d frames in %.3f s (%.0f frames/s), world hash %016llx: %s\n",
+            replayFrames, seconds, seconds > 0 ? replayFrames / seconds : 0.0f, WorldHash(),
+            !inputLog.hasExpectedHash ? "no reference hash" : mismatch ? "MISMATCH" : "match");
+    }
+    return mismatch;
 }
\ No newline at end of file